@@ -6,11 +6,19 @@
 #define CPPBAZAARBOT_AUCTION_HOUSE_H
 
 #include <random>
+#include <cmath>
 #include <algorithm>
 #include <utility>
 #include <memory>
+#include <deque>
+#include <optional>
+#include <stdexcept>
 
+#include "../common/executor.h"
 #include "../common/history.h"
+#include "../common/sim_clock.h"
+#include "../common/inventory_ledger.h"
+#include "production.h"
 
 #include "../common/agent.h"
 #include "../common/messages.h"
@@ -64,6 +72,58 @@ namespace ah {
     CREATED_ENTITY,
     ASSIGNED_PARTITION
   };
+
+  using RegisterCommand = market::RegisterCommandComponent::Commands::RegisterCommand;
+  using AssignPartitionCommand = improbable::restricted::Worker::Commands::AssignPartition;
+  using HandOffCommand = market::HandOffCommandComponent::Commands::HandOffTrader;
+  using RequestHandOffCommand = trader::HandOffRequestComponent::Commands::RequestHandOff;
+
+  // A registration in flight. Each SpatialOS response moves it one step on, so the AH never waits on them.
+  struct PendingRegistration {
+    worker::RequestId<worker::IncomingCommandRequest<RegisterCommand>> request_id;
+    messages::RegisterRequest request;
+    worker::EntityId caller_worker_entity_id;
+    worker::EntityId entity_id = -1;
+    messages::AIRole assigned_role = messages::AIRole::NONE;
+    std::int32_t members = 1; // cohort size, once accepted
+    RegisterProgress progress = NONE;
+  };
+
+  // Everything about a new AI trader that doesn't depend on its entity ID, built once per role
+  struct TraderTemplate {
+    worker::Entity entity; // AIBuildings + starting Inventory
+    improbable::ComponentSetInterest_Query market_query;
+    std::shared_ptr<const std::vector<std::int32_t>> recipes_by_priority;
+    double idle_tax;
+  };
+
+  // The partition shared by every AI trader hosted on one worker. A worker holds a single partition,
+  // so traders are delegated to this rather than each being a partition of its own.
+  struct WorkerPartition {
+    worker::EntityId partition_id = -1;
+    bool assigned = false;
+    std::vector<std::uint32_t> waiting; // registrations holding an entity ID until the partition is assigned
+    std::size_t traders = 0; // AI trader entities currently delegated to this partition
+  };
+
+  // One AI trader (or cohort of them) in the AH's production ledger. Its recipe list is shared with
+  // the role template.
+  struct Producer {
+    worker::EntityId entity_id;
+    std::shared_ptr<const std::vector<std::int32_t>> recipes_by_priority;
+    double idle_tax; // per member
+    std::int32_t members = 1;
+  };
+
+  // Controls how often market components are re-sent to subscribers.
+  // A listing only goes out when one of its fields has moved by more than its epsilon, and at most
+  // once per publish_interval_ms, independently of the matching tick rate.
+  struct PublishPolicy {
+    int publish_interval_ms = 100;
+    double price_epsilon = 0.01;
+    int net_supply_epsilon = 1;
+    int trade_volume_epsilon = 1;
+  };
 }
 class AuctionHouse : public Agent {
 public:
@@ -78,6 +138,15 @@ private:
     worker::Map<messages::AIRole, int> demographics = {};
 
     int TICK_TIME_MS; //ms
+    // Simulated time is read from `clock` once per tick, into tick_clock, which history and offer
+    // expiry use for the rest of the tick
+    const SimClock& clock;
+    LogicalClock tick_clock;
+    ah::PublishPolicy publish_policy;
+    std::int64_t last_publish_ms = 0;
+    bool demographics_dirty = true;
+    // Last published state of every market, indexed by MarketIndex(market_component_id)
+    worker::List<market::MarketListing> market_listings = InitialMarketListings();
     std::atomic<bool> queue_active = true;
 
     std::mutex bid_book_mutex;
@@ -90,19 +159,75 @@ private:
     std::mt19937 rng_gen = std::mt19937(std::random_device()());
     std::map<std::string, Commodity> known_commodities;
 
+    // Registrations in flight, keyed by the incoming register request's ID, and the outstanding
+    // SpatialOS requests for each of them (outgoing request ID -> registration key)
+    const std::uint32_t REGISTER_STEP_TIMEOUT_MS = 500;
+    // Largest cohort one AI trader entity may stand for; keeps pooled item counts well inside int32
+    const std::int32_t MAX_COHORT_MEMBERS = 100000;
+    std::map<std::uint32_t, ah::PendingRegistration> registrations;
+    std::map<std::uint32_t, std::uint32_t> create_entity_requests;
+    std::map<std::uint32_t, std::uint32_t> assign_partition_requests;
+
+    // AI trader partitions by the caller's worker entity ID, and their outstanding setup requests
+    std::map<worker::EntityId, ah::WorkerPartition> worker_partitions;
+    std::map<std::uint32_t, worker::EntityId> partition_create_requests;
+    std::map<std::uint32_t, worker::EntityId> partition_assign_requests;
+    std::unordered_map<worker::EntityId, worker::EntityId> trader_workers; // AI trader -> worker hosting it
+
+    // Every REBALANCE_INTERVAL_MS, if one worker hosts more than REBALANCE_SLACK traders over another,
+    // some of its traders are asked to hand themselves off (trader::HandOff) to the other
+    int REBALANCE_INTERVAL_MS = 5000;
+    std::size_t REBALANCE_SLACK = 8;
+    std::size_t MAX_HAND_OFFS_PER_REBALANCE = 32;
+    std::int64_t last_rebalance_ms = 0;
+    std::map<std::uint32_t, worker::EntityId> hand_off_requests; // request ID -> trader asked to move
+
+    // Pre-reserved entity IDs for new agents, topped up in blocks whenever it runs low
+    const std::uint32_t ENTITY_ID_POOL_BLOCK_SIZE = 256;
+    const std::size_t ENTITY_ID_POOL_LOW_WATER = 64;
+    std::deque<worker::EntityId> entity_id_pool;
+    std::optional<std::uint32_t> entity_id_pool_refill; // request ID of the in-flight reservation, if any
+    std::deque<std::uint32_t> waiting_for_entity_id; // registrations that found the pool empty
+
+    std::map<messages::AIRole, ah::TraderTemplate> trader_templates;
+
+    // Shared production recipes, published in the RecipeRegistry component. A recipe's id is its index.
+    worker::List<trader::Recipe> recipes;
+    std::map<std::string, std::int32_t> recipe_ids; // debug_name -> id
+    bool recipes_dirty = false;
+    production::RecipeBook recipe_book; // the same recipes, compiled for the production pass
+    production::UniformBatch production_rolls = production::UniformBatch(rng_gen);
+
+    // Production is run by the AH for every registered AI trader, once per PRODUCTION_INTERVAL_MS
+    int PRODUCTION_INTERVAL_MS = 50; // the AI trader worker's tick
+    std::int64_t last_production_ms = 0;
+    std::vector<ah::Producer> producers;
+    std::map<worker::EntityId, std::size_t> producer_index; // entity ID -> position in producers
+
+    // The AH's own copy of every trader's Inventory, with the full item map checkpointed back to the
+    // component once per INVENTORY_CHECKPOINT_INTERVAL_MS, and before a hand-off
+    InventoryLedger inventories = InventoryLedger(view);
+    int INVENTORY_CHECKPOINT_INTERVAL_MS = 2000;
+    std::int64_t last_inventory_checkpoint_ms = 0;
+
     std::map<std::string, std::vector<std::pair<BidOffer, BidResult>>> bid_book = {};
     std::map<std::string, std::vector<std::pair<AskOffer, AskResult>>> ask_book = {};
     std::unique_ptr<Logger> logger;
 
 public:
     double spread_profit = 0;
-    AuctionHouse(worker::Connection& connection, worker::View& view, int auction_house_id, int tick_time_ms, Log::LogLevel verbosity)
+    AuctionHouse(transport::Connection& connection, transport::View& view, int auction_house_id, int tick_time_ms, Log::LogLevel verbosity,
+                 const SimClock& clock = SimClock::Wall())
         : Agent(auction_house_id, connection, view)
         , unique_name(std::string("AH")+std::to_string(id))
-        , TICK_TIME_MS(tick_time_ms) {
+        , TICK_TIME_MS(tick_time_ms)
+        , clock(clock)
+        , tick_clock(clock.NowMs()) {
         logger = std::make_unique<SpatialLogger>(verbosity, unique_name, connection);
+        history.use_clock(tick_clock);
         ConstructInitialAuctionHouseEntity(auction_house_id);
         MakeCallbacks();
+        RefillEntityIdPool();
     }
 
     ~AuctionHouse() override {
@@ -117,6 +242,14 @@ public:
         destroyed = true;
     }
 
+    void SetPublishPolicy(const ah::PublishPolicy& policy) {
+        publish_policy = policy;
+    }
+
+    int Ticks() const {
+        return ticks;
+    }
+
     void SendDirect(Message outgoing_message, std::shared_ptr<Agent>& recipient) {
         logger->Log(Log::WARN, "Using SendDirect method to reach unregistered trader");
         logger->LogSent(recipient->id, Log::DEBUG, outgoing_message.ToString());
@@ -158,21 +291,37 @@ public:
     return RandomChoice(weights, rng_gen);
   }
 
-    void IncrementDemographic(messages::AIRole role) {
+    void IncrementDemographic(messages::AIRole role, int count = 1) {
       if (demographics.count(role) != 1) {
-        demographics[role] = 1;
+        demographics[role] = count;
       } else {
-        demographics[role] += 1;
+        demographics[role] += count;
       }
+      demographics_dirty = true;
     }
-    void DecrementDemographic(messages::AIRole role) {
+    void DecrementDemographic(messages::AIRole role, int count = 1) {
       if (demographics.count(role) != 1) {
         demographics[role] = 0;
       } else {
-        demographics[role] -= 1;
+        demographics[role] -= count;
       }
+      demographics_dirty = true;
+    }
+    void UpdateRecipeRegistryComponent() {
+      // Recipes are registered before the AH entity is necessarily ours, so wait until it is
+      if (!recipes_dirty || view.GetAuthority<market::ServerMarketComponentSet>(id) != worker::Authority::kAuthoritative) {
+        return;
+      }
+      recipes_dirty = false;
+      market::RecipeRegistry::Update registry_update;
+      registry_update.set_recipes(recipes);
+      connection.SendComponentUpdate<market::RecipeRegistry>(id, registry_update);
     }
     void UpdateDemographicInfoComponent() {
+      if (!demographics_dirty) {
+        return;
+      }
+      demographics_dirty = false;
       market::DemographicInfo::Update update_dems;
       update_dems.set_total_deaths(num_deaths);
       update_dems.set_role_counts(demographics);
@@ -183,31 +332,40 @@ public:
       }
       connection.SendComponentUpdate<market::DemographicInfo>(id, update_dems);
     }
-  template <class Tmarket>
-  void UpdatePriceInfoComponent(const std::string& commodity) {
-      static_assert(std::is_base_of<::worker::detail::ComponentMetaclass, Tmarket>::value, "T must inherit from ComponentMetaclass");
+  // Refreshes the commodity's entry in market_listings. Returns true if it moved enough to be re-published.
+  bool UpdateMarketListing(const Commodity& commodity) {
+      int index = MarketIndex(commodity.market_component_id);
+      if (index < 0 || index >= (int) market_listings.size()) {
+        return false; // not a published market
+      }
       int recent = 50*TICK_TIME_MS; // arbritrary choice
 
       // Get data
-      double curr_price = history.prices.t_average(commodity, TICK_TIME_MS);
-      double recent_price = history.prices.t_average(commodity, recent);
+      double curr_price = history.prices.t_average(commodity.name, TICK_TIME_MS);
+      double recent_price = history.prices.t_average(commodity.name, recent);
 
-      int curr_net_supply = history.net_supply.t_average(commodity, TICK_TIME_MS);
-      int recent_net_supply = history.net_supply.t_average(commodity, recent);
+      int curr_net_supply = history.net_supply.t_average(commodity.name, TICK_TIME_MS);
+      int recent_net_supply = history.net_supply.t_average(commodity.name, recent);
 
-      int recent_trade_volume = history.trades.t_total(commodity, recent);
+      int recent_trade_volume = history.trades.t_total(commodity.name, recent);
 
-      // Send update
+      // Only publish if something moved enough for subscribers to care
       market::PriceInfo info{curr_price, recent_price, curr_net_supply, recent_net_supply, recent_trade_volume};
-      info.set_curr_price(curr_price);
-
-
-      market::MarketListing listing;
+      auto& listing = market_listings[index];
+      if (!PriceInfoChanged(listing.price_info(), info)) {
+        return false;
+      }
+      listing.set_item({commodity.name, commodity.size, commodity.market_component_id});
       listing.set_price_info(info);
+      return true;
+    }
 
-      typename Tmarket::Update update_market;
-      update_market.set_listing(listing);
-      connection.SendComponentUpdate<Tmarket>(id, update_market);
+    bool PriceInfoChanged(const market::PriceInfo& before, const market::PriceInfo& after) const {
+      return std::abs(after.curr_price() - before.curr_price()) > publish_policy.price_epsilon
+          || std::abs(after.recent_price() - before.recent_price()) > publish_policy.price_epsilon
+          || std::abs(after.curr_net_supply() - before.curr_net_supply()) > publish_policy.net_supply_epsilon
+          || std::abs(after.recent_net_supply() - before.recent_net_supply()) > publish_policy.net_supply_epsilon
+          || std::abs(after.recent_trade_volume() - before.recent_trade_volume()) > publish_policy.trade_volume_epsilon;
     }
 
     double MostRecentBuyPrice(const std::string& commodity) const {
@@ -275,6 +433,14 @@ public:
         }
         history.initialise(new_commodity.name);
         known_commodities[new_commodity.name] = new_commodity;
+        int index = MarketIndex(new_commodity.market_component_id);
+        if (index >= (int) market_listings.size()) {
+          market_listings.resize(index + 1);
+        }
+        if (index >= 0 && index < (int) production::MAX_COMMODITIES) {
+          recipe_book.SetCommodity(index, new_commodity.name);
+        }
+        RebuildTraderTemplates();
 
         bid_book_mutex.lock();
         bid_book[new_commodity.name] = {};
@@ -285,39 +451,61 @@ public:
         ask_book_mutex.unlock();
     }
 
-    void Tick(int duration) {
-        std::int64_t expiry_ms = to_unix_timestamp_ms(std::chrono::system_clock::now()) + duration;
-        while (!destroyed) {
-            auto t1 = std::chrono::high_resolution_clock::now();
+    // Runs TickOnce every TICK_TIME_MS on the executor's main lane, until Shutdown()
+    Executor::TaskId Schedule(Executor& executor) {
+        return executor.Every(TICK_TIME_MS, 0, [this] {
+            if (destroyed) {
+                return;
+            }
+            auto t1 = std::chrono::steady_clock::now();
             TickOnce();
             ticks++;
-
-            std::chrono::duration<double, std::milli> elapsed_ms = std::chrono::high_resolution_clock::now() - t1;
+            std::chrono::duration<double, std::milli> elapsed_ms = std::chrono::steady_clock::now() - t1;
             int elapsed = elapsed_ms.count();
-            if (elapsed < TICK_TIME_MS) {
-                std::this_thread::sleep_for(std::chrono::milliseconds{TICK_TIME_MS - elapsed});
-            } else {
-                logger->Log(Log::WARN, "AH thread overran on tick "+ std::to_string(ticks) + ": took " + std::to_string(elapsed) +"/" + std::to_string(TICK_TIME_MS) + "ms )");
+            if (elapsed >= TICK_TIME_MS) {
+                logger->Log(Log::WARN, "AH overran on tick "+ std::to_string(ticks) + ": took " + std::to_string(elapsed) +"/" + std::to_string(TICK_TIME_MS) + "ms )");
             }
-            if (to_unix_timestamp_ms(std::chrono::system_clock::now()) > expiry_ms) {
-              logger->Log(Log::ERROR, "Shutting down (expiry time reached)");
-              Shutdown();
-            }
-        }
+        });
     }
-
     void TickOnce() {
+      std::int64_t now = clock.NowMs();
+      tick_clock.Set(now);
       for (const auto& item : known_commodities) {
         ResolveOffers(item.first);
       }
       logger->Log(Log::INFO, "Net spread profit for tick" + std::to_string(ticks) + ": " + std::to_string(spread_profit));
+
+      if (now - last_production_ms >= PRODUCTION_INTERVAL_MS) {
+        last_production_ms = now;
+        RunProductionPass();
+      }
+      if (now - last_rebalance_ms >= REBALANCE_INTERVAL_MS) {
+        last_rebalance_ms = now;
+        RebalanceWorkers();
+      }
+      if (now - last_inventory_checkpoint_ms >= INVENTORY_CHECKPOINT_INTERVAL_MS) {
+        last_inventory_checkpoint_ms = now;
+        inventories.Checkpoint([&](worker::EntityId entity_id, const trader::Inventory::Update& update) {
+          connection.SendComponentUpdate<trader::Inventory>(entity_id, update);
+        });
+      }
+
+      if (now - last_publish_ms < publish_policy.publish_interval_ms) {
+        return;
+      }
+      last_publish_ms = now;
+      UpdateRecipeRegistryComponent();
       UpdateDemographicInfoComponent();
-      UpdatePriceInfoComponent<market::FoodMarket>("food");
-      UpdatePriceInfoComponent<market::WoodMarket>("wood");
-      UpdatePriceInfoComponent<market::FertilizerMarket>("fertilizer");
-      UpdatePriceInfoComponent<market::OreMarket>("ore");
-      UpdatePriceInfoComponent<market::MetalMarket>("metal");
-      UpdatePriceInfoComponent<market::ToolsMarket>("tools");
+
+      bool markets_changed = false;
+      for (const auto& item : known_commodities) {
+        markets_changed |= UpdateMarketListing(item.second);
+      }
+      if (markets_changed) {
+        market::MarketSnapshot::Update snapshot_update;
+        snapshot_update.set_listings(market_listings);
+        connection.SendComponentUpdate<market::MarketSnapshot>(id, snapshot_update);
+      }
 
     }
     double QuerySpace(trader::InventoryData& inv) {
@@ -327,86 +515,107 @@ public:
       }
       return inv.capacity() - used_space;
     }
-    int ConsumeItem(trader::InventoryItem& item, int quantity) {
-      int actual_consumed = std::max(quantity, item.quantity());
-      item.set_quantity(item.quantity() - actual_consumed);
-      return actual_consumed;
-    };
-    int ProduceItem(trader::InventoryItem& item, int quantity, double capacity) {
-      int actual_produced = std::max(quantity, (int) std::floor(capacity * item.size()));
-      item.set_quantity(item.quantity() + actual_produced);
-      return actual_produced;
-    }
-    bool CheckTraderHasItem(std::string& commodity, int quantity, trader::InventoryData& inv) {
+    bool CheckTraderHasItem(const std::string& commodity, int quantity, const trader::InventoryData& inv) {
       if (inv.inv().count(commodity) != 1) return false;
-      if (inv.inv()[commodity].quantity() < quantity ) return false;
+      if (inv.inv().at(commodity).quantity() < quantity ) return false;
       return true;
     }
     bool CheckTraderHasMoney(double quantity, trader::InventoryData& inv) {
       return (inv.cash() >= quantity);
     }
-    bool CheckBuildingRequirementsMet(worker::List<trader::Consumption>& all_requirements, trader::InventoryData& inv) {
-      for (auto& requirement : all_requirements) {
-        if (!CheckTraderHasItem(requirement.item().name(), requirement.quantity(), inv)) {
-          return false;
-        }
+    // PRODUCTION
+    void RunProductionPass() {
+      for (const auto& producer : producers) {
+        RunProduction(producer);
       }
-      return true;
     }
-    std::optional<messages::ProductionResponse> TickWorkerProduction(const worker::CommandRequestOp<market::RequestProductionComponent::Commands::RequestProduction>& op) {
+
+    // Runs the first recipe (by priority) whose requirements are met, or charges idle tax if none are.
+    // A cohort runs it for all its members at once (RecipeBook::EvaluateCohort) and pays idle tax for each.
+    // The item changes and the ProductionResponse go out together in one Inventory update.
+    void RunProduction(const ah::Producer& producer) {
         ::worker::Map< std::string, std::int32_t> production = {};
         ::worker::Map< std::string, std::int32_t> overproduction = {};
         ::worker::Map< std::string, std::int32_t> consumption = {};
 
-        auto trader_buildings = view.Entities[op.Request.sender_id()].Get<trader::AIBuildings>();
-        auto trader_inventory = view.Entities[op.Request.sender_id()].Get<trader::Inventory>();
+        auto trader_inventory = inventories.Find(producer.entity_id);
         if (!trader_inventory) {
-          return {};
-        }
-        if (!trader_buildings) {
-          return {};
+          return;
         }
 
-        auto all_buildings = trader_buildings->buildings();
-        std::vector<trader::Building*> building_ptrs;
-        for (auto& item : all_buildings) {
-          building_ptrs.push_back(&item);
+        production::Outcome outcome;
+        bool produced;
+        if (producer.members > 1) {
+          produced = recipe_book.EvaluateCohort(*producer.recipes_by_priority, recipe_book.Load(*trader_inventory),
+                                                producer.members, rng_gen, outcome);
+        } else {
+          produced = recipe_book.Evaluate(*producer.recipes_by_priority, recipe_book.Load(*trader_inventory),
+                                          production_rolls, outcome);
         }
-        // Sort production options by priority
-        std::sort(building_ptrs.begin(), building_ptrs.end(),
-                  [](trader::Building* i,trader::Building* j){
-                    return i->priority() < j->priority();
-                  });
         trader::Inventory::Update inv_update;
-        for (auto& ptr : building_ptrs) {
-          if (CheckBuildingRequirementsMet(ptr->requires(), *trader_inventory)) {
-            std::uniform_real_distribution<> consumption_chance(0, 1);
-            auto final_inventory = trader_inventory->inv();
-            for (auto& requirement : ptr->requires()) {
-              if (requirement.chance() >= 1 || consumption_chance(rng_gen) < requirement.chance()) {
-                //consume
-                int actual = ConsumeItem(final_inventory[requirement.item().name()], requirement.quantity());
-                consumption[requirement.item().name()] = actual;
-              }
+        if (produced) {
+          for (std::size_t i = 0; i < production::MAX_COMMODITIES; i++) {
+            auto bit = production::RecipeBook::Bit(i);
+            if (!((outcome.consumed_mask | outcome.produced_mask) & bit)) {
+              continue;
             }
-            for (auto& result : ptr->produces()) {
-              if (result.chance() >= 1 || consumption_chance(rng_gen) < result.chance()) {
-                int actual = ProduceItem(final_inventory[result.item().name()], result.quantity(), QuerySpace(*trader_inventory));
-                production[result.item().name()] = actual;
-                overproduction[result.item().name()] = result.quantity() - actual; // overflow
-              }
+            const std::string& name = recipe_book.Name(i);
+            if (outcome.consumed_mask & bit) {
+              consumption[name] = outcome.consumed[i];
             }
-            inv_update.set_inv(final_inventory);
-            connection.SendComponentUpdate<trader::Inventory>(op.Request.sender_id(), inv_update);
-            return {{(trader_inventory->cash() < 0), production, overproduction, consumption}};
+            if (outcome.produced_mask & bit) {
+              production[name] = outcome.produced[i];
+              overproduction[name] = outcome.overproduced[i]; // overflow
+            }
+            trader::InventoryItem item = trader_inventory->inv()[name];
+            item.set_quantity(outcome.after.quantity[i]);
+            inventories.SetItem(producer.entity_id, *trader_inventory, inv_update, name, item);
           }
+        } else {
+          trader_inventory->set_cash(trader_inventory->cash() - producer.idle_tax*producer.members);
+          inv_update.set_cash(trader_inventory->cash());
         }
-        inv_update.set_cash(trader_inventory->cash() - trader_buildings->idle_tax());
-        connection.SendComponentUpdate<trader::Inventory>(op.Request.sender_id(), inv_update);
-        return {{(trader_inventory->cash() < 0), production, overproduction, consumption}};
+        messages::ProductionResponse report{(trader_inventory->cash() < 0), production, overproduction, consumption};
+        inv_update.add_production_report(report);
+        connection.SendComponentUpdate<trader::Inventory>(producer.entity_id, inv_update);
     };
+
+    void AddProducer(worker::EntityId entity_id, messages::AIRole role, std::int32_t members = 1) {
+      auto role_template = trader_templates.find(role);
+      if (role_template == trader_templates.end() || producer_index.count(entity_id) > 0) {
+        return;
+      }
+      producer_index[entity_id] = producers.size();
+      producers.push_back({entity_id, role_template->second.recipes_by_priority, role_template->second.idle_tax, members});
+    }
+
+    void RemoveProducer(worker::EntityId entity_id) {
+      auto index = producer_index.find(entity_id);
+      if (index == producer_index.end()) {
+        return;
+      }
+      // swap with the last entry to keep the ledger packed
+      std::size_t position = index->second;
+      producer_index.erase(index);
+      if (position != producers.size() - 1) {
+        producers[position] = std::move(producers.back());
+        producer_index[producers[position].entity_id] = position;
+      }
+      producers.pop_back();
+    }
 private:
     // SPATIALOS CONCEPTS
+    // Seed prices for each market, published until the first real update goes out
+    static worker::List<market::MarketListing> InitialMarketListings() {
+      return {
+          {{"food", 0.5, 3010}, {10.0, 10.0, 0, 0, 0}},
+          {{"wood", 1, 3011}, {3.0, 3.0, 0, 0, 0}},
+          {{"fertilizer", 0.1, 3012}, {11.0, 11.0, 0, 0, 0}},
+          {{"ore", 1, 3013}, {1.0, 1.0, 0, 0, 0}},
+          {{"metal", 1, 3014}, {2.0, 2.0, 0, 0, 0}},
+          {{"tools", 1, 3015}, {5.0, 5.0, 0, 0, 0}}
+      };
+    }
     bool ConstructInitialAuctionHouseEntity(worker::EntityId AH_id) {
       if (!IsConnected()) {
         return false;
@@ -422,81 +631,12 @@ private:
       AH_entity.Add<market::MakeOfferCommandComponent>({});
       AH_entity.Add<market::RequestProductionComponent>({});
       AH_entity.Add<market::RequestShutdownComponent>({});
+      AH_entity.Add<market::HandOffCommandComponent>({});
       AH_entity.Add<market::DemographicInfo>({demographics,
                                               0,
                                               0.0});
-      AH_entity.Add<market::FoodMarket>({{{
-                                              "food",
-                                              0.5,
-                                              3010
-                                          },
-                                             {
-                                                 10.0,
-                                                 10.0,
-                                                 0,
-                                                 0,
-                                                 0
-                                             }}});
-      AH_entity.Add<market::WoodMarket>({{{
-                                              "wood",
-                                              1,
-                                              3011
-                                          },
-                                             {
-                                                 3.0,
-                                                 3.0,
-                                                 0,
-                                                 0,
-                                                0
-                                             }}});
-      AH_entity.Add<market::FertilizerMarket>({{{
-                                                    "fertilizer",
-                                                    0.1,
-                                                    3012
-                                                },
-                                                   {
-                                                       11.0,
-                                                       11.0,
-                                                       0,
-                                                       0,
-                                                       0
-                                                   }}});
-      AH_entity.Add<market::OreMarket>({{{
-                                             "ore",
-                                             1,
-                                             3013
-                                         },
-                                            {
-                                                1.0,
-                                                1.0,
-                                                0,
-                                                0,
-                                                0
-                                            }}});
-      AH_entity.Add<market::MetalMarket>({{{
-                                               "metal",
-                                               1,
-                                               3014
-                                           },
-                                              {
-                                                  2.0,
-                                                  2.0,
-                                                  0,
-                                                  0,
-                                                  0
-                                              }}});
-      AH_entity.Add<market::ToolsMarket>({{{
-                                               "tools",
-                                               1,
-                                               3015
-                                           },
-                                              {
-                                                  5.0,
-                                                  5.0,
-                                                  0,
-                                                  0,
-                                                  0
-                                              }}});
+      AH_entity.Add<market::MarketSnapshot>({market_listings});
+      AH_entity.Add<market::RecipeRegistry>({recipes});
       auto result = connection.SendCreateEntityRequest(AH_entity, AH_id, {});
       if (!result) {
         connection.SendLogMessage(worker::LogLevel::kError, "AHWorker",
@@ -514,20 +654,25 @@ private:
       using RequestShutdownCommand = market::RequestShutdownComponent::Commands::RequestShutdown;
       using RequestProductionCommand = market::RequestProductionComponent::Commands::RequestProduction;
       view.OnCommandRequest<RequestProductionCommand>(
-          [&](const worker::CommandRequestOp<RequestProductionCommand>& op) {
-            auto res = TickWorkerProduction(op);
-            if (!res) {
-              connection.SendCommandFailure<RequestProductionCommand>(op.RequestId, "Failed to tick production");
-            }
-            connection.SendCommandResponse<RequestProductionCommand>(op.RequestId, *res);
+          [&](const transport::CommandRequestOp<RequestProductionCommand>& op) {
+            // Production only runs in the AH's own pass: running it here as well would let any caller
+            // produce for any trader as often as it likes. Reports arrive as Inventory production_report events.
+            connection.SendCommandFailure<RequestProductionCommand>(
+                op.RequestId, "Production runs on the auction house's schedule; see the Inventory production_report event");
           });
       view.OnCommandRequest<RequestShutdownCommand>(
-          [&](const worker::CommandRequestOp<RequestShutdownCommand>& op) {
+          [&](const transport::CommandRequestOp<RequestShutdownCommand>& op) {
             worker::EntityId entity_id = op.Request.entity_id();
             int age_ticks = op.Request.age_ticks();
-            DecrementDemographic(op.Request.role());
-            num_deaths += 1;
-            total_age += age_ticks;
+            // a cohort's members all go together
+            auto producer = producer_index.find(entity_id);
+            int members = (producer != producer_index.end()) ? producers[producer->second].members : 1;
+            DecrementDemographic(op.Request.role(), members);
+            RemoveProducer(entity_id);
+            ForgetTraderWorker(entity_id);
+            inventories.Erase(entity_id);
+            num_deaths += members;
+            total_age += age_ticks*members;
 
             logger->Log(Log::INFO, "Deregistered trader "+std::to_string(entity_id));
 
@@ -536,7 +681,7 @@ private:
             connection.SendDeleteEntityRequest(entity_id, {});
           });
       view.OnCommandRequest<RegisterTraderCommand>(
-          [&](const worker::CommandRequestOp<RegisterTraderCommand>& op) {
+          [&](const transport::CommandRequestOp<RegisterTraderCommand>& op) {
             std::string req_type = "unknown";
             if (op.Request.type() == messages::AgentType::MONITOR) {
               req_type = "Monitor";
@@ -548,16 +693,30 @@ private:
             connection.SendLogMessage(worker::LogLevel::kInfo, "AuctionHouse",
                                       "Received register request.\nCallerWorkerEntityId: " + std::to_string(op.CallerWorkerEntityId)
                                       + " for new trader of type: " + req_type);
-
-          bool result = RegisterNewAgent(op);
-          if (!result) {
-            connection.SendCommandFailure<RegisterTraderCommand>(op.RequestId, "Auction House failed to create trader entities");
-            connection.SendLogMessage(worker::LogLevel::kWarn, "AuctionHouse",
-                                      "Failed to register new" + req_type +"trader with ID #" + std::to_string(result));
-          }});
+            StartRegistration(op);
+          });
+      view.OnCommandRequest<ah::HandOffCommand>(
+          [&](const transport::CommandRequestOp<ah::HandOffCommand>& op) {
+            HandOffTrader(op);
+          });
+      view.OnCommandResponse<ah::RequestHandOffCommand>(
+          [&](const transport::CommandResponseOp<ah::RequestHandOffCommand>& op) {
+            hand_off_requests.erase(op.RequestId.Id); // whether or not it went ahead
+          });
+      view.OnReserveEntityIdsResponse([&](const transport::ReserveEntityIdsResponseOp& op) {
+        OnEntityIdsReserved(op);
+      });
+      view.OnCreateEntityResponse([&](const transport::CreateEntityResponseOp& op) {
+        OnRegisteredEntityCreated(op);
+        OnWorkerPartitionCreated(op);
+      });
+      view.OnCommandResponse<ah::AssignPartitionCommand>(
+          [&](const transport::CommandResponseOp<ah::AssignPartitionCommand>& op) {
+            OnPartitionAssigned(op);
+          });
 
       view.OnCommandRequest<MakeBidOfferCommand>(
-          [&](const worker::CommandRequestOp<MakeBidOfferCommand>& op) {
+          [&](const transport::CommandRequestOp<MakeBidOfferCommand>& op) {
             BidOffer bid = {op.RequestId,
                             static_cast<int>(op.Request.sender_id()),
                             op.Request.good(),
@@ -574,7 +733,7 @@ private:
             connection.SendCommandResponse<MakeBidOfferCommand>(op.RequestId, {true});
           });
       view.OnCommandRequest<MakeAskOfferCommand>(
-          [&](const worker::CommandRequestOp<MakeAskOfferCommand>& op) {
+          [&](const transport::CommandRequestOp<MakeAskOfferCommand>& op) {
             // Basic check for validity (more checking is done at resolution-time)
             if (op.Request.quantity() <= 0) {
               connection.SendCommandFailure<MakeAskOfferCommand>(op.RequestId, "Quantity offered must be > 0");
@@ -608,7 +767,7 @@ private:
             return false;
         }
 
-        auto inv = view.Entities[offer.sender_id].Get<trader::Inventory>();
+        auto inv = inventories.Find(offer.sender_id);
         if (!inv) {
           logger->Log(Log::WARN, "Missing entity for Bid stake: " + offer.ToString());
           return false;
@@ -624,7 +783,7 @@ private:
             logger->Log(Log::WARN, "Rejected nonsensical ask: " + offer.ToString());
             return false;
         }
-        auto inv = view.Entities[offer.sender_id].Get<trader::Inventory>();
+        auto inv = inventories.Find(offer.sender_id);
         if (!inv) {
           logger->Log(Log::WARN, "Missing entity for Ask stake: " + offer.ToString());
           return false;
@@ -651,25 +810,25 @@ private:
     }
     int TryTakeCommodity(int trader_id, const std::string& commodity, int quantity, bool atomic) {
         if (quantity <= 0) return 0;
-        auto inv = view.Entities[trader_id].Get<trader::Inventory>();
+        auto inv = inventories.Find(trader_id);
         if (!inv) {
           return 0;
         }
-        auto initial_inventory = inv->inv();
-        if (initial_inventory.count(commodity) != 1) return 0;
-        int available = initial_inventory[commodity].quantity();
+        if (inv->inv().count(commodity) != 1) return 0;
+        trader::InventoryItem item = inv->inv()[commodity];
+        int available = item.quantity();
         if (available < quantity && atomic) return 0;
 
         int actual_taken = std::min(available, quantity);
-        initial_inventory[commodity].set_quantity( available - actual_taken);
+        item.set_quantity( available - actual_taken);
         trader::Inventory::Update inv_update;
-        inv_update.set_inv(initial_inventory);
+        inventories.SetItem(trader_id, *inv, inv_update, commodity, item);
         connection.SendComponentUpdate<trader::Inventory>(trader_id, inv_update, {});
         return actual_taken;
     }
     double TryTakeMoney(int trader_id, double quantity, bool atomic) {
       if (quantity <= 0) return 0;
-      auto inv = view.Entities[trader_id].Get<trader::Inventory>();
+      auto inv = inventories.Find(trader_id);
       if (!inv) {
         return 0;
       }
@@ -678,34 +837,36 @@ private:
       if (available < quantity && atomic) return 0;
 
       double actual_taken = std::min(available, quantity);
+      inv->set_cash(available - actual_taken);
       trader::Inventory::Update inv_update;
-      inv_update.set_cash(available - actual_taken);
+      inv_update.set_cash(inv->cash());
       connection.SendComponentUpdate<trader::Inventory>(trader_id, inv_update, {});
       return actual_taken;
     }
     int TryAddCommodity(int trader_id, const std::string& commodity, int quantity, bool atomic) {
       if (quantity <= 0) return 0;
-      auto inv = view.Entities[trader_id].Get<trader::Inventory>();
+      auto inv = inventories.Find(trader_id);
       if (!inv) {
         return 0;
       }
 
       int actual_added = std::min((int) std::floor(QuerySpace(*inv) / known_commodities[commodity].size), quantity);
-      auto initial_inventory = inv->inv();
-      initial_inventory[commodity].set_quantity( initial_inventory[commodity].quantity() + actual_added);
+      trader::InventoryItem item = inv->inv()[commodity];
+      item.set_quantity( item.quantity() + actual_added);
       trader::Inventory::Update inv_update;
-      inv_update.set_inv(initial_inventory);
+      inventories.SetItem(trader_id, *inv, inv_update, commodity, item);
       connection.SendComponentUpdate<trader::Inventory>(trader_id, inv_update, {});
       return actual_added;
     }
     void AddMoney(int trader_id, double quantity) {
       if (quantity <= 0) return;
-      auto inv = view.Entities[trader_id].Get<trader::Inventory>();
+      auto inv = inventories.Find(trader_id);
       if (!inv) {
         return;
       }
+      inv->set_cash(inv->cash() + quantity);
       trader::Inventory::Update inv_update;
-      inv_update.set_cash(inv->cash() + quantity);
+      inv_update.set_cash(inv->cash());
       connection.SendComponentUpdate<trader::Inventory>(trader_id, inv_update, {});
       return;
     }
@@ -796,7 +957,7 @@ private:
         std::vector<std::pair<BidOffer, BidResult>> retained_bids = {};
         std::vector<std::pair<AskOffer, AskResult>> retained_asks = {};
 
-        auto resolve_time = to_unix_timestamp_ms(std::chrono::system_clock::now());
+        auto resolve_time = tick_clock.NowMs();
 
         auto& bids = bid_book[commodity];
         auto& asks = ask_book[commodity];
@@ -932,101 +1093,172 @@ private:
     ask_book_mutex.unlock();
     }
 
-    int RegisterNewAgent(const worker::CommandRequestOp<market::RegisterCommandComponent::Commands::RegisterCommand>& op) {
-      using AssignPartitionCommand = improbable::restricted::Worker::Commands::AssignPartition;
-      // Set parameters
-      std::int32_t GetOpListTimeout = 500; // all times in ms unless stated otherwise
-      std::int32_t WhileLoopTimeout = 500;
-
-      worker::EntityId entity_id;
-      ah::RegisterProgress progress = ah::NONE;
-      messages::AIRole assigned_role = messages::AIRole::NONE;
-
-      // Set callbacks
-      {
-        view.OnReserveEntityIdsResponse([&](const worker::ReserveEntityIdsResponseOp& op) {
-          if (op.StatusCode == worker::StatusCode::kSuccess) {
-            entity_id = *op.FirstEntityId;
-            progress = ah::RESERVED_ID;
-          } else {
-            connection.SendLogMessage(
-                worker::LogLevel::kError, unique_name,
-                "Failed to reserve ID(s): error code : " +
-                std::to_string(static_cast<std::uint8_t>(op.StatusCode)) +
-                " message: " + op.Message);
-          }
-        });
-        view.OnCreateEntityResponse([&](const worker::CreateEntityResponseOp& op) {
-          if (op.StatusCode == worker::StatusCode::kSuccess) {
-            connection.SendLogMessage(worker::LogLevel::kInfo, unique_name,
-                                      "Successfully created entity");
-            progress = ah::CREATED_ENTITY;
-          } else {
-            connection.SendLogMessage(worker::LogLevel::kWarn, unique_name,
-                                      "Failed to create entity");
-          };
-        });
-        view.OnCommandResponse<AssignPartitionCommand>(
-            [&](const worker::CommandResponseOp<AssignPartitionCommand>& op) {
-              if (op.StatusCode == worker::StatusCode::kSuccess) {
-                connection.SendLogMessage(worker::LogLevel::kInfo, unique_name,
-                                          "Successfully assigned partition.");
-                progress = ah::ASSIGNED_PARTITION;
-              } else {
-                connection.SendLogMessage(
-                    worker::LogLevel::kError, unique_name,
-                    "Failed to assign partition: error code : " +
-                        std::to_string(static_cast<std::uint8_t>(op.StatusCode)) +
-                        " message: " + op.Message);
-              }
-            });
-      }
-      // Start
-      connection.SendReserveEntityIdsRequest(1, {});
-      //Wait for entity ID to be reserved
-      auto now_time = to_unix_timestamp_ms(std::chrono::high_resolution_clock::now());
-      do {
-        view.Process(connection.GetOpList(GetOpListTimeout));
-        if (progress == ah::RESERVED_ID) {
-          // CREATE ENTITY HERE
-          switch (op.Request.type()) {
-          case messages::AgentType::MONITOR:
-            CreateMonitorEntity(entity_id);
-            break;
-          case messages::AgentType::AI_TRADER:
-            assigned_role = CreateAITraderEntity(entity_id, op.Request.requested_role());
-            break;
-          case messages::AgentType::HUMAN_TRADER:
-            break;
-          default:
-            return false;
-          }
+    // REGISTRATION
+    // Take an entity ID from the pool -> create the entity -> assign it to the caller's partition -> respond.
+    // AI traders skip the last step: they are created straight into their worker's shared partition,
+    // which is set up (and assigned) by the first registration from that worker.
+    // Every step is driven by its response callback, so any number of registrations can be in flight
+    // while the AH keeps ticking.
+    void StartRegistration(const transport::CommandRequestOp<ah::RegisterCommand>& op) {
+      std::uint32_t key = op.RequestId.Id;
+      ah::PendingRegistration registration;
+      registration.request_id = op.RequestId;
+      registration.request = op.Request;
+      registration.caller_worker_entity_id = op.CallerWorkerEntityId;
+      registrations.insert_or_assign(key, std::move(registration));
+      TakeEntityId(key);
+    }
+
+    void TakeEntityId(std::uint32_t key) {
+      if (entity_id_pool.empty()) {
+        waiting_for_entity_id.push_back(key);
+      } else {
+        worker::EntityId entity_id = entity_id_pool.front();
+        entity_id_pool.pop_front();
+        CreateRegisteredEntity(key, entity_id);
+      }
+      RefillEntityIdPool();
+    }
+
+    // Keeps a block of reserved entity IDs on hand, so spawning skips the reservation round-trip
+    void RefillEntityIdPool() {
+      if (entity_id_pool_refill || entity_id_pool.size() >= ENTITY_ID_POOL_LOW_WATER) {
+        return;
+      }
+      entity_id_pool_refill = connection.SendReserveEntityIdsRequest(ENTITY_ID_POOL_BLOCK_SIZE, {}).Id;
+    }
+
+    void OnEntityIdsReserved(const transport::ReserveEntityIdsResponseOp& op) {
+      if (!entity_id_pool_refill || op.RequestId.Id != *entity_id_pool_refill) {
+        return; // not one of ours
+      }
+      entity_id_pool_refill.reset();
+      if (op.StatusCode != worker::StatusCode::kSuccess || !op.FirstEntityId) {
+        std::string reason = "Failed to reserve ID(s): error code : " +
+            std::to_string(static_cast<std::uint8_t>(op.StatusCode)) + " message: " + op.Message;
+        // Nothing else will come along to serve the waiting registrations, so fail them now
+        while (!waiting_for_entity_id.empty()) {
+          FailRegistration(waiting_for_entity_id.front(), reason);
+          waiting_for_entity_id.pop_front();
         }
-        if (to_unix_timestamp_ms(std::chrono::high_resolution_clock::now()) - now_time > WhileLoopTimeout) return 0;
-      } while (progress != ah::RESERVED_ID);
-
-      // Wait for create entity to be processed, then request partition assignment
-      now_time = to_unix_timestamp_ms(std::chrono::high_resolution_clock::now());
-      do {
-        view.Process(connection.GetOpList(GetOpListTimeout));
-        if (progress == ah::CREATED_ENTITY) {
-          connection.SendCommandRequest<AssignPartitionCommand>(
-              op.CallerWorkerEntityId, {entity_id}, /* default timeout */ {});
+        return;
+      }
+      for (std::uint32_t i = 0; i < op.NumberOfEntityIds; i++) {
+        entity_id_pool.push_back(*op.FirstEntityId + i);
+      }
+      while (!waiting_for_entity_id.empty() && !entity_id_pool.empty()) {
+        std::uint32_t key = waiting_for_entity_id.front();
+        waiting_for_entity_id.pop_front();
+        worker::EntityId entity_id = entity_id_pool.front();
+        entity_id_pool.pop_front();
+        CreateRegisteredEntity(key, entity_id);
+      }
+      RefillEntityIdPool();
+    }
+
+    void CreateRegisteredEntity(std::uint32_t key, worker::EntityId entity_id) {
+      auto registration = registrations.find(key);
+      if (registration == registrations.end()) {
+        return;
+      }
+      auto& pending = registration->second;
+      pending.entity_id = entity_id;
+      pending.progress = ah::RESERVED_ID;
+
+      std::optional<worker::RequestId<worker::CreateEntityRequest>> create_request;
+      switch (pending.request.type()) {
+      case messages::AgentType::MONITOR:
+        create_request = CreateMonitorEntity(pending.entity_id);
+        break;
+      case messages::AgentType::AI_TRADER: {
+        auto partition = worker_partitions.find(pending.caller_worker_entity_id);
+        if (partition == worker_partitions.end()) {
+          // First trader from this worker: spend the ID on its partition, then take another
+          CreateWorkerPartition(pending.caller_worker_entity_id, entity_id);
+          pending.progress = ah::NONE;
+          TakeEntityId(key);
+          return;
+        }
+        if (!partition->second.assigned) {
+          partition->second.waiting.push_back(key);
+          return;
         }
-        if (to_unix_timestamp_ms(std::chrono::high_resolution_clock::now()) - now_time > WhileLoopTimeout) return 0;
-      } while(progress != ah::CREATED_ENTITY);
+        pending.assigned_role = pending.request.requested_role();
+        pending.members = std::max(1, std::min(pending.request.members(), MAX_COHORT_MEMBERS));
+        create_request = CreateAITraderEntity(pending.entity_id, partition->second.partition_id, pending.assigned_role,
+                                              pending.members);
+        break;
+      }
+      default:
+        break; // human traders are not supported yet
+      }
+      if (!create_request) {
+        FailRegistration(key, "Failed to create entity for new agent");
+        return;
+      }
+      create_entity_requests[create_request->Id] = key;
+    }
 
-      // Wait for partition assignment to go through
-      now_time = to_unix_timestamp_ms(std::chrono::high_resolution_clock::now());
-      do {
-        view.Process(connection.GetOpList(GetOpListTimeout));
-        if (to_unix_timestamp_ms(std::chrono::high_resolution_clock::now()) - now_time > WhileLoopTimeout) return 0;
-      } while(progress != ah::ASSIGNED_PARTITION);
+    void OnRegisteredEntityCreated(const transport::CreateEntityResponseOp& op) {
+      auto request = create_entity_requests.find(op.RequestId.Id);
+      if (request == create_entity_requests.end()) {
+        return; // not one of ours
+      }
+      std::uint32_t key = request->second;
+      create_entity_requests.erase(request);
+      auto registration = registrations.find(key);
+      if (registration == registrations.end()) {
+        return;
+      }
+      auto& pending = registration->second;
+      if (op.StatusCode != worker::StatusCode::kSuccess) {
+        FailRegistration(key, "Failed to create entity: " + op.Message);
+        return;
+      }
+      pending.progress = ah::CREATED_ENTITY;
+      if (pending.request.type() == messages::AgentType::AI_TRADER) {
+        pending.progress = ah::ASSIGNED_PARTITION; // created inside the worker's partition
+        CompleteRegistration(key);
+        return;
+      }
+      auto assign_request = connection.SendCommandRequest<ah::AssignPartitionCommand>(
+          pending.caller_worker_entity_id, {pending.entity_id}, {REGISTER_STEP_TIMEOUT_MS});
+      assign_partition_requests[assign_request.Id] = key;
+    }
+
+    void OnPartitionAssigned(const transport::CommandResponseOp<ah::AssignPartitionCommand>& op) {
+      auto request = assign_partition_requests.find(op.RequestId.Id);
+      if (request == assign_partition_requests.end()) {
+        OnWorkerPartitionAssigned(op);
+        return;
+      }
+      std::uint32_t key = request->second;
+      assign_partition_requests.erase(request);
+      auto registration = registrations.find(key);
+      if (registration == registrations.end()) {
+        return;
+      }
+      auto& pending = registration->second;
+      if (op.StatusCode != worker::StatusCode::kSuccess) {
+        FailRegistration(key, "Failed to assign partition: error code : " +
+            std::to_string(static_cast<std::uint8_t>(op.StatusCode)) + " message: " + op.Message);
+        return;
+      }
+      pending.progress = ah::ASSIGNED_PARTITION;
+      CompleteRegistration(key);
+    }
 
+    void CompleteRegistration(std::uint32_t key) {
+      auto registration = registrations.find(key);
+      if (registration == registrations.end()) {
+        return;
+      }
+      auto& pending = registration->second;
       // Send successful response
       messages::RegisterResponse req_res;
-      req_res.set_entity_id(entity_id);
-      req_res.set_assigned_role(assigned_role);
+      req_res.set_entity_id(pending.entity_id);
+      req_res.set_assigned_role(pending.assigned_role);
+      req_res.set_members(pending.members);
       worker::List<commodity::Commodity> commodities;
       for (auto& good : known_commodities) {
         commodity::Commodity comm{
@@ -1036,15 +1268,226 @@ private:
         commodities.emplace_back(comm);
       }
       req_res.set_listed_items(commodities);
-      using RegisterTraderCommand = market::RegisterCommandComponent::Commands::RegisterCommand;
-      connection.SendCommandResponse<RegisterTraderCommand>(op.RequestId, req_res);
+      connection.SendCommandResponse<ah::RegisterCommand>(pending.request_id, req_res);
       connection.SendLogMessage(worker::LogLevel::kInfo, "AuctionHouse",
-      "Registered new" + RoleToString(assigned_role) +"trader with ID #" + std::to_string(entity_id));
-      IncrementDemographic(assigned_role);
-      return true;
+      "Registered new" + RoleToString(pending.assigned_role) +"trader with ID #" + std::to_string(pending.entity_id));
+      if (pending.request.type() == messages::AgentType::AI_TRADER) {
+        IncrementDemographic(pending.assigned_role, pending.members);
+        AddProducer(pending.entity_id, pending.assigned_role, pending.members);
+        trader_workers[pending.entity_id] = pending.caller_worker_entity_id;
+        worker_partitions[pending.caller_worker_entity_id].traders++;
+      }
+      registrations.erase(registration);
+    }
+
+    void FailRegistration(std::uint32_t key, const std::string& reason) {
+      auto registration = registrations.find(key);
+      if (registration == registrations.end()) {
+        return;
+      }
+      auto& pending = registration->second;
+      if (pending.progress >= ah::CREATED_ENTITY) {
+        connection.SendDeleteEntityRequest(pending.entity_id, {}); // don't leave an orphaned entity behind
+      }
+      connection.SendCommandFailure<ah::RegisterCommand>(pending.request_id, "Auction House failed to create trader entities");
+      connection.SendLogMessage(worker::LogLevel::kWarn, "AuctionHouse", "Failed to register new agent: " + reason);
+      registrations.erase(registration);
+    }
+
+    void CreateWorkerPartition(worker::EntityId worker_entity_id, worker::EntityId partition_id) {
+      worker_partitions[worker_entity_id].partition_id = partition_id;
+      worker::Entity partition_entity;
+      partition_entity.Add<improbable::Metadata>({{"AITraderPartition"}});
+      partition_entity.Add<improbable::Position>({{3, 0, static_cast<double>(partition_id)}});
+      auto create_request = SendCreateEntity(partition_entity, partition_id);
+      if (!create_request) {
+        FailWorkerPartition(worker_entity_id, "Failed to create partition entity");
+        return;
+      }
+      partition_create_requests[create_request->Id] = worker_entity_id;
     }
 
-  void CreateMonitorEntity(worker::EntityId monitor_entity_id) {
+    void OnWorkerPartitionCreated(const transport::CreateEntityResponseOp& op) {
+      auto request = partition_create_requests.find(op.RequestId.Id);
+      if (request == partition_create_requests.end()) {
+        return; // not one of ours
+      }
+      worker::EntityId worker_entity_id = request->second;
+      partition_create_requests.erase(request);
+      auto partition = worker_partitions.find(worker_entity_id);
+      if (partition == worker_partitions.end()) {
+        return;
+      }
+      if (op.StatusCode != worker::StatusCode::kSuccess) {
+        partition->second.partition_id = -1; // nothing to clean up
+        FailWorkerPartition(worker_entity_id, "Failed to create partition entity: " + op.Message);
+        return;
+      }
+      auto assign_request = connection.SendCommandRequest<ah::AssignPartitionCommand>(
+          worker_entity_id, {partition->second.partition_id}, {REGISTER_STEP_TIMEOUT_MS});
+      partition_assign_requests[assign_request.Id] = worker_entity_id;
+    }
+
+    void OnWorkerPartitionAssigned(const transport::CommandResponseOp<ah::AssignPartitionCommand>& op) {
+      auto request = partition_assign_requests.find(op.RequestId.Id);
+      if (request == partition_assign_requests.end()) {
+        return; // not one of ours
+      }
+      worker::EntityId worker_entity_id = request->second;
+      partition_assign_requests.erase(request);
+      auto partition = worker_partitions.find(worker_entity_id);
+      if (partition == worker_partitions.end()) {
+        return;
+      }
+      if (op.StatusCode != worker::StatusCode::kSuccess) {
+        FailWorkerPartition(worker_entity_id, "Failed to assign partition: error code : " +
+            std::to_string(static_cast<std::uint8_t>(op.StatusCode)) + " message: " + op.Message);
+        return;
+      }
+      partition->second.assigned = true;
+      auto waiting = std::move(partition->second.waiting);
+      partition->second.waiting.clear();
+      for (auto key : waiting) {
+        auto registration = registrations.find(key);
+        if (registration != registrations.end()) {
+          CreateRegisteredEntity(key, registration->second.entity_id);
+        }
+      }
+    }
+
+    // HAND-OFFS
+    // A trader moves between workers with its learned state: the worker hosting it sends that state
+    // here, the AH writes it to the trader's TraderState, then re-delegates the trader's client
+    // components to the target worker's partition, which picks the trader up from TraderState.
+    // Its Inventory, production and offers stay with the AH throughout, so the economy never loses it.
+    void HandOffTrader(const transport::CommandRequestOp<ah::HandOffCommand>& op) {
+      worker::EntityId entity_id = op.Request.entity_id();
+      auto source = trader_workers.find(entity_id);
+      if (source == trader_workers.end() || source->second != op.CallerWorkerEntityId) {
+        connection.SendCommandFailure<ah::HandOffCommand>(op.RequestId, "Trader is not hosted by the caller");
+        return;
+      }
+      worker::EntityId target_worker = op.Request.target_worker_entity_id();
+      if (target_worker == 0) {
+        target_worker = LeastLoadedWorker(source->second);
+      }
+      auto target = worker_partitions.find(target_worker);
+      if (target == worker_partitions.end() || !target->second.assigned || target_worker == source->second) {
+        connection.SendCommandFailure<ah::HandOffCommand>(op.RequestId, "No worker to hand the trader off to");
+        return;
+      }
+      // Stamped with its new worker, so only that worker adopts it, whatever order the ops arrive in
+      trader::AITraderState state = op.Request.state();
+      state.set_worker_entity_id(target_worker);
+      trader::TraderState::Update state_update;
+      state_update.set_state(state);
+      connection.SendComponentUpdate<trader::TraderState>(entity_id, state_update);
+      // The target checks the trader out from `inv`, and never sees the item events sent before that
+      inventories.Checkpoint(entity_id, [&](worker::EntityId, const trader::Inventory::Update& update) {
+        connection.SendComponentUpdate<trader::Inventory>(entity_id, update);
+      });
+      improbable::AuthorityDelegation::Update delegation;
+      delegation.set_delegations({{4005, target->second.partition_id}, {4004, 3}}); // as in CreateAITraderEntity
+      connection.SendComponentUpdate<improbable::AuthorityDelegation>(entity_id, delegation);
+
+      worker_partitions[source->second].traders--;
+      target->second.traders++;
+      source->second = target_worker;
+      connection.SendCommandResponse<ah::HandOffCommand>(op.RequestId, {true});
+      logger->Log(Log::INFO, "Handed trader " + std::to_string(entity_id) + " off to worker " + std::to_string(target_worker));
+    }
+
+    // The assigned worker partition with the fewest traders, other than `exclude`; 0 if there is none
+    worker::EntityId LeastLoadedWorker(worker::EntityId exclude) const {
+      worker::EntityId least = 0;
+      std::size_t least_traders = 0;
+      for (const auto& partition : worker_partitions) {
+        if (!partition.second.assigned || partition.first == exclude) {
+          continue;
+        }
+        if (least == 0 || partition.second.traders < least_traders) {
+          least = partition.first;
+          least_traders = partition.second.traders;
+        }
+      }
+      return least;
+    }
+
+    void ForgetTraderWorker(worker::EntityId entity_id) {
+      auto hosted = trader_workers.find(entity_id);
+      if (hosted == trader_workers.end()) {
+        return;
+      }
+      auto partition = worker_partitions.find(hosted->second);
+      if (partition != worker_partitions.end() && partition->second.traders > 0) {
+        partition->second.traders--;
+      }
+      trader_workers.erase(hosted);
+    }
+
+    // Asks traders on the busiest worker to move to the idlest, halving the gap between them.
+    // Waits for the last round of requests to be answered first, so counts are never stale.
+    void RebalanceWorkers() {
+      if (!hand_off_requests.empty()) {
+        return;
+      }
+      worker::EntityId busiest = 0;
+      std::size_t most_traders = 0;
+      for (const auto& partition : worker_partitions) {
+        if (partition.second.assigned && (busiest == 0 || partition.second.traders > most_traders)) {
+          busiest = partition.first;
+          most_traders = partition.second.traders;
+        }
+      }
+      worker::EntityId idlest = LeastLoadedWorker(busiest);
+      if (busiest == 0 || idlest == 0) {
+        return;
+      }
+      std::size_t fewest_traders = worker_partitions[idlest].traders;
+      if (most_traders <= fewest_traders + REBALANCE_SLACK) {
+        return;
+      }
+      std::size_t moves = std::min((most_traders - fewest_traders)/2, MAX_HAND_OFFS_PER_REBALANCE);
+      for (const auto& hosted : trader_workers) {
+        if (moves == 0) {
+          break;
+        }
+        if (hosted.second != busiest) {
+          continue;
+        }
+        auto request = connection.SendCommandRequest<ah::RequestHandOffCommand>(hosted.first, {idlest}, {REGISTER_STEP_TIMEOUT_MS});
+        hand_off_requests[request.Id] = hosted.first;
+        moves--;
+      }
+    }
+
+    // Fails every registration waiting on the partition; the next one from that worker starts over
+    void FailWorkerPartition(worker::EntityId worker_entity_id, const std::string& reason) {
+      auto partition = worker_partitions.find(worker_entity_id);
+      if (partition == worker_partitions.end()) {
+        return;
+      }
+      auto waiting = std::move(partition->second.waiting);
+      if (partition->second.partition_id >= 0) {
+        connection.SendDeleteEntityRequest(partition->second.partition_id, {});
+      }
+      worker_partitions.erase(partition);
+      for (auto key : waiting) {
+        FailRegistration(key, reason);
+      }
+    }
+
+    std::optional<worker::RequestId<worker::CreateEntityRequest>> SendCreateEntity(const worker::Entity& entity, worker::EntityId entity_id) {
+      auto result = connection.SendCreateEntityRequest(entity, entity_id, {REGISTER_STEP_TIMEOUT_MS});
+      if (!result) {
+        connection.SendLogMessage(worker::LogLevel::kError, unique_name,
+                                  "Failed to send create entity request: " + result.GetErrorMessage());
+        return {};
+      }
+      return *result;
+    }
+
+  std::optional<worker::RequestId<worker::CreateEntityRequest>> CreateMonitorEntity(worker::EntityId monitor_entity_id) {
     worker::Entity monitor_entity;
 
     // Interest for auction house markets
@@ -1072,297 +1515,303 @@ private:
     monitor_entity.Add<improbable::Interest>({{{50, all_markets_interest}}});
 
     monitor_entity.Add<improbable::AuthorityDelegation>({{{50, monitor_entity_id}}});
-    connection.SendCreateEntityRequest(monitor_entity, monitor_entity_id, {});
+    return SendCreateEntity(monitor_entity, monitor_entity_id);
   }
 
-  messages::AIRole CreateAITraderEntity(worker::EntityId trader_entity_id, messages::AIRole requested_role) {
-    worker::Entity trader_entity;
+  // requested_role is updated to the role actually assigned. A cohort of `members` traders starts with
+  // `members` times a single trader's Inventory.
+  std::optional<worker::RequestId<worker::CreateEntityRequest>> CreateAITraderEntity(worker::EntityId trader_entity_id, worker::EntityId partition_id, messages::AIRole& requested_role,
+                                                                                     std::int32_t members = 1) {
     if (requested_role == messages::AIRole::NONE) {
       requested_role = ChooseNewClassWeighted();
     }
-    switch (requested_role) {
+    auto role_template = trader_templates.find(requested_role);
+    if (role_template == trader_templates.end()) {
+      requested_role = messages::AIRole::NONE;
+      return {};
+    }
+    // Clone the role's template and fill in everything that depends on the entity ID
+    worker::Entity trader_entity = role_template->second.entity;
+    if (members > 1) {
+      auto inventory = trader_entity.Get<trader::Inventory>();
+      if (inventory) {
+        worker::Map<std::string, trader::InventoryItem> pooled = inventory->inv();
+        for (auto& item : pooled) {
+          item.second.set_quantity(item.second.quantity()*members);
+        }
+        trader::Inventory::Update scaled;
+        scaled.set_cash(inventory->cash()*members).set_inv(pooled).set_capacity(inventory->capacity()*members);
+        trader_entity.Update<trader::Inventory>(scaled);
+      }
+    }
+
+    // add interest for own inventory & buildings
+    improbable::ComponentSetInterest_QueryConstraint self_constraint;
+    self_constraint.set_entity_id_constraint(trader_entity_id);
+    improbable::ComponentSetInterest_Query self_query;
+    self_query.set_constraint(self_constraint).set_result_component_set_id({4006}); //Inventory + AIBuildings + TraderState components
+    worker::List<improbable::ComponentSetInterest_Query> const_queries = {role_template->second.market_query, self_query};
+
+    improbable::ComponentSetInterest trader_interest;
+    trader_interest.set_queries(const_queries);
+    trader_entity.Add<improbable::Interest>({{{4005, trader_interest}}});
+
+    trader_entity.Add<improbable::Metadata>({{RoleToString(requested_role) + std::to_string(trader_entity_id)}});
+    trader_entity.Add<improbable::Position>({{3, 0, static_cast<double>(trader_entity_id)}});
+
+    trader_entity.Add<improbable::AuthorityDelegation>({{{4005, partition_id}, {4004, 3}}}); // The AH partition entity is hardcoded to 3
+    return SendCreateEntity(trader_entity, trader_entity_id);
+  }
+
+  // RECIPES
+  // Returns the recipe's id, adding it to the registry (or updating it in place) as needed
+  std::int32_t RegisterRecipe(const trader::Building& building) {
+    auto existing = recipe_ids.find(building.debug_name());
+    if (existing != recipe_ids.end()) {
+      if (recipes[existing->second].building() != building) {
+        recipe_book.Compile(existing->second, building);
+        recipes[existing->second].set_building(building);
+        recipes_dirty = true;
+      }
+      return existing->second;
+    }
+    auto recipe_id = static_cast<std::int32_t>(recipes.size());
+    recipe_book.Compile(recipe_id, building); // throws before anything is registered if it can't be compiled
+    recipes.push_back({recipe_id, building});
+    recipe_ids[building.debug_name()] = recipe_id;
+    recipes_dirty = true;
+    return recipe_id;
+  }
+
+  // TRADER TEMPLATES
+  // Rebuilt whenever a commodity is registered. A role only gets a template once every commodity it
+  // deals in is known.
+  void RebuildTraderTemplates() {
+    trader_templates.clear();
+    for (auto role : {messages::AIRole::FARMER, messages::AIRole::WOODCUTTER, messages::AIRole::COMPOSTER,
+                      messages::AIRole::MINER, messages::AIRole::REFINER, messages::AIRole::BLACKSMITH}) {
+      if (auto role_template = BuildTraderTemplate(role)) {
+        trader_templates.insert_or_assign(role, std::move(*role_template));
+      }
+    }
+  }
+
+  // The commodities a role's buildings and inventory deal in; keep in step with the Add*Components below
+  static const std::vector<std::string>& RoleCommodities(messages::AIRole role) {
+    static const std::map<messages::AIRole, std::vector<std::string>> role_commodities = {
+        {messages::AIRole::FARMER, {"food", "tools", "wood", "fertilizer"}},
+        {messages::AIRole::WOODCUTTER, {"food", "tools", "wood"}},
+        {messages::AIRole::COMPOSTER, {"food", "fertilizer"}},
+        {messages::AIRole::MINER, {"food", "tools", "ore"}},
+        {messages::AIRole::REFINER, {"food", "tools", "ore", "metal"}},
+        {messages::AIRole::BLACKSMITH, {"food", "tools", "metal"}}};
+    static const std::vector<std::string> none;
+    auto commodities = role_commodities.find(role);
+    return commodities == role_commodities.end() ? none : commodities->second;
+  }
+
+  // Empty if the role has no template or not all of its commodities are registered yet
+  std::optional<ah::TraderTemplate> BuildTraderTemplate(messages::AIRole role) {
+    const auto& commodities = RoleCommodities(role);
+    if (commodities.empty()) {
+      return std::nullopt;
+    }
+    for (const auto& commodity : commodities) {
+      if (known_commodities.count(commodity) == 0) {
+        return std::nullopt;
+      }
+    }
+    ah::TraderTemplate role_template;
+    std::uint32_t market_interest_set;
+    switch (role) {
     case messages::AIRole::FARMER:
-      AddFarmerComponents(trader_entity, trader_entity_id);
+      AddFarmerComponents(role_template.entity);
+      market_interest_set = 3021;
       break;
     case messages::AIRole::WOODCUTTER:
-      AddWoodcutterComponents(trader_entity, trader_entity_id);
+      AddWoodcutterComponents(role_template.entity);
+      market_interest_set = 3022;
       break;
     case messages::AIRole::COMPOSTER:
-      AddComposterComponents(trader_entity, trader_entity_id);
+      AddComposterComponents(role_template.entity);
+      market_interest_set = 3023;
       break;
     case messages::AIRole::MINER:
-      AddMinerComponents(trader_entity, trader_entity_id);
+      AddMinerComponents(role_template.entity);
+      market_interest_set = 3024;
       break;
     case messages::AIRole::REFINER:
-      AddRefinerComponents(trader_entity, trader_entity_id);
+      AddRefinerComponents(role_template.entity);
+      market_interest_set = 3025;
       break;
     case messages::AIRole::BLACKSMITH:
-      AddBlacksmithComponents(trader_entity, trader_entity_id);
+      AddBlacksmithComponents(role_template.entity);
+      market_interest_set = 3026;
       break;
     default:
-      return messages::AIRole::NONE;
+      return std::nullopt;
     }
-    trader_entity.Add<improbable::Metadata>({{RoleToString(requested_role) + std::to_string(trader_entity_id)}});
-    trader_entity.Add<improbable::Position>({{3, 0, static_cast<double>(trader_entity_id)}});
-
-    trader_entity.Add<improbable::AuthorityDelegation>({{{4005, trader_entity_id}, {4004, 3}}}); // The AH partition entity is hardcoded to 3
-    connection.SendCreateEntityRequest(trader_entity, trader_entity_id, {});
-
-    return requested_role;
-  }
-
-  void AddFarmerComponents(worker::Entity& trader_entity, int entity_id) {
+    // Filled in if the trader is ever handed off to another worker
+    role_template.entity.Add<trader::TraderState>({{messages::AIRole::NONE, 0, 0, 0, {}, {}, {}, 0}});
     // Interest for auction house markets
     improbable::ComponentSetInterest_QueryConstraint market_constraint;
     market_constraint.set_component_constraint({3001});  // only markets have this MakeOfferCommandComponent
-    improbable::ComponentSetInterest_Query market_query;
-    market_query.set_constraint(market_constraint).set_result_component_set_id({3021});
-
-
-    // add interest for own inventory & buildings
-    improbable::ComponentSetInterest_QueryConstraint self_constraint;
-    self_constraint.set_entity_id_constraint(entity_id);
-    improbable::ComponentSetInterest_Query self_query;
-    self_query.set_constraint(self_constraint).set_result_component_set_id({4006}); //Inventory + AIBuildings component
-    worker::List<improbable::ComponentSetInterest_Query> const_queries = {market_query, self_query};
-
-    improbable::ComponentSetInterest trader_interest;
-    trader_interest.set_queries(const_queries);
-    trader_entity.Add<improbable::Interest>({{{4005, trader_interest}}});
+    role_template.market_query.set_constraint(market_constraint).set_result_component_set_id({market_interest_set});
+
+    // Production options, sorted by priority once rather than on every production run
+    auto ai_buildings = role_template.entity.Get<trader::AIBuildings>();
+    std::vector<std::int32_t> recipe_order(ai_buildings->recipe_ids().begin(), ai_buildings->recipe_ids().end());
+    std::stable_sort(recipe_order.begin(), recipe_order.end(), [this](std::int32_t i, std::int32_t j) {
+      return recipes[i].building().priority() < recipes[j].building().priority();
+    });
+    role_template.recipes_by_priority = std::make_shared<const std::vector<std::int32_t>>(std::move(recipe_order));
+    role_template.idle_tax = ai_buildings->idle_tax();
+    return role_template;
+  }
 
+  void AddFarmerComponents(worker::Entity& trader_entity) {
     // Create production rules
     // 1 fert + 1 tool (10% break change) + 1 wood = 6 food
-    trader::Building farm1 = {{{ToSchemaCommodity(known_commodities["food"]), 6, 1.0}},
-                              {{ToSchemaCommodity(known_commodities["fertilizer"]), 1, 1.0},
-                               {ToSchemaCommodity(known_commodities["tools"]), 1, 0.1},
-                               {ToSchemaCommodity(known_commodities["wood"]), 1, 1}},
+    trader::Building farm1 = {{{ToSchemaCommodity(known_commodities.at("food")), 6, 1.0}},
+                              {{ToSchemaCommodity(known_commodities.at("fertilizer")), 1, 1.0},
+                               {ToSchemaCommodity(known_commodities.at("tools")), 1, 0.1},
+                               {ToSchemaCommodity(known_commodities.at("wood")), 1, 1}},
                               1,
                               "AIFarm1", false};
     // 1 fert + 1 wood = 3 food
-    trader::Building farm2 = {{{ToSchemaCommodity(known_commodities["food"]), 3, 1.0}},
-                              {{ToSchemaCommodity(known_commodities["fertilizer"]), 1, 1.0},
-                               {ToSchemaCommodity(known_commodities["wood"]), 1, 1}},
+    trader::Building farm2 = {{{ToSchemaCommodity(known_commodities.at("food")), 3, 1.0}},
+                              {{ToSchemaCommodity(known_commodities.at("fertilizer")), 1, 1.0},
+                               {ToSchemaCommodity(known_commodities.at("wood")), 1, 1}},
                               2,
                               "AIFarm2", false};
     // 1 fert = 1 food
-    trader::Building farm3 = {{{ToSchemaCommodity(known_commodities["food"]), 1, 1.0}},
-                              {{ToSchemaCommodity(known_commodities["fertilizer"]), 1, 1.0}},
+    trader::Building farm3 = {{{ToSchemaCommodity(known_commodities.at("food")), 1, 1.0}},
+                              {{ToSchemaCommodity(known_commodities.at("fertilizer")), 1, 1.0}},
                               3,
                               "AIFarm3", false};
-    trader_entity.Add<trader::AIBuildings>({{farm1, farm2, farm3}, 20});
+    trader_entity.Add<trader::AIBuildings>({{RegisterRecipe(farm1), RegisterRecipe(farm2), RegisterRecipe(farm3)}, 20});
     // Add starting inventory
     ::worker::Map<std::string, ::trader::InventoryItem> starting_inv = {
-        {"food", {known_commodities["food"].size, 0}},
-        {"tools", {known_commodities["tools"].size, 1}},
-        {"wood", {known_commodities["wood"].size, 1}},
-        {"fertilizer", {known_commodities["fertilizer"].size, 1}}
+        {"food", {known_commodities.at("food").size, 0}},
+        {"tools", {known_commodities.at("tools").size, 1}},
+        {"wood", {known_commodities.at("wood").size, 1}},
+        {"fertilizer", {known_commodities.at("fertilizer").size, 1}}
     };
     trader_entity.Add<trader::Inventory>({500, starting_inv, 20});
 
   }
 
-  void AddWoodcutterComponents(worker::Entity& trader_entity, int entity_id) {
-    // Interest for auction house markets
-    improbable::ComponentSetInterest_QueryConstraint market_constraint;
-    market_constraint.set_component_constraint({3001});  // only markets have this MakeOfferCommandComponent
-    improbable::ComponentSetInterest_Query market_query;
-    market_query.set_constraint(market_constraint).set_result_component_set_id({3022});
-
-
-    // add interest for own inventory & buildings
-    improbable::ComponentSetInterest_QueryConstraint self_constraint;
-    self_constraint.set_entity_id_constraint(entity_id);
-    improbable::ComponentSetInterest_Query self_query;
-    self_query.set_constraint(self_constraint).set_result_component_set_id({4006}); //Inventory + AIBuildings component
-    worker::List<improbable::ComponentSetInterest_Query> const_queries = {market_query, self_query};
-
-    improbable::ComponentSetInterest trader_interest;
-    trader_interest.set_queries(const_queries);
-    trader_entity.Add<improbable::Interest>({{{4005, trader_interest}}});
-
+  void AddWoodcutterComponents(worker::Entity& trader_entity) {
     // Create production rules
     // 1 food + 1 tool (10% break change) = 2 wood
-    trader::Building lumberyard1 = {{{ToSchemaCommodity(known_commodities["wood"]), 2, 1.0}},
-                              {{ToSchemaCommodity(known_commodities["tools"]), 1, 0.1},
-                               {ToSchemaCommodity(known_commodities["food"]), 1, 1}},
+    trader::Building lumberyard1 = {{{ToSchemaCommodity(known_commodities.at("wood")), 2, 1.0}},
+                              {{ToSchemaCommodity(known_commodities.at("tools")), 1, 0.1},
+                               {ToSchemaCommodity(known_commodities.at("food")), 1, 1}},
                               1,
                               "AILumberyard1", false};
     // 1 food = 1 wood
-    trader::Building lumberyard2 = {{{ToSchemaCommodity(known_commodities["wood"]), 1, 1.0}},
-                              {{ToSchemaCommodity(known_commodities["food"]), 1, 1}},
+    trader::Building lumberyard2 = {{{ToSchemaCommodity(known_commodities.at("wood")), 1, 1.0}},
+                              {{ToSchemaCommodity(known_commodities.at("food")), 1, 1}},
                               2,
                               "AILumberyard2", false};
-    trader_entity.Add<trader::AIBuildings>({{lumberyard1, lumberyard2}, 20});
+    trader_entity.Add<trader::AIBuildings>({{RegisterRecipe(lumberyard1), RegisterRecipe(lumberyard2)}, 20});
     // Add starting inventory
     ::worker::Map<std::string, ::trader::InventoryItem> starting_inv = {
-        {"food", {known_commodities["food"].size, 2}},
-        {"tools", {known_commodities["tools"].size, 1}},
-        {"wood", {known_commodities["wood"].size, 0}},
+        {"food", {known_commodities.at("food").size, 2}},
+        {"tools", {known_commodities.at("tools").size, 1}},
+        {"wood", {known_commodities.at("wood").size, 0}},
     };
     trader_entity.Add<trader::Inventory>({500, starting_inv, 20});
   }
 
-  void AddComposterComponents(worker::Entity& trader_entity, int entity_id) {
-    // Interest for auction house markets
-    improbable::ComponentSetInterest_QueryConstraint market_constraint;
-    market_constraint.set_component_constraint({3001});  // only markets have this MakeOfferCommandComponent
-    improbable::ComponentSetInterest_Query market_query;
-    market_query.set_constraint(market_constraint).set_result_component_set_id({3023});
-
-
-    // add interest for own inventory & buildings
-    improbable::ComponentSetInterest_QueryConstraint self_constraint;
-    self_constraint.set_entity_id_constraint(entity_id);
-    improbable::ComponentSetInterest_Query self_query;
-    self_query.set_constraint(self_constraint).set_result_component_set_id({4006}); //Inventory + AIBuildings component
-    worker::List<improbable::ComponentSetInterest_Query> const_queries = {market_query, self_query};
-
-    improbable::ComponentSetInterest trader_interest;
-    trader_interest.set_queries(const_queries);
-    trader_entity.Add<improbable::Interest>({{{4005, trader_interest}}});
-
+  void AddComposterComponents(worker::Entity& trader_entity) {
     // Create production rules
     // 1 food  = 1 fert (50% succeed chance)
-    trader::Building composter1 = {{{ToSchemaCommodity(known_commodities["fertilizer"]), 1, 0.5}},
-                              {{ToSchemaCommodity(known_commodities["food"]), 1, 1}},
+    trader::Building composter1 = {{{ToSchemaCommodity(known_commodities.at("fertilizer")), 1, 0.5}},
+                              {{ToSchemaCommodity(known_commodities.at("food")), 1, 1}},
                               1,
                               "AIComposter1", false};
 
-    trader_entity.Add<trader::AIBuildings>({{composter1}, 20});
+    trader_entity.Add<trader::AIBuildings>({{RegisterRecipe(composter1)}, 20});
     // Add starting inventory
     ::worker::Map<std::string, ::trader::InventoryItem> starting_inv = {
-        {"food", {known_commodities["food"].size, 2}},
-        {"fertilizer", {known_commodities["fertilizer"].size, 0}}
+        {"food", {known_commodities.at("food").size, 2}},
+        {"fertilizer", {known_commodities.at("fertilizer").size, 0}}
     };
     trader_entity.Add<trader::Inventory>({500, starting_inv, 20});
   }
 
-  void AddMinerComponents(worker::Entity& trader_entity, int entity_id) {
-    // Interest for auction house markets
-    improbable::ComponentSetInterest_QueryConstraint market_constraint;
-    market_constraint.set_component_constraint({3001});  // only markets have this MakeOfferCommandComponent
-    improbable::ComponentSetInterest_Query market_query;
-    market_query.set_constraint(market_constraint).set_result_component_set_id({3024});
-
-
-    // add interest for own inventory & buildings
-    improbable::ComponentSetInterest_QueryConstraint self_constraint;
-    self_constraint.set_entity_id_constraint(entity_id);
-    improbable::ComponentSetInterest_Query self_query;
-    self_query.set_constraint(self_constraint).set_result_component_set_id({4006}); //Inventory + AIBuildings component
-    worker::List<improbable::ComponentSetInterest_Query> const_queries = {market_query, self_query};
-
-    improbable::ComponentSetInterest trader_interest;
-    trader_interest.set_queries(const_queries);
-    trader_entity.Add<improbable::Interest>({{{4005, trader_interest}}});
-
+  void AddMinerComponents(worker::Entity& trader_entity) {
     // Create production rules
     // 1 food + 1 tools  = 4 ore
-    trader::Building mine1 = {{{ToSchemaCommodity(known_commodities["ore"]), 4, 1}},
-                                   {{ToSchemaCommodity(known_commodities["food"]), 1, 1},
-                                    {ToSchemaCommodity(known_commodities["tools"]), 1, 0.1}},
+    trader::Building mine1 = {{{ToSchemaCommodity(known_commodities.at("ore")), 4, 1}},
+                                   {{ToSchemaCommodity(known_commodities.at("food")), 1, 1},
+                                    {ToSchemaCommodity(known_commodities.at("tools")), 1, 0.1}},
                                    1,
                                    "AIMine1", false};
     // 1 food = 2 ore
-    trader::Building mine2 = {{{ToSchemaCommodity(known_commodities["ore"]), 2, 1}},
-                              {{ToSchemaCommodity(known_commodities["food"]), 1, 1}},
+    trader::Building mine2 = {{{ToSchemaCommodity(known_commodities.at("ore")), 2, 1}},
+                              {{ToSchemaCommodity(known_commodities.at("food")), 1, 1}},
                               2,
                               "AIMine2", false};
 
-    trader_entity.Add<trader::AIBuildings>({{mine1, mine2}, 20});
+    trader_entity.Add<trader::AIBuildings>({{RegisterRecipe(mine1), RegisterRecipe(mine2)}, 20});
     // Add starting inventory
     ::worker::Map<std::string, ::trader::InventoryItem> starting_inv = {
-        {"food", {known_commodities["food"].size, 2}},
-        {"tools", {known_commodities["tools"].size, 1}},
-        {"ore", {known_commodities["ore"].size, 0}},
+        {"food", {known_commodities.at("food").size, 2}},
+        {"tools", {known_commodities.at("tools").size, 1}},
+        {"ore", {known_commodities.at("ore").size, 0}},
     };
     trader_entity.Add<trader::Inventory>({500, starting_inv, 20});
   }
 
-  void AddRefinerComponents(worker::Entity& trader_entity, int entity_id) {
-    // Interest for auction house markets
-    improbable::ComponentSetInterest_QueryConstraint market_constraint;
-    market_constraint.set_component_constraint({3001});  // only markets have this MakeOfferCommandComponent
-    improbable::ComponentSetInterest_Query market_query;
-    market_query.set_constraint(market_constraint).set_result_component_set_id({3025});
-
-
-    // add interest for own inventory & buildings
-    improbable::ComponentSetInterest_QueryConstraint self_constraint;
-    self_constraint.set_entity_id_constraint(entity_id);
-    improbable::ComponentSetInterest_Query self_query;
-    self_query.set_constraint(self_constraint).set_result_component_set_id({4006}); //Inventory + AIBuildings component
-    worker::List<improbable::ComponentSetInterest_Query> const_queries = {market_query, self_query};
-
-    improbable::ComponentSetInterest trader_interest;
-    trader_interest.set_queries(const_queries);
-    trader_entity.Add<improbable::Interest>({{{4005, trader_interest}}});
-
+  void AddRefinerComponents(worker::Entity& trader_entity) {
     // Create production rules
     // 1 food + 1 ore + 1 tools  = 1 metal [REPEATABLE]
-    trader::Building smelter1 = {{{ToSchemaCommodity(known_commodities["metal"]), 1, 1}},
-                              {{ToSchemaCommodity(known_commodities["food"]), 1, 1},
-                                  {ToSchemaCommodity(known_commodities["ore"]), 1, 1},
-                               {ToSchemaCommodity(known_commodities["tools"]), 1, 0.1}},
+    trader::Building smelter1 = {{{ToSchemaCommodity(known_commodities.at("metal")), 1, 1}},
+                              {{ToSchemaCommodity(known_commodities.at("food")), 1, 1},
+                                  {ToSchemaCommodity(known_commodities.at("ore")), 1, 1},
+                               {ToSchemaCommodity(known_commodities.at("tools")), 1, 0.1}},
                               1,
                               "AISmelter1", true};
     // 1 food + 2 ore = 2 metal
-    trader::Building smelter2 = {{{ToSchemaCommodity(known_commodities["metal"]), 2, 1}},
-                              {{ToSchemaCommodity(known_commodities["food"]), 1, 1},
-                               {ToSchemaCommodity(known_commodities["ore"]), 2, 1}},
+    trader::Building smelter2 = {{{ToSchemaCommodity(known_commodities.at("metal")), 2, 1}},
+                              {{ToSchemaCommodity(known_commodities.at("food")), 1, 1},
+                               {ToSchemaCommodity(known_commodities.at("ore")), 2, 1}},
                               2,
                               "AISmelter2", false};
     // 1 food + 1 ore = 1 metal
-    trader::Building smelter3 = {{{ToSchemaCommodity(known_commodities["metal"]), 1, 1}},
-                                 {{ToSchemaCommodity(known_commodities["food"]), 1, 1},
-                                  {ToSchemaCommodity(known_commodities["ore"]), 1, 1}},
+    trader::Building smelter3 = {{{ToSchemaCommodity(known_commodities.at("metal")), 1, 1}},
+                                 {{ToSchemaCommodity(known_commodities.at("food")), 1, 1},
+                                  {ToSchemaCommodity(known_commodities.at("ore")), 1, 1}},
                                  3,
                                  "AISmelter3", false};
-    trader_entity.Add<trader::AIBuildings>({{smelter1, smelter2, smelter3}, 20});
+    trader_entity.Add<trader::AIBuildings>({{RegisterRecipe(smelter1), RegisterRecipe(smelter2), RegisterRecipe(smelter3)}, 20});
     // Add starting inventory
     ::worker::Map<std::string, ::trader::InventoryItem> starting_inv = {
-        {"food", {known_commodities["food"].size, 2}},
-        {"tools", {known_commodities["tools"].size, 1}},
-        {"ore", {known_commodities["ore"].size, 1}},
-        {"metal", {known_commodities["metal"].size, 0}}
+        {"food", {known_commodities.at("food").size, 2}},
+        {"tools", {known_commodities.at("tools").size, 1}},
+        {"ore", {known_commodities.at("ore").size, 1}},
+        {"metal", {known_commodities.at("metal").size, 0}}
     };
     trader_entity.Add<trader::Inventory>({500, starting_inv, 20});
   }
 
-  void AddBlacksmithComponents(worker::Entity& trader_entity, int entity_id) {
-    // Interest for auction house markets
-    improbable::ComponentSetInterest_QueryConstraint market_constraint;
-    market_constraint.set_component_constraint({3001});  // only markets have this MakeOfferCommandComponent
-    improbable::ComponentSetInterest_Query market_query;
-    market_query.set_constraint(market_constraint).set_result_component_set_id({3026});
-
-
-    // add interest for own inventory & buildings
-    improbable::ComponentSetInterest_QueryConstraint self_constraint;
-    self_constraint.set_entity_id_constraint(entity_id);
-    improbable::ComponentSetInterest_Query self_query;
-    self_query.set_constraint(self_constraint).set_result_component_set_id({4006}); //Inventory + AIBuildings component
-
-    worker::List<improbable::ComponentSetInterest_Query> const_queries = {market_query, self_query};
-
-    improbable::ComponentSetInterest trader_interest;
-    trader_interest.set_queries(const_queries);
-    trader_entity.Add<improbable::Interest>({{{4005, trader_interest}}});
-
+  void AddBlacksmithComponents(worker::Entity& trader_entity) {
     // Create production rules
     // 1 food + 1 metal  = 1 tools [REPEATABLE]
-    trader::Building forge1 = {{{ToSchemaCommodity(known_commodities["tools"]), 1, 1}},
-                                 {{ToSchemaCommodity(known_commodities["food"]), 1, 1},
-                                  {ToSchemaCommodity(known_commodities["metal"]), 1, 1}},
+    trader::Building forge1 = {{{ToSchemaCommodity(known_commodities.at("tools")), 1, 1}},
+                                 {{ToSchemaCommodity(known_commodities.at("food")), 1, 1},
+                                  {ToSchemaCommodity(known_commodities.at("metal")), 1, 1}},
                                  1,
                                  "AIForge1", true};
 
-    trader_entity.Add<trader::AIBuildings>({{forge1}, 20});
+    trader_entity.Add<trader::AIBuildings>({{RegisterRecipe(forge1)}, 20});
     // Add starting inventory
     ::worker::Map<std::string, ::trader::InventoryItem> starting_inv = {
-        {"food", {known_commodities["food"].size, 2}},
-        {"tools", {known_commodities["tools"].size, 0}},
-        {"metal", {known_commodities["metal"].size, 1}},
+        {"food", {known_commodities.at("food").size, 2}},
+        {"tools", {known_commodities.at("tools").size, 0}},
+        {"metal", {known_commodities.at("metal").size, 1}},
     };
     trader_entity.Add<trader::Inventory>({500, starting_inv, 20});
   }
@@ -0,0 +1,269 @@
+#ifndef OUTERSPATIALENGINE_PRODUCTION_H
+#define OUTERSPATIALENGINE_PRODUCTION_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "../common/commodity.h"
+
+// Production recipes compiled down to flat tables over commodity indices (MarketIndex of the
+// commodity's component id). Evaluating one needs no string lookups or schema objects: a trader's
+// inventory is loaded once into a fixed-size Stock, and chance rolls come from a pre-drawn batch.
+namespace production {
+  constexpr std::size_t MAX_COMMODITIES = 16;
+  using CommodityMask = std::uint32_t;
+  static_assert(MAX_COMMODITIES <= sizeof(CommodityMask)*8, "one mask bit per commodity");
+
+  struct Term {
+    std::uint16_t commodity;
+    std::int32_t quantity;
+    double chance;
+  };
+
+  // Indices into RecipeBook::terms: inputs first, then outputs
+  struct CompiledRecipe {
+    std::uint32_t first_term = 0;
+    std::uint32_t num_inputs = 0;
+    std::uint32_t num_outputs = 0;
+  };
+
+  // A trader's inventory as seen by the kernel
+  struct Stock {
+    std::array<std::int32_t, MAX_COMMODITIES> quantity{};
+    std::array<double, MAX_COMMODITIES> size{};
+    CommodityMask present = 0; // commodities that have an inventory entry
+    double free_space = 0;
+  };
+
+  struct Outcome {
+    std::int32_t recipe = -1; // -1 if no recipe could run
+    Stock after;
+    std::array<std::int32_t, MAX_COMMODITIES> consumed{};
+    std::array<std::int32_t, MAX_COMMODITIES> produced{};
+    std::array<std::int32_t, MAX_COMMODITIES> overproduced{};
+    CommodityMask consumed_mask = 0;
+    CommodityMask produced_mask = 0;
+  };
+
+  // Uniform [0, 1) draws, generated a block at a time
+  class UniformBatch {
+  public:
+    explicit UniformBatch(std::mt19937& gen)
+        : gen(gen) {};
+    double Next() {
+      if (next == buffer.size()) {
+        std::uniform_real_distribution<> uniform(0, 1);
+        for (auto& draw : buffer) {
+          draw = uniform(gen);
+        }
+        next = 0;
+      }
+      return buffer[next++];
+    }
+  private:
+    std::mt19937& gen;
+    std::array<double, 256> buffer{};
+    std::size_t next = buffer.size();
+  };
+
+  class RecipeBook {
+  public:
+    // Commodity names are only needed to translate to and from the schema's string-keyed maps
+    void SetCommodity(int index, const std::string& name) {
+      CheckIndex(index);
+      names[index] = name;
+      indices[name] = static_cast<std::uint16_t>(index);
+    }
+    const std::string& Name(std::size_t index) const {
+      return names[index];
+    }
+
+    // Compiles (or recompiles) recipe `id`. Throws std::out_of_range if it uses an unknown commodity.
+    void Compile(std::int32_t id, const trader::Building& building) {
+      std::vector<Term> consumes;
+      std::vector<Term> produces;
+      for (const auto& requirement : building.consumes()) {
+        consumes.push_back(ToTerm(requirement.item().component_id(), requirement.quantity(), requirement.chance()));
+      }
+      for (const auto& result : building.produces()) {
+        produces.push_back(ToTerm(result.item().component_id(), result.quantity(), result.chance()));
+      }
+      Compile(id, consumes, produces);
+    }
+    // As above, from terms already over commodity indices
+    void Compile(std::int32_t id, const std::vector<Term>& consumes, const std::vector<Term>& produces) {
+      if (id < 0) {
+        throw std::out_of_range("Negative recipe id");
+      }
+      CompiledRecipe recipe;
+      recipe.first_term = static_cast<std::uint32_t>(terms.size());
+      for (const auto& term : consumes) {
+        CheckIndex(term.commodity);
+        terms.push_back(term);
+      }
+      for (const auto& term : produces) {
+        CheckIndex(term.commodity);
+        terms.push_back(term);
+      }
+      recipe.num_inputs = static_cast<std::uint32_t>(consumes.size());
+      recipe.num_outputs = static_cast<std::uint32_t>(produces.size());
+      if (static_cast<std::size_t>(id) >= recipes.size()) {
+        recipes.resize(id + 1);
+      }
+      recipes[id] = recipe; // terms of a replaced recipe are simply left unused
+    }
+
+    Stock Load(const trader::InventoryData& inventory) const {
+      Stock stock;
+      double used_space = 0;
+      for (const auto& item : inventory.inv()) {
+        used_space += item.second.size()*item.second.quantity();
+        auto index = indices.find(item.first);
+        if (index == indices.end()) {
+          continue;
+        }
+        stock.quantity[index->second] = item.second.quantity();
+        stock.size[index->second] = item.second.size();
+        stock.present |= Bit(index->second);
+      }
+      stock.free_space = inventory.capacity() - used_space;
+      return stock;
+    }
+
+    // Runs the first recipe in `program` (ids, highest priority first) whose inputs are all in stock
+    bool Evaluate(const std::vector<std::int32_t>& program, const Stock& stock, UniformBatch& rolls, Outcome& outcome) const {
+      for (auto id : program) {
+        const auto& recipe = recipes[id];
+        const Term* inputs = terms.data() + recipe.first_term;
+        const Term* outputs = inputs + recipe.num_inputs;
+        if (!InputsMet(inputs, recipe.num_inputs, stock)) {
+          continue;
+        }
+        outcome.recipe = id;
+        outcome.after = stock;
+        // Consumes what is asked for, or what is left; produces what fits in the space left after that
+        for (std::uint32_t i = 0; i < recipe.num_inputs; i++) {
+          const Term& input = inputs[i];
+          if (input.chance >= 1 || rolls.Next() < input.chance) {
+            std::int32_t actual = std::min(input.quantity, outcome.after.quantity[input.commodity]);
+            outcome.after.quantity[input.commodity] -= actual;
+            outcome.after.free_space += actual*outcome.after.size[input.commodity];
+            outcome.consumed[input.commodity] = actual;
+            outcome.consumed_mask |= Bit(input.commodity);
+          }
+        }
+        for (std::uint32_t i = 0; i < recipe.num_outputs; i++) {
+          const Term& output = outputs[i];
+          if (output.chance >= 1 || rolls.Next() < output.chance) {
+            std::int32_t actual = std::min(output.quantity, Room(outcome.after.free_space, outcome.after.size[output.commodity]));
+            outcome.after.quantity[output.commodity] += actual;
+            outcome.after.free_space -= actual*outcome.after.size[output.commodity];
+            outcome.produced[output.commodity] = actual;
+            outcome.overproduced[output.commodity] = output.quantity - actual;
+            outcome.produced_mask |= Bit(output.commodity);
+          }
+        }
+        return true;
+      }
+      return false;
+    }
+
+    // Evaluate for a cohort of `members` traders sharing one pooled stock. A recipe runs if the average
+    // member has its inputs, and each chance term then fires for Binomial(members, chance) of them
+    // rather than for all or none, so the cohort's totals match `members` separate evaluations on average.
+    bool EvaluateCohort(const std::vector<std::int32_t>& program, const Stock& stock, std::int32_t members,
+                        std::mt19937& gen, Outcome& outcome) const {
+      for (auto id : program) {
+        const auto& recipe = recipes[id];
+        const Term* inputs = terms.data() + recipe.first_term;
+        const Term* outputs = inputs + recipe.num_inputs;
+        if (!InputsMet(inputs, recipe.num_inputs, stock, members)) {
+          continue;
+        }
+        outcome.recipe = id;
+        outcome.after = stock;
+        // Same per-member arithmetic as Evaluate, on each member's share of the stock and free space
+        for (std::uint32_t i = 0; i < recipe.num_inputs; i++) {
+          const Term& input = inputs[i];
+          std::int32_t rolled = Rolled(input.chance, members, gen);
+          if (rolled > 0) {
+            std::int32_t share = outcome.after.quantity[input.commodity] / members;
+            std::int32_t actual = rolled*std::min(input.quantity, share);
+            outcome.after.quantity[input.commodity] -= actual;
+            outcome.after.free_space += actual*outcome.after.size[input.commodity];
+            outcome.consumed[input.commodity] = actual;
+            outcome.consumed_mask |= Bit(input.commodity);
+          }
+        }
+        for (std::uint32_t i = 0; i < recipe.num_outputs; i++) {
+          const Term& output = outputs[i];
+          std::int32_t rolled = Rolled(output.chance, members, gen);
+          if (rolled > 0) {
+            std::int32_t room = Room(outcome.after.free_space/members, outcome.after.size[output.commodity]);
+            std::int32_t per_member = std::min(output.quantity, room);
+            outcome.after.quantity[output.commodity] += rolled*per_member;
+            outcome.after.free_space -= rolled*per_member*outcome.after.size[output.commodity];
+            outcome.produced[output.commodity] = rolled*per_member;
+            outcome.overproduced[output.commodity] = rolled*(output.quantity - per_member);
+            outcome.produced_mask |= Bit(output.commodity);
+          }
+        }
+        return true;
+      }
+      return false;
+    }
+
+    static CommodityMask Bit(std::size_t index) {
+      return CommodityMask(1) << index;
+    }
+
+  private:
+    std::vector<Term> terms;
+    std::vector<CompiledRecipe> recipes;
+    std::array<std::string, MAX_COMMODITIES> names;
+    std::map<std::string, std::uint16_t> indices;
+
+    static void CheckIndex(int index) {
+      if (index < 0 || static_cast<std::size_t>(index) >= MAX_COMMODITIES) {
+        throw std::out_of_range("Commodity index " + std::to_string(index) + " out of range");
+      }
+    }
+    static Term ToTerm(int component_id, std::int32_t quantity, double chance) {
+      int index = MarketIndex(component_id);
+      CheckIndex(index);
+      return {static_cast<std::uint16_t>(index), quantity, chance};
+    }
+    // Whole units of a commodity of `size` that fit in `free_space`
+    static std::int32_t Room(double free_space, double size) {
+      if (size <= 0) {
+        return std::numeric_limits<std::int32_t>::max();
+      }
+      double units = std::floor(free_space/size);
+      return static_cast<std::int32_t>(std::clamp(units, 0.0, double(std::numeric_limits<std::int32_t>::max())));
+    }
+    static bool InputsMet(const Term* inputs, std::uint32_t count, const Stock& stock, std::int64_t members = 1) {
+      for (std::uint32_t i = 0; i < count; i++) {
+        if (!(stock.present & Bit(inputs[i].commodity)) || stock.quantity[inputs[i].commodity] < inputs[i].quantity*members) {
+          return false;
+        }
+      }
+      return true;
+    }
+    static std::int32_t Rolled(double chance, std::int32_t members, std::mt19937& gen) {
+      if (chance >= 1) {
+        return members;
+      }
+      return std::binomial_distribution<std::int32_t>(members, std::max(0.0, chance))(gen);
+    }
+  };
+}
+
+#endif  // OUTERSPATIALENGINE_PRODUCTION_H
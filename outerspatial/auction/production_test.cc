@@ -0,0 +1,197 @@
+#undef NDEBUG  // the checks are asserts
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include <trader.h>
+
+#include "production.h"
+
+// RecipeBook::Evaluate against the item-at-a-time arithmetic it replaces: consume what is asked for
+// or what is left, then produce what fits in the space freed up. EvaluateCohort against Evaluate.
+
+using production::Term;
+
+struct NaiveInventory {
+  std::vector<std::int32_t> quantity;
+  std::vector<double> size;
+  double capacity;
+
+  double FreeSpace() const {
+    double used = 0;
+    for (std::size_t i = 0; i < quantity.size(); i++) {
+      used += quantity[i]*size[i];
+    }
+    return capacity - used;
+  }
+  void Consume(const Term& input) {
+    quantity[input.commodity] -= std::min(input.quantity, quantity[input.commodity]);
+  }
+  void Produce(const Term& output) {
+    std::int32_t fits = output.quantity;
+    while (fits > 0 && fits*size[output.commodity] > FreeSpace()) {
+      fits--;
+    }
+    quantity[output.commodity] += fits;
+  }
+};
+
+production::Stock ToStock(const NaiveInventory& inventory) {
+  production::Stock stock;
+  for (std::size_t i = 0; i < inventory.quantity.size(); i++) {
+    stock.quantity[i] = inventory.quantity[i];
+    stock.size[i] = inventory.size[i];
+    stock.present |= production::RecipeBook::Bit(i);
+  }
+  stock.free_space = inventory.FreeSpace();
+  return stock;
+}
+
+// 1 fertilizer + 1 wood = 3 food, with room for all of it
+void TestOneRecipe() {
+  const std::uint16_t FOOD = 0, WOOD = 1, FERTILIZER = 2;
+  production::RecipeBook book;
+  book.Compile(0, {{FERTILIZER, 1, 1.0}, {WOOD, 1, 1.0}}, {{FOOD, 3, 1.0}});
+  NaiveInventory inventory{{2, 5, 4}, {0.5, 1, 0.1}, 20};
+  std::mt19937 gen(1);
+  production::UniformBatch rolls(gen);
+  production::Outcome outcome;
+  assert(book.Evaluate({0}, ToStock(inventory), rolls, outcome));
+  assert(outcome.recipe == 0);
+  assert(outcome.after.quantity[FOOD] == 5);
+  assert(outcome.after.quantity[WOOD] == 4);
+  assert(outcome.after.quantity[FERTILIZER] == 3);
+  assert(outcome.consumed[WOOD] == 1 && outcome.consumed[FERTILIZER] == 1);
+  assert(outcome.produced[FOOD] == 3 && outcome.overproduced[FOOD] == 0);
+}
+
+// Output that does not fit is reported as overproduction
+void TestFullInventory() {
+  const std::uint16_t FOOD = 0, WOOD = 1;
+  production::RecipeBook book;
+  book.Compile(0, {{WOOD, 1, 1.0}}, {{FOOD, 6, 1.0}});
+  NaiveInventory inventory{{0, 9}, {0.5, 1}, 10.5};
+  std::mt19937 gen(1);
+  production::UniformBatch rolls(gen);
+  production::Outcome outcome;
+  assert(book.Evaluate({0}, ToStock(inventory), rolls, outcome));
+  // 1.5 free, plus 1 freed by the wood: 5 food fit
+  assert(outcome.after.quantity[FOOD] == 5);
+  assert(outcome.produced[FOOD] == 5 && outcome.overproduced[FOOD] == 1);
+}
+
+void TestAgainstNaive() {
+  const std::size_t COMMODITIES = 6;
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<std::int32_t> quantity(0, 8);
+  std::uniform_int_distribution<std::uint16_t> commodity(0, COMMODITIES - 1);
+  std::uniform_int_distribution<int> terms(1, 3);
+  for (int trial = 0; trial < 2000; trial++) {
+    production::RecipeBook book;
+    std::vector<std::int32_t> program;
+    std::vector<std::vector<Term>> consumes(3), produces(3);
+    for (std::int32_t id = 0; id < 3; id++) {
+      // distinct commodities, so each term touches its own entry as in the schema's maps
+      std::vector<bool> used(COMMODITIES);
+      auto term = [&] {
+        std::uint16_t c;
+        do {
+          c = commodity(gen);
+        } while (used[c]);
+        used[c] = true;
+        return Term{c, 1 + quantity(gen), 1.0};
+      };
+      for (int i = terms(gen); i > 0; i--) {
+        consumes[id].push_back(term());
+      }
+      for (int i = terms(gen) - 1; i > 0; i--) {
+        produces[id].push_back(term());
+      }
+      book.Compile(id, consumes[id], produces[id]);
+      program.push_back(id);
+    }
+    NaiveInventory inventory{{}, {}, 0};
+    for (std::size_t i = 0; i < COMMODITIES; i++) {
+      inventory.quantity.push_back(quantity(gen));
+      inventory.size.push_back(0.5*(1 + i % 3));
+    }
+    inventory.capacity = inventory.FreeSpace() + quantity(gen);
+
+    production::UniformBatch rolls(gen);
+    production::Outcome outcome;
+    bool ran = book.Evaluate(program, ToStock(inventory), rolls, outcome);
+
+    std::int32_t expected_recipe = -1;
+    for (auto id : program) {
+      bool met = true;
+      for (const auto& input : consumes[id]) {
+        met = met && inventory.quantity[input.commodity] >= input.quantity;
+      }
+      if (met) {
+        expected_recipe = id;
+        break;
+      }
+    }
+    assert(ran == (expected_recipe >= 0));
+    if (!ran) {
+      continue;
+    }
+    assert(outcome.recipe == expected_recipe);
+    for (const auto& input : consumes[expected_recipe]) {
+      inventory.Consume(input);
+    }
+    for (const auto& output : produces[expected_recipe]) {
+      inventory.Produce(output);
+    }
+    for (std::size_t i = 0; i < COMMODITIES; i++) {
+      assert(outcome.after.quantity[i] == inventory.quantity[i]);
+    }
+  }
+}
+
+// A cohort whose pooled stock is `members` copies of one trader's ends up as `members` copies of
+// that trader's outcome, when every term is certain
+void TestCohort() {
+  const std::uint16_t FOOD = 0, WOOD = 1, TOOLS = 2;
+  production::RecipeBook book;
+  book.Compile(0, {{WOOD, 2, 1.0}, {TOOLS, 1, 1.0}}, {{FOOD, 10, 1.0}});
+  book.Compile(1, {{WOOD, 1, 1.0}}, {{FOOD, 2, 1.0}});
+  std::mt19937 gen(3);
+  for (std::int32_t members : {1, 2, 7, 100}) {
+    for (double capacity : {40.0, 6.0, 4.5}) { // room for all of the output, or only some
+      NaiveInventory member{{1, 3, 1}, {0.5, 1, 1}, capacity};
+      NaiveInventory cohort{{members*1, members*3, members*1}, member.size, members*capacity};
+
+      production::UniformBatch rolls(gen);
+      production::Outcome single;
+      production::Outcome pooled;
+      assert(book.Evaluate({0, 1}, ToStock(member), rolls, single));
+      assert(book.EvaluateCohort({0, 1}, ToStock(cohort), members, gen, pooled));
+      assert(pooled.recipe == single.recipe);
+      assert(capacity > 10 || single.overproduced[FOOD] > 0);
+      for (std::uint16_t c : {FOOD, WOOD, TOOLS}) {
+        assert(pooled.after.quantity[c] == members*single.after.quantity[c]);
+        assert(pooled.consumed[c] == members*single.consumed[c]);
+        assert(pooled.produced[c] == members*single.produced[c]);
+        assert(pooled.overproduced[c] == members*single.overproduced[c]);
+      }
+    }
+  }
+  // Recipe 0 needs 2 wood each: a cohort short of that on average falls through to recipe 1
+  production::Outcome outcome;
+  NaiveInventory cohort{{0, 19, 10}, {0.5, 1, 1}, 100};
+  assert(book.EvaluateCohort({0, 1}, ToStock(cohort), 10, gen, outcome));
+  assert(outcome.recipe == 1 && outcome.after.quantity[WOOD] == 9 && outcome.after.quantity[FOOD] == 20);
+}
+
+int main() {
+  TestOneRecipe();
+  TestFullInventory();
+  TestAgainstNaive();
+  TestCohort();
+  std::cout << "production_test passed" << std::endl;
+  return 0;
+}
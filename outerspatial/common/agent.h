@@ -6,6 +6,8 @@
 #define CPPBAZAARBOT_AGENT_H
 
 #include "messages.h"
+#include "transport.h"
+#include "inventory_ledger.h"
 #include <memory>
 #include <utility>
 
@@ -13,12 +15,12 @@ class AuctionHouse;
 // All an agent is is an entity with an id, capable of sending and receiving messages
 class Agent {
 protected:
-    worker::Connection& connection;
-    worker::View& view;
+    transport::Connection& connection;
+    transport::View& view;
 public:
     int id;
     int ticks = 0;
-    Agent(int agent_id, worker::Connection& connection, worker::View& view)
+    Agent(int agent_id, transport::Connection& connection, transport::View& view)
       : connection(connection)
       , view(view)
       , id(agent_id) {};
@@ -41,20 +43,21 @@ public:
 // A Trader is an Agent capable of interacting with an AuctionHouse
 class Trader : public Agent {
 public:
-    Trader(int id, std::string name, worker::Connection& connection, worker::View& view)
+    Trader(int id, std::string name, transport::Connection& connection, transport::View& view)
         : Agent(id, connection, view)
-        , class_name(std::move(name)){};
+        , class_name(std::move(name))
+        , inventory_ledger(view) {};
     ~Trader() override = default;
 
     bool HasMoney(double quantity) {
-      auto inv = view.Entities[id].Get<trader::Inventory>();
+      auto inv = OwnInventory();
       if (inv) {
         return (inv->cash() >= quantity);
       }
       return false;
     };
     bool HasCommodity(const std::string& commodity, int quantity) {
-      auto inv = view.Entities[id].Get<trader::Inventory>();
+      auto inv = OwnInventory();
       if (inv) {
           auto inv_items = inv->inv();
           // TODO Use find to check for missing items and make function const
@@ -67,6 +70,11 @@ public:
 protected:
     friend AuctionHouse;
     std::string class_name;
+    // Our Inventory as of the latest update from the AH; item changes only arrive as events
+    InventoryLedger inventory_ledger;
+    trader::InventoryData* OwnInventory() {
+      return inventory_ledger.Find(id);
+    }
     virtual double TryTakeMoney(double quantity, bool atomic) {};
     virtual void ForceTakeMoney(double quantity) {};
     virtual void AddMoney(double quantity) {};
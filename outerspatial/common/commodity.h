@@ -5,6 +5,13 @@
 #ifndef CPPBAZAARBOT_COMMODITY_H
 #define CPPBAZAARBOT_COMMODITY_H
 
+// Markets are identified by component id 3010 onwards. All of them are published together in the AH's
+// MarketSnapshot component, at index (market_component_id - FIRST_MARKET_COMPONENT_ID)
+constexpr int FIRST_MARKET_COMPONENT_ID = 3010;
+inline int MarketIndex(int market_component_id) {
+  return market_component_id - FIRST_MARKET_COMPONENT_ID;
+}
+
 // simplest form of Commodity, detailing the name and size (eg: "wood", 1)
 class Commodity {
 public:
@@ -0,0 +1,317 @@
+#ifndef OUTERSPATIALENGINE_COROUTINE_H
+#define OUTERSPATIALENGINE_COROUTINE_H
+
+// C++20 coroutine support, only compiled when the worker is built as C++20 (OUTERSPATIAL_COROUTINES
+// in the worker's CMakeLists). Everything here runs on the thread that owns the Connection and View:
+// a suspended coroutine is just its frame, parked in one of the tables below until the View or the
+// Executor resumes it, so it costs no thread and is never polled.
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define OUTERSPATIAL_HAS_COROUTINES 1
+#else
+#define OUTERSPATIAL_HAS_COROUTINES 0
+#endif
+
+#if OUTERSPATIAL_HAS_COROUTINES
+
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <improbable/worker.h>
+
+#include "executor.h"
+#include "transport.h"
+
+namespace coro {
+  // A coroutine that starts running as soon as it is called and is owned by the returned Task.
+  // Destroying the Task destroys a suspended coroutine's frame, which unregisters whatever it was
+  // waiting on.
+  class Task {
+  public:
+    struct promise_type {
+      std::exception_ptr exception;
+
+      Task get_return_object() {
+        return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+      std::suspend_never initial_suspend() noexcept {
+        return {};
+      }
+      std::suspend_always final_suspend() noexcept {
+        return {}; // keep the frame so done() can be checked
+      }
+      void return_void() {}
+      void unhandled_exception() {
+        exception = std::current_exception();
+      }
+    };
+
+    Task() = default;
+    Task(Task&& other) noexcept
+        : handle(std::exchange(other.handle, {})) {};
+    Task& operator=(Task&& other) noexcept {
+      if (this != &other) {
+        Reset();
+        handle = std::exchange(other.handle, {});
+      }
+      return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+      Reset();
+    }
+
+    bool done() const {
+      return !handle || handle.done();
+    }
+    // Rethrows whatever ended the coroutine early, if anything did
+    void Check() const {
+      if (handle && handle.promise().exception) {
+        std::rethrow_exception(handle.promise().exception);
+      }
+    }
+
+  private:
+    explicit Task(std::coroutine_handle<promise_type> handle)
+        : handle(handle) {};
+    void Reset() {
+      if (handle) {
+        handle.destroy();
+        handle = {};
+      }
+    }
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  // Awaitable command requests: `auto op = co_await commands.Send<T>(entity_id, request, timeout);`
+  // suspends until the SDK delivers the CommandResponseOp, which it always does (on failure or
+  // timeout too). The router registers one View callback per command type, on first use.
+  class CommandRouter {
+  public:
+    CommandRouter(transport::Connection& connection, transport::View& view)
+        : connection(connection)
+        , view(view) {};
+    CommandRouter(const CommandRouter&) = delete;
+    CommandRouter& operator=(const CommandRouter&) = delete;
+    ~CommandRouter() {
+      for (auto key : callback_keys) {
+        view.Remove(key);
+      }
+    }
+
+    template<typename T>
+    class Response {
+    public:
+      Response(CommandRouter& router, worker::EntityId entity_id, const typename T::Request& request,
+               const worker::Option<std::uint32_t>& timeout_ms)
+          : router(router)
+          , entity_id(entity_id)
+          , request(request)
+          , timeout_ms(timeout_ms) {};
+      Response(const Response&) = delete;
+      Response& operator=(const Response&) = delete;
+      ~Response() {
+        if (waiting) {
+          router.Waiting<T>().erase(request_id);
+        }
+      }
+
+      bool await_ready() const {
+        return false;
+      }
+      void await_suspend(std::coroutine_handle<> awaiting) {
+        handle = awaiting;
+        request_id = router.connection.SendCommandRequest<T>(entity_id, request, timeout_ms).Id;
+        router.Waiting<T>()[request_id] = this;
+        waiting = true;
+      }
+      transport::CommandResponseOp<T> await_resume() {
+        return std::move(*op);
+      }
+
+    private:
+      friend class CommandRouter;
+      CommandRouter& router;
+      worker::EntityId entity_id;
+      typename T::Request request;
+      worker::Option<std::uint32_t> timeout_ms;
+      std::uint32_t request_id = 0;
+      bool waiting = false;
+      std::coroutine_handle<> handle;
+      std::optional<transport::CommandResponseOp<T>> op;
+    };
+
+    template<typename T>
+    Response<T> Send(worker::EntityId entity_id, const typename T::Request& request,
+                     const worker::Option<std::uint32_t>& timeout_ms = {}) {
+      return Response<T>(*this, entity_id, request, timeout_ms);
+    }
+
+  private:
+    struct TableBase {
+      virtual ~TableBase() = default;
+    };
+    template<typename T>
+    struct Table : TableBase {
+      std::unordered_map<std::uint32_t, Response<T>*> waiting; // request ID -> suspended Send
+    };
+
+    transport::Connection& connection;
+    transport::View& view;
+    std::unordered_map<std::type_index, std::unique_ptr<TableBase>> tables;
+    std::vector<std::uint64_t> callback_keys;
+
+    template<typename T>
+    std::unordered_map<std::uint32_t, Response<T>*>& Waiting() {
+      auto& table = tables[std::type_index(typeid(T))];
+      if (!table) {
+        table = std::make_unique<Table<T>>();
+        callback_keys.push_back(view.OnCommandResponse<T>(
+            [this](const transport::CommandResponseOp<T>& op) { Resume<T>(op); }));
+      }
+      return static_cast<Table<T>&>(*table).waiting;
+    }
+
+    template<typename T>
+    void Resume(const transport::CommandResponseOp<T>& op) {
+      auto& waiting = Waiting<T>();
+      auto entry = waiting.find(op.RequestId.Id);
+      if (entry == waiting.end()) {
+        return; // not one of ours
+      }
+      Response<T>* response = entry->second;
+      waiting.erase(entry);
+      response->waiting = false;
+      response->op.emplace(op);
+      response->handle.resume();
+    }
+  };
+
+  // `co_await Sleep(executor, ms)` resumes the coroutine from the executor's main lane ms later
+  class Sleep {
+  public:
+    Sleep(Executor& executor, int delay_ms)
+        : executor(executor)
+        , delay_ms(delay_ms) {};
+    Sleep(const Sleep&) = delete;
+    Sleep& operator=(const Sleep&) = delete;
+    ~Sleep() {
+      if (timer) {
+        executor.Cancel(timer);
+      }
+    }
+
+    bool await_ready() const {
+      return delay_ms <= 0;
+    }
+    void await_suspend(std::coroutine_handle<> awaiting) {
+      timer = executor.After(delay_ms, [this, awaiting] {
+        timer = 0;
+        awaiting.resume();
+      });
+    }
+    void await_resume() const {}
+
+  private:
+    Executor& executor;
+    int delay_ms;
+    Executor::TaskId timer = 0;
+  };
+
+  // Values pushed by callbacks (e.g. command requests routed to an agent), awaited by one coroutine.
+  // `co_await mailbox.Next(executor, timeout_ms)` gives the next value, or nullopt on timeout.
+  template<typename T>
+  class Mailbox {
+  public:
+    class Receive;
+
+    Mailbox() = default;
+    Mailbox(const Mailbox&) = delete;
+    Mailbox& operator=(const Mailbox&) = delete;
+
+    void Push(T value) {
+      items.push_back(std::move(value));
+      if (receiver) {
+        std::exchange(receiver, nullptr)->Wake();
+      }
+    }
+    std::optional<T> TryPop() {
+      if (items.empty()) {
+        return {};
+      }
+      T value = std::move(items.front());
+      items.pop_front();
+      return value;
+    }
+    bool empty() const {
+      return items.empty();
+    }
+
+    Receive Next(Executor& executor, int timeout_ms) {
+      return Receive(*this, executor, timeout_ms);
+    }
+
+    class Receive {
+    public:
+      Receive(Mailbox& mailbox, Executor& executor, int timeout_ms)
+          : mailbox(mailbox)
+          , executor(executor)
+          , timeout_ms(timeout_ms) {};
+      Receive(const Receive&) = delete;
+      Receive& operator=(const Receive&) = delete;
+      ~Receive() {
+        if (mailbox.receiver == this) {
+          mailbox.receiver = nullptr;
+        }
+        if (timer) {
+          executor.Cancel(timer);
+        }
+      }
+
+      bool await_ready() const {
+        return !mailbox.empty() || timeout_ms <= 0;
+      }
+      void await_suspend(std::coroutine_handle<> awaiting) {
+        handle = awaiting;
+        mailbox.receiver = this;
+        timer = executor.After(timeout_ms, [this] {
+          timer = 0;
+          mailbox.receiver = nullptr;
+          handle.resume();
+        });
+      }
+      std::optional<T> await_resume() {
+        return mailbox.TryPop();
+      }
+
+    private:
+      friend class Mailbox;
+      Mailbox& mailbox;
+      Executor& executor;
+      int timeout_ms;
+      Executor::TaskId timer = 0;
+      std::coroutine_handle<> handle;
+
+      void Wake() {
+        executor.Cancel(std::exchange(timer, 0));
+        handle.resume();
+      }
+    };
+
+  private:
+    std::deque<T> items;
+    Receive* receiver = nullptr; // the coroutine waiting in Next, if any
+  };
+}
+
+#endif  // OUTERSPATIAL_HAS_COROUTINES
+
+#endif  // OUTERSPATIALENGINE_COROUTINE_H
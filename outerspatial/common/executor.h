@@ -0,0 +1,342 @@
+#ifndef OUTERSPATIALENGINE_EXECUTOR_H
+#define OUTERSPATIALENGINE_EXECUTOR_H
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "sim_clock.h"
+
+// Hierarchical timer wheel: LEVELS wheels of SLOTS slots, each level's slot spanning a whole turn of
+// the level below. Inserting is O(1); a timer is cascaded down a level each time its slot comes up, so
+// it is touched at most LEVELS times before it fires. Times are in wheel ticks; callers pick the
+// resolution. Timers further out than the wheel spans are parked in the next top-level slot and
+// re-placed each time it comes up.
+class TimerWheel {
+public:
+  static constexpr int SLOT_BITS = 6;
+  static constexpr std::size_t SLOTS = std::size_t(1) << SLOT_BITS;
+  static constexpr int LEVELS = 4;
+
+  struct Timer {
+    std::uint64_t id;
+    std::int64_t deadline;
+  };
+
+  explicit TimerWheel(std::int64_t now = 0)
+      : current(now) {};
+
+  void Insert(std::uint64_t id, std::int64_t deadline) {
+    Place({id, std::max(deadline, current + 1)});
+    count++;
+  }
+
+  // Moves time forward to `now`, appending every timer that has come due to `due`
+  void Advance(std::int64_t now, std::vector<std::uint64_t>& due) {
+    while (current < now) {
+      if (count == 0) {
+        current = now;
+        return;
+      }
+      // Skip straight to the next tick that has anything to do
+      current = std::min(now, NextEvent());
+      Cascade();
+      auto& slot = wheels[0][Index(current, 0)];
+      for (const auto& timer : slot) {
+        due.push_back(timer.id);
+      }
+      count -= slot.size();
+      slot.clear();
+    }
+  }
+
+  // The earliest tick at which Advance could produce a timer: exact for timers on the lowest level,
+  // otherwise the tick at which the next occupied higher slot is cascaded down
+  std::int64_t NextEvent() const {
+    if (count == 0) {
+      return std::numeric_limits<std::int64_t>::max();
+    }
+    for (int level = 0; level < LEVELS; level++) {
+      std::int64_t span = std::int64_t(1) << (SLOT_BITS*level);
+      std::int64_t base = (current >> (SLOT_BITS*level)); // current position on this level
+      for (std::size_t step = 1; step <= SLOTS; step++) {
+        std::int64_t position = base + static_cast<std::int64_t>(step);
+        if (!wheels[level][position & (SLOTS - 1)].empty()) {
+          return position*span;
+        }
+        if (level + 1 < LEVELS && (position & (SLOTS - 1)) == 0) {
+          break; // the level above cascades into this one here, so check it first
+        }
+      }
+    }
+    return current + 1;
+  }
+
+  std::size_t size() const {
+    return count;
+  }
+  std::int64_t now() const {
+    return current;
+  }
+
+private:
+  std::array<std::array<std::vector<Timer>, SLOTS>, LEVELS> wheels;
+  std::int64_t current;
+  std::size_t count = 0;
+
+  static std::size_t Index(std::int64_t tick, int level) {
+    return static_cast<std::size_t>(tick >> (SLOT_BITS*level)) & (SLOTS - 1);
+  }
+
+  void Place(const Timer& timer) {
+    for (int level = 0; level < LEVELS; level++) {
+      // The timer belongs on the lowest level whose current turn still contains its deadline
+      if ((timer.deadline >> (SLOT_BITS*(level + 1))) == (current >> (SLOT_BITS*(level + 1)))
+          || level == LEVELS - 1) {
+        std::int64_t deadline = timer.deadline;
+        if (level == LEVELS - 1 && (deadline >> (SLOT_BITS*LEVELS)) != (current >> (SLOT_BITS*LEVELS))) {
+          deadline = current + (std::int64_t(1) << (SLOT_BITS*level)); // out of range: look again next slot
+        }
+        wheels[level][Index(deadline, level)].push_back(timer);
+        return;
+      }
+    }
+  }
+
+  // On entering a new turn of a level, pull its slot for this turn down into the levels below
+  void Cascade() {
+    for (int level = 1; level < LEVELS; level++) {
+      if ((current & ((std::int64_t(1) << (SLOT_BITS*level)) - 1)) != 0) {
+        return;
+      }
+      auto slot = std::move(wheels[level][Index(current, level)]);
+      wheels[level][Index(current, level)].clear();
+      for (const auto& timer : slot) {
+        Place(timer);
+      }
+    }
+  }
+};
+
+// Runs periodic tasks off a shared TimerWheel with a small thread pool, instead of each agent pacing
+// itself with sleep_for. Tasks go on one of two lanes:
+//  - MAIN tasks only run inside RunMain(), on the thread that owns the SpatialOS Connection and View
+//  - POOL tasks run on the executor's own threads, and must not touch the Connection or View. An
+//    executor built without pool threads runs them inside RunMain() like MAIN tasks instead.
+// Nobody busy-waits: pool threads sleep until the next deadline, and RunMain() returns how long the
+// main thread can block (e.g. in GetOpList) before it is needed again. Wake-ups are late by at most
+// RESOLUTION_MS plus the time spent running other due tasks.
+// Timers follow the steady clock, or the SimClock given, if any. A LogicalClock only moves when it is
+// advanced, so whoever advances it decides how fast time goes (pool threads just poll it).
+class Executor {
+public:
+  enum Lane {
+    MAIN,
+    POOL
+  };
+  using TaskId = std::uint64_t;
+
+  explicit Executor(std::size_t pool_threads = 0, int resolution_ms = 1, const SimClock* clock = nullptr)
+      : RESOLUTION_MS(std::max(1, resolution_ms))
+      , clock(clock)
+      , wheel(Tick(NowMs())) {
+    for (std::size_t i = 0; i < pool_threads; i++) {
+      threads.emplace_back([this] { PoolLoop(); });
+    }
+  }
+  Executor(const Executor&) = delete;
+  Executor& operator=(const Executor&) = delete;
+  ~Executor() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  }
+
+  // Runs `task` every period_ms. The first run is staggered randomly across one period, and every run
+  // is pushed back by up to jitter_ms, so agents started together don't all wake on the same tick.
+  TaskId Every(int period_ms, int jitter_ms, std::function<void()> task, Lane lane = MAIN) {
+    std::lock_guard<std::mutex> lock(mutex);
+    TaskId id = next_id++;
+    Task& entry = tasks[id];
+    entry.period = std::max<std::int64_t>(1, period_ms / RESOLUTION_MS);
+    entry.jitter = std::max(0, jitter_ms) / RESOLUTION_MS;
+    entry.lane = lane;
+    entry.run = std::make_shared<std::function<void()>>(std::move(task));
+    entry.anchor = Tick(NowMs()) + std::uniform_int_distribution<std::int64_t>(0, entry.period - 1)(rng);
+    Arm(id, entry);
+    wake.notify_all();
+    return id;
+  }
+
+  // Runs `task` once, delay_ms from now
+  TaskId After(int delay_ms, std::function<void()> task, Lane lane = MAIN) {
+    std::lock_guard<std::mutex> lock(mutex);
+    TaskId id = next_id++;
+    Task& entry = tasks[id];
+    entry.once = true;
+    entry.lane = lane;
+    entry.run = std::make_shared<std::function<void()>>(std::move(task));
+    entry.anchor = Tick(NowMs()) + std::max(0, delay_ms) / RESOLUTION_MS;
+    Arm(id, entry);
+    wake.notify_all();
+    return id;
+  }
+
+  // The task won't be started again; a run already in progress is allowed to finish
+  void Cancel(TaskId id) {
+    std::lock_guard<std::mutex> lock(mutex);
+    tasks.erase(id);
+  }
+
+  // Runs every MAIN task that is due, then returns the milliseconds until the next one is
+  // (at most max_wait_ms), for use as the main thread's blocking timeout
+  int RunMain(int max_wait_ms = 100) {
+    std::deque<TaskId> due;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Collect();
+      due.swap(main_ready);
+    }
+    for (auto id : due) {
+      RunTask(id);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    Collect();
+    if (!main_ready.empty()) {
+      return 0;
+    }
+    std::int64_t wait = (wheel.NextEvent() - Tick(NowMs()))*RESOLUTION_MS;
+    return static_cast<int>(std::clamp<std::int64_t>(wait, 0, max_wait_ms));
+  }
+
+  std::size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return tasks.size();
+  }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Task {
+    std::int64_t period = 1;
+    std::int64_t jitter = 0;
+    std::int64_t anchor = 0; // the unjittered time of the next run, so jitter never accumulates
+    bool once = false;
+    Lane lane = MAIN;
+    std::shared_ptr<std::function<void()>> run;
+  };
+
+  const int RESOLUTION_MS;
+  const SimClock* clock; // nullptr: the steady clock
+  mutable std::mutex mutex;
+  std::condition_variable wake;
+  TimerWheel wheel;
+  std::unordered_map<TaskId, Task> tasks;
+  std::deque<TaskId> main_ready;
+  std::deque<TaskId> pool_ready;
+  std::vector<std::thread> threads;
+  std::vector<std::uint64_t> due_scratch;
+  std::mt19937 rng = std::mt19937(std::random_device()());
+  TaskId next_id = 1;
+  bool stopping = false;
+
+  std::int64_t NowMs() const {
+    if (clock) {
+      return clock->NowMs();
+    }
+    return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now().time_since_epoch()).count();
+  }
+  std::int64_t Tick(std::int64_t time_ms) const {
+    return time_ms / RESOLUTION_MS;
+  }
+
+  void Arm(TaskId id, const Task& task) {
+    std::int64_t jitter = (task.jitter > 0) ? std::uniform_int_distribution<std::int64_t>(0, task.jitter)(rng) : 0;
+    wheel.Insert(id, task.anchor + jitter);
+  }
+
+  // Called with the lock held: moves due tasks onto their lane's ready queue (MAIN's for every task if
+  // there is no pool to run POOL tasks)
+  void Collect() {
+    due_scratch.clear();
+    wheel.Advance(Tick(NowMs()), due_scratch);
+    for (auto id : due_scratch) {
+      auto task = tasks.find(id);
+      if (task == tasks.end()) {
+        continue; // cancelled
+      }
+      (task->second.lane == MAIN || threads.empty() ? main_ready : pool_ready).push_back(id);
+    }
+  }
+
+  void RunTask(TaskId id) {
+    std::shared_ptr<std::function<void()>> run;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto task = tasks.find(id);
+      if (task == tasks.end()) {
+        return;
+      }
+      run = task->second.run;
+    }
+    (*run)();
+    std::lock_guard<std::mutex> lock(mutex);
+    auto task = tasks.find(id);
+    if (task == tasks.end()) {
+      return;
+    }
+    if (task->second.once) {
+      tasks.erase(task);
+      return;
+    }
+    // Runs that were missed while this one overran are skipped rather than run back to back
+    std::int64_t now = Tick(NowMs());
+    Task& entry = task->second;
+    entry.anchor += entry.period;
+    if (entry.anchor <= now) {
+      entry.anchor += ((now - entry.anchor) / entry.period + 1)*entry.period;
+    }
+    Arm(id, entry);
+    wake.notify_one();
+  }
+
+  void PoolLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+      Collect();
+      if (!pool_ready.empty()) {
+        TaskId id = pool_ready.front();
+        pool_ready.pop_front();
+        lock.unlock();
+        RunTask(id);
+        lock.lock();
+        continue;
+      }
+      std::int64_t next = wheel.NextEvent();
+      if (clock) {
+        wake.wait_for(lock, std::chrono::milliseconds(RESOLUTION_MS));
+      } else if (next == std::numeric_limits<std::int64_t>::max()) {
+        wake.wait(lock);
+      } else {
+        wake.wait_until(lock, Clock::time_point(std::chrono::milliseconds(next*RESOLUTION_MS)));
+      }
+    }
+  }
+};
+
+#endif  // OUTERSPATIALENGINE_EXECUTOR_H
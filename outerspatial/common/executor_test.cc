@@ -0,0 +1,77 @@
+#undef NDEBUG  // the checks are asserts
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "executor.h"
+
+// TimerWheel against a sorted multimap of deadlines, and the Executor's lanes on a LogicalClock
+
+void TestTimerWheel(std::int64_t start, std::int64_t max_delay, std::int64_t max_step, unsigned seed) {
+  std::mt19937_64 gen(seed);
+  TimerWheel wheel(start);
+  std::multimap<std::int64_t, std::uint64_t> naive; // deadline -> id
+  std::int64_t now = start;
+  std::uint64_t next_id = 0;
+  std::vector<std::uint64_t> due;
+  for (int step = 0; step < 20000; step++) {
+    for (int i = std::uniform_int_distribution<int>(0, 3)(gen); i > 0; i--) {
+      std::int64_t deadline = now + std::uniform_int_distribution<std::int64_t>(-2, max_delay)(gen);
+      wheel.Insert(next_id, deadline);
+      naive.emplace(std::max(deadline, now + 1), next_id); // nothing fires before the next tick
+      next_id++;
+    }
+    assert(wheel.size() == naive.size());
+    if (!naive.empty()) {
+      // Advance never skips past a deadline
+      assert(wheel.NextEvent() > now && wheel.NextEvent() <= naive.begin()->first);
+    }
+
+    now += std::uniform_int_distribution<std::int64_t>(0, max_step)(gen);
+    due.clear();
+    wheel.Advance(now, due);
+    assert(wheel.now() == now);
+    std::vector<std::uint64_t> expected;
+    while (!naive.empty() && naive.begin()->first <= now) {
+      expected.push_back(naive.begin()->second);
+      naive.erase(naive.begin());
+    }
+    std::sort(due.begin(), due.end());
+    std::sort(expected.begin(), expected.end());
+    assert(due == expected);
+  }
+}
+
+// With no pool threads, POOL tasks run inside RunMain
+void TestInlinePool() {
+  LogicalClock clock(0);
+  Executor executor(0, 1, &clock);
+  int main_runs = 0;
+  int pool_runs = 0;
+  int once_runs = 0;
+  executor.Every(10, 0, [&] { main_runs++; });
+  executor.Every(10, 0, [&] { pool_runs++; }, Executor::POOL);
+  executor.After(25, [&] { once_runs++; }, Executor::POOL);
+  for (int ms = 0; ms < 1000; ms++) {
+    executor.RunMain(0);
+    clock.Advance(1);
+  }
+  executor.RunMain(0);
+  assert(main_runs >= 99 && main_runs <= 101);
+  assert(pool_runs >= 99 && pool_runs <= 101);
+  assert(once_runs == 1);
+  assert(executor.size() == 2);
+}
+
+int main() {
+  TestTimerWheel(0, 50, 3, 1);                // within the lowest level
+  TestTimerWheel(1000, 5000, 40, 2);          // cascading from the levels above
+  TestTimerWheel(-777, 1 << 25, 1 << 14, 3);  // beyond what the wheel spans
+  TestInlinePool();
+  std::cout << "executor_test passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,219 @@
+#ifndef OUTERSPATIALENGINE_GORILLA_H
+#define OUTERSPATIALENGINE_GORILLA_H
+
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+// Block compression for (value, timestamp) series, after Facebook's Gorilla TSDB:
+//  - timestamps are stored as delta-of-deltas, which are almost always 0 for a fixed tick rate
+//  - values are XORed with their predecessor; repeated prices cost a single bit, and small moves
+//    only store the bits that actually changed
+// A block is immutable once built; it is decoded sequentially from the start.
+namespace gorilla {
+  class BitWriter {
+  public:
+    void Write(std::uint64_t value, int bits) {
+      while (bits > 0) {
+        if (used % 64 == 0) {
+          words.push_back(0);
+        }
+        int free_bits = 64 - used % 64;
+        int n = (bits < free_bits) ? bits : free_bits;
+        std::uint64_t chunk = (value >> (bits - n)) & Mask(n);
+        words.back() |= chunk << (free_bits - n);
+        used += n;
+        bits -= n;
+      }
+    }
+    void WriteBit(bool bit) {
+      Write(bit ? 1 : 0, 1);
+    }
+    std::vector<std::uint64_t> Finish() {
+      words.shrink_to_fit();
+      return std::move(words);
+    }
+  private:
+    std::vector<std::uint64_t> words;
+    std::size_t used = 0;
+
+    static std::uint64_t Mask(int bits) {
+      return (bits == 64) ? ~0ULL : ((1ULL << bits) - 1);
+    }
+  };
+
+  class BitReader {
+  public:
+    explicit BitReader(const std::vector<std::uint64_t>& words)
+        : words(words) {};
+    std::uint64_t Read(int bits) {
+      std::uint64_t value = 0;
+      while (bits > 0) {
+        int free_bits = 64 - position % 64;
+        int n = (bits < free_bits) ? bits : free_bits;
+        std::uint64_t word = words[position / 64];
+        std::uint64_t chunk = (word >> (free_bits - n)) & ((n == 64) ? ~0ULL : ((1ULL << n) - 1));
+        value = (n == 64) ? chunk : ((value << n) | chunk);
+        position += n;
+        bits -= n;
+      }
+      return value;
+    }
+    bool ReadBit() {
+      return Read(1) == 1;
+    }
+  private:
+    const std::vector<std::uint64_t>& words;
+    std::size_t position = 0;
+  };
+
+  inline std::uint64_t ToBits(double value) {
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+  }
+  inline double FromBits(std::uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+  inline int LeadingZeros(std::uint64_t x) {
+    int n = 0;
+    for (std::uint64_t bit = 1ULL << 63; bit != 0 && !(x & bit); bit >>= 1) n++;
+    return n;
+  }
+  inline int TrailingZeros(std::uint64_t x) {
+    int n = 0;
+    for (std::uint64_t bit = 1; bit != 0 && !(x & bit); bit <<= 1) n++;
+    return n;
+  }
+
+  struct CompressedBlock {
+    std::size_t count = 0;
+    // Endpoints are kept raw so window queries can skip a block without decoding it
+    std::int64_t first_time = 0;
+    std::int64_t last_time = 0;
+    double first_value = 0;
+    double last_value = 0;
+    std::vector<std::uint64_t> bits;
+  };
+
+  inline CompressedBlock Compress(const double* values, const std::int64_t* times, std::size_t count) {
+    CompressedBlock block;
+    block.count = count;
+    if (count == 0) {
+      return block;
+    }
+    block.first_time = times[0];
+    block.last_time = times[count - 1];
+    block.first_value = values[0];
+    block.last_value = values[count - 1];
+
+    BitWriter out;
+    out.Write(static_cast<std::uint64_t>(times[0]), 64);
+    out.Write(ToBits(values[0]), 64);
+
+    // Timestamp arithmetic is done unsigned so that it wraps rather than overflows
+    std::uint64_t prev_delta = 0;
+    std::uint64_t prev_bits = ToBits(values[0]);
+    int prev_leading = 64;
+    int prev_trailing = 0;
+    for (std::size_t i = 1; i < count; i++) {
+      // Timestamp: delta-of-delta in variable width buckets
+      std::uint64_t delta = static_cast<std::uint64_t>(times[i]) - static_cast<std::uint64_t>(times[i - 1]);
+      auto dod = static_cast<std::int64_t>(delta - prev_delta);
+      prev_delta = delta;
+      if (dod == 0) {
+        out.WriteBit(false);
+      } else if (dod >= -63 && dod <= 64) {
+        out.Write(0b10, 2);
+        out.Write(static_cast<std::uint64_t>(dod + 63), 7);
+      } else if (dod >= -255 && dod <= 256) {
+        out.Write(0b110, 3);
+        out.Write(static_cast<std::uint64_t>(dod + 255), 9);
+      } else if (dod >= -2047 && dod <= 2048) {
+        out.Write(0b1110, 4);
+        out.Write(static_cast<std::uint64_t>(dod + 2047), 12);
+      } else {
+        out.Write(0b1111, 4);
+        out.Write(static_cast<std::uint64_t>(dod), 64);
+      }
+
+      // Value: XOR against the previous value, reusing the previous bit window when it fits
+      std::uint64_t bits = ToBits(values[i]);
+      std::uint64_t x = bits ^ prev_bits;
+      prev_bits = bits;
+      if (x == 0) {
+        out.WriteBit(false);
+        continue;
+      }
+      out.WriteBit(true);
+      int leading = LeadingZeros(x);
+      int trailing = TrailingZeros(x);
+      if (leading > 31) {
+        leading = 31; // only 5 bits to store it in
+      }
+      if (prev_leading <= leading && prev_trailing <= trailing) {
+        out.WriteBit(false);
+        out.Write(x >> prev_trailing, 64 - prev_leading - prev_trailing);
+      } else {
+        int meaningful = 64 - leading - trailing;
+        out.WriteBit(true);
+        out.Write(static_cast<std::uint64_t>(leading), 5);
+        out.Write(static_cast<std::uint64_t>(meaningful % 64), 6); // 64 is stored as 0
+        out.Write(x >> trailing, meaningful);
+        prev_leading = leading;
+        prev_trailing = trailing;
+      }
+    }
+    block.bits = out.Finish();
+    return block;
+  }
+
+  // Decodes the whole block into the given arrays, which must hold block.count samples
+  inline void Decompress(const CompressedBlock& block, double* values, std::int64_t* times) {
+    if (block.count == 0) {
+      return;
+    }
+    BitReader in(block.bits);
+    times[0] = static_cast<std::int64_t>(in.Read(64));
+    std::uint64_t prev_bits = in.Read(64);
+    values[0] = FromBits(prev_bits);
+
+    std::uint64_t prev_delta = 0;
+    int prev_leading = 64;
+    int prev_trailing = 0;
+    for (std::size_t i = 1; i < block.count; i++) {
+      std::int64_t dod;
+      if (!in.ReadBit()) {
+        dod = 0;
+      } else if (!in.ReadBit()) {
+        dod = static_cast<std::int64_t>(in.Read(7)) - 63;
+      } else if (!in.ReadBit()) {
+        dod = static_cast<std::int64_t>(in.Read(9)) - 255;
+      } else if (!in.ReadBit()) {
+        dod = static_cast<std::int64_t>(in.Read(12)) - 2047;
+      } else {
+        dod = static_cast<std::int64_t>(in.Read(64));
+      }
+      prev_delta += static_cast<std::uint64_t>(dod);
+      times[i] = static_cast<std::int64_t>(static_cast<std::uint64_t>(times[i - 1]) + prev_delta);
+
+      if (in.ReadBit()) {
+        if (in.ReadBit()) {
+          prev_leading = static_cast<int>(in.Read(5));
+          int meaningful = static_cast<int>(in.Read(6));
+          if (meaningful == 0) {
+            meaningful = 64;
+          }
+          prev_trailing = 64 - prev_leading - meaningful;
+        }
+        prev_bits ^= in.Read(64 - prev_leading - prev_trailing) << prev_trailing;
+      }
+      values[i] = FromBits(prev_bits);
+    }
+  }
+}
+
+#endif  // OUTERSPATIALENGINE_GORILLA_H
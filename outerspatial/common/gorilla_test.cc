@@ -0,0 +1,109 @@
+#undef NDEBUG  // the checks are asserts
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "gorilla.h"
+
+// Compress then Decompress must give back every sample bit for bit, whatever the series looks like
+
+void RoundTrip(const std::vector<double>& values, const std::vector<std::int64_t>& times) {
+  auto block = gorilla::Compress(values.data(), times.data(), values.size());
+  assert(block.count == values.size());
+  std::vector<double> decoded_values(values.size());
+  std::vector<std::int64_t> decoded_times(times.size());
+  gorilla::Decompress(block, decoded_values.data(), decoded_times.data());
+  for (std::size_t i = 0; i < values.size(); i++) {
+    assert(gorilla::ToBits(decoded_values[i]) == gorilla::ToBits(values[i]));
+    assert(decoded_times[i] == times[i]);
+  }
+  if (!values.empty()) {
+    assert(block.first_time == times.front() && block.last_time == times.back());
+    assert(gorilla::ToBits(block.first_value) == gorilla::ToBits(values.front()));
+    assert(gorilla::ToBits(block.last_value) == gorilla::ToBits(values.back()));
+  }
+}
+
+void TestBits() {
+  std::mt19937_64 gen(1);
+  std::vector<std::pair<std::uint64_t, int>> written;
+  gorilla::BitWriter out;
+  for (int i = 0; i < 5000; i++) {
+    int bits = std::uniform_int_distribution<int>(1, 64)(gen);
+    std::uint64_t value = gen() >> (64 - bits);
+    out.Write(value, bits);
+    written.push_back({value, bits});
+  }
+  auto words = out.Finish();
+  gorilla::BitReader in(words);
+  for (const auto& entry : written) {
+    assert(in.Read(entry.second) == entry.first);
+  }
+  for (std::uint64_t x : {std::uint64_t(1), std::uint64_t(1) << 63, ~std::uint64_t(0), std::uint64_t(0x00f0)}) {
+    int leading = 0, trailing = 0;
+    while (leading < 64 && !(x & (std::uint64_t(1) << (63 - leading)))) leading++;
+    while (trailing < 64 && !(x & (std::uint64_t(1) << trailing))) trailing++;
+    assert(gorilla::LeadingZeros(x) == leading && gorilla::TrailingZeros(x) == trailing);
+  }
+}
+
+void TestSeries() {
+  RoundTrip({}, {});
+  RoundTrip({3.5}, {1000});
+
+  std::mt19937_64 gen(2);
+  std::normal_distribution<double> move(0, 0.05);
+  for (int series = 0; series < 200; series++) {
+    std::size_t count = std::uniform_int_distribution<std::size_t>(2, 600)(gen);
+    std::vector<double> values;
+    std::vector<std::int64_t> times;
+    double price = 10;
+    std::int64_t time = std::uniform_int_distribution<std::int64_t>(-5000, 1700000000000)(gen);
+    for (std::size_t i = 0; i < count; i++) {
+      switch (std::uniform_int_distribution<int>(0, 9)(gen)) {
+      case 0:
+        time += std::uniform_int_distribution<std::int64_t>(-3000, 3000)(gen); // late, early or out of order
+        break;
+      case 1:
+        time += std::uniform_int_distribution<std::int64_t>(1, 1LL << 40)(gen); // a long gap
+        break;
+      default:
+        time += 50; // the usual tick
+      }
+      switch (std::uniform_int_distribution<int>(0, 9)(gen)) {
+      case 0:
+        price = -price;
+        break;
+      case 1:
+        price = std::uniform_real_distribution<double>(-1e12, 1e12)(gen);
+        break;
+      case 2:
+      case 3:
+        break; // unchanged
+      default:
+        price += move(gen);
+      }
+      values.push_back(price);
+      times.push_back(time);
+    }
+    RoundTrip(values, times);
+  }
+
+  // Values whose XOR with the previous one has every bit meaningful, or none
+  RoundTrip({0.0, -0.0, std::numeric_limits<double>::infinity(), std::numeric_limits<double>::quiet_NaN(),
+             std::numeric_limits<double>::denorm_min(), gorilla::FromBits(~std::uint64_t(0) >> 1), 0.0},
+            {0, 1, 2, 3, 4, 5, 6});
+  // Timestamps at the edges of the widest delta-of-delta bucket
+  RoundTrip({1, 2, 3, 4}, {std::numeric_limits<std::int64_t>::min(), 0, std::numeric_limits<std::int64_t>::max(), 0});
+}
+
+int main() {
+  TestBits();
+  TestSeries();
+  std::cout << "gorilla_test passed" << std::endl;
+  return 0;
+}
@@ -6,7 +6,15 @@
 #define CPPBAZAARBOT_HISTORY_H
 #include <map>
 #include <vector>
+#include <algorithm>
 #include <atomic>
+#include <limits>
+#include <memory>
+#include <thread>
+
+#include "gorilla.h"
+#include "series_store.h"
+#include "sim_clock.h"
 
 enum LogType {
     PRICE,
@@ -16,53 +24,290 @@ enum LogType {
     NET_SUPPLY
 };
 
+// The (value, timestamp) samples of one series, with exactly one writer (the AH tick thread) and any
+// number of readers on other threads (GlobalMetrics, display code).
+// Writes are guarded by a seqlock: the writer never waits, and readers visit the samples in place
+// then retry if the writer moved underneath them. Visitors passed to Read() must therefore be
+// free of side effects - they may run more than once, and may see torn data on a discarded pass.
+//
+// Appends go into a raw head block. When it fills up it is sealed into an immutable Gorilla-compressed
+// block (see gorilla.h), so long histories cost a few bits per sample. Only the newest `capacity`
+// samples are visible, and sealed blocks are dropped once none of their samples are.
+class SampleSeries {
+public:
+  static constexpr std::size_t kBlockSize = 512;
+  using BlockList = std::vector<std::shared_ptr<const gorilla::CompressedBlock>>;
+
+  struct Sample {
+    double value;
+    std::int64_t time;
+  };
+
+  // Zero-copy window onto the series, valid only inside a Read() visitor.
+  // Walking it only decodes the sealed blocks the walk actually reaches.
+  class View {
+  public:
+    View(const SampleSeries& series, std::shared_ptr<const BlockList> blocks,
+         std::size_t head_length, std::size_t hidden, std::size_t length)
+        : series(series)
+        , blocks(std::move(blocks))
+        , head_length(head_length)
+        , hidden(hidden)
+        , length(length) {};
+    std::size_t size() const {return length;}
+    bool empty() const {return length == 0;}
+    Sample back() const {
+      if (head_length > 0) {
+        return series.HeadSample(head_length - 1);
+      }
+      if (!blocks->empty()) {
+        return {blocks->back()->last_value, blocks->back()->last_time};
+      }
+      return {0, 0};
+    }
+    Sample front() const {
+      if (hidden == 0 && !blocks->empty()) {
+        return {blocks->front()->first_value, blocks->front()->first_time};
+      }
+      Sample oldest = {0, 0};
+      ForEachSince(std::numeric_limits<std::int64_t>::min(), [&oldest](const Sample& sample) {
+        oldest = sample;
+        return false;
+      });
+      return oldest;
+    }
+
+    // Visits samples newest first until `visit` returns false
+    template <typename Visitor>
+    void ForEachNewestFirst(Visitor&& visit) const {
+      std::size_t remaining = length;
+      for (std::size_t i = head_length; i > 0 && remaining > 0; i--, remaining--) {
+        if (!visit(series.HeadSample(i - 1))) return;
+      }
+      double values[kBlockSize];
+      std::int64_t times[kBlockSize];
+      for (auto it = blocks->rbegin(); it != blocks->rend() && remaining > 0; ++it) {
+        const auto& block = **it;
+        gorilla::Decompress(block, values, times);
+        for (std::size_t i = block.count; i > 0 && remaining > 0; i--, remaining--) {
+          if (!visit(Sample{values[i - 1], times[i - 1]})) return;
+        }
+      }
+    }
+
+    // Visits samples with time >= start_time oldest first, until `visit` returns false
+    template <typename Visitor>
+    void ForEachSince(std::int64_t start_time, Visitor&& visit) const {
+      std::size_t to_skip = hidden;
+      double values[kBlockSize];
+      std::int64_t times[kBlockSize];
+      for (const auto& ptr : *blocks) {
+        const auto& block = *ptr;
+        if (to_skip >= block.count) {
+          to_skip -= block.count;
+          continue;
+        }
+        if (block.last_time < start_time) {
+          to_skip = 0;
+          continue; // whole block is outside the window
+        }
+        gorilla::Decompress(block, values, times);
+        for (std::size_t i = to_skip; i < block.count; i++) {
+          if (times[i] >= start_time && !visit(Sample{values[i], times[i]})) return;
+        }
+        to_skip = 0;
+      }
+      for (std::size_t i = to_skip; i < head_length; i++) {
+        Sample sample = series.HeadSample(i);
+        if (sample.time >= start_time && !visit(sample)) return;
+      }
+    }
+  private:
+    const SampleSeries& series;
+    std::shared_ptr<const BlockList> blocks;
+    std::size_t head_length;
+    std::size_t hidden;
+    std::size_t length;
+  };
+
+  explicit SampleSeries(std::size_t capacity)
+      : capacity(capacity)
+      , blocks(std::make_shared<const BlockList>()) {};
+  SampleSeries(const SampleSeries&) = delete;
+  SampleSeries& operator=(const SampleSeries&) = delete;
+
+  // Writer only
+  void Push(double value, std::int64_t time) {
+    std::size_t head = head_length.load(std::memory_order_relaxed);
+    std::size_t sealed = sealed_samples.load(std::memory_order_relaxed);
+    auto current_blocks = std::atomic_load(&blocks);
+    std::shared_ptr<BlockList> next_blocks;
+
+    // Seal the full head before entering the write section - nobody else writes to it
+    if (head == kBlockSize) {
+      double values[kBlockSize];
+      std::int64_t times[kBlockSize];
+      for (std::size_t i = 0; i < kBlockSize; i++) {
+        values[i] = head_values[i].load(std::memory_order_relaxed);
+        times[i] = head_times[i].load(std::memory_order_relaxed);
+      }
+      next_blocks = std::make_shared<BlockList>(*current_blocks);
+      next_blocks->push_back(std::make_shared<const gorilla::CompressedBlock>(gorilla::Compress(values, times, kBlockSize)));
+      sealed += kBlockSize;
+      head = 0;
+    }
+    head++;
+
+    // Drop sealed blocks that have fallen entirely out of view
+    const BlockList& retained = next_blocks ? *next_blocks : *current_blocks;
+    if (!retained.empty() && sealed + head - retained.front()->count >= capacity) {
+      if (!next_blocks) {
+        next_blocks = std::make_shared<BlockList>(*current_blocks);
+      }
+      auto first_kept = next_blocks->begin();
+      while (first_kept != next_blocks->end() && sealed + head - (*first_kept)->count >= capacity) {
+        sealed -= (*first_kept)->count;
+        ++first_kept;
+      }
+      next_blocks->erase(next_blocks->begin(), first_kept);
+    }
+
+    std::uint64_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    if (next_blocks) {
+      std::atomic_store(&blocks, std::shared_ptr<const BlockList>(std::move(next_blocks)));
+    }
+    head_values[head - 1].store(value, std::memory_order_relaxed);
+    head_times[head - 1].store(time, std::memory_order_relaxed);
+    head_length.store(head, std::memory_order_relaxed);
+    sealed_samples.store(sealed, std::memory_order_relaxed);
+
+    sequence.store(seq + 2, std::memory_order_release);
+  }
+
+  // Calls visit(View) until it completes without a concurrent write, then returns its result.
+  template <typename Visitor>
+  auto Read(Visitor&& visit) const {
+    while (true) {
+      std::uint64_t begin = sequence.load(std::memory_order_acquire);
+      if (begin & 1) {
+        std::this_thread::yield(); // writer mid-push
+        continue;
+      }
+      auto current_blocks = std::atomic_load(&blocks);
+      std::size_t head = head_length.load(std::memory_order_relaxed);
+      std::size_t total = sealed_samples.load(std::memory_order_relaxed) + head;
+      std::size_t length = std::min(total, capacity);
+      auto result = visit(View(*this, std::move(current_blocks), head, total - length, length));
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == begin) {
+        return result;
+      }
+    }
+  }
+
+private:
+  std::size_t capacity;
+  std::shared_ptr<const BlockList> blocks; // replaced wholesale (atomic_store), never mutated
+  std::atomic<double> head_values[kBlockSize];
+  std::atomic<std::int64_t> head_times[kBlockSize];
+  std::atomic<std::size_t> head_length = 0;
+  std::atomic<std::size_t> sealed_samples = 0;
+  std::atomic<std::uint64_t> sequence = 0; // odd while a write is in progress
+
+  Sample HeadSample(std::size_t i) const {
+    return {head_values[i].load(std::memory_order_relaxed), head_times[i].load(std::memory_order_relaxed)};
+  }
+};
+
+// Series are created by initialise() during setup, before any reader threads start.
+// After that the maps themselves are never mutated, only the series (and files) inside them.
 class HistoryLog {
     int max_size = 60000; //10 min worth of data @ 10ms frametime
+    std::string store_prefix; // empty unless persist() was called
+    const SimClock* clock = &SimClock::Wall(); // what samples are timestamped with
+    std::map<std::string, MappedSeriesWriter> store;
 public:
     LogType type;
-    std::map<std::string, std::vector<std::pair<double, std::int64_t>>> log;
+    std::map<std::string, SampleSeries> log;
     std::map<std::string, std::atomic<double>> most_recent;
     HistoryLog(LogType log_type)
-    : type(log_type) {
-        log = {};
-    }
-    bool exists(const std::string& name) {
+    : type(log_type) {}
+    bool exists(const std::string& name) const {
       return (log.count(name) > 0);
     }
+    // Back every series initialised from now on with <directory>/<series_name>_<commodity>.bin.
+    // Samples already in an existing file are loaded back (up to max_size), so history and the
+    // latest values survive an AH restart.
+    void persist(const std::string& directory, const std::string& series_name) {
+        store_prefix = directory + "/" + series_name + "_";
+    }
+    // The clock must outlive this log
+    void use_clock(const SimClock& sim_clock) {
+        clock = &sim_clock;
+    }
     void initialise(const std::string& name) {
         if (log.count(name) > 0) {
             return;// already registered
         }
+        auto& series = log.try_emplace(name, max_size).first->second;
+        if (!store_prefix.empty()) {
+            auto& file = store[name];
+            if (file.Open(store_prefix + name + ".bin") && file.size() > 0) {
+                // warm start from disk
+                std::size_t first = (file.size() > (std::size_t) max_size) ? file.size() - max_size : 0;
+                for (std::size_t i = first; i < file.size(); i++) {
+                    series.Push(file.data()[i].value, file.data()[i].time);
+                }
+                most_recent[name] = file.data()[file.size() - 1].value;
+                return;
+            }
+        }
         double starting_value = (type == LogType::PRICE) ? 10 : 0;
-        log[name].emplace_back(starting_value, to_unix_timestamp_ms(std::chrono::system_clock::now()));
+        std::int64_t now = clock->NowMs();
+        series.Push(starting_value, now);
+        Store(name, starting_value, now);
         most_recent[name] = starting_value;
     }
 
     void add(const std::string& name, double amount) {
-        if (log.count(name) != 1) {
+        auto it = log.find(name);
+        if (it == log.end()) {
             return;// no entry found
         }
-        if (log[name].size() == max_size) {
-            log[name].erase(log[name].begin());
-        }
-        log[name].emplace_back(amount, to_unix_timestamp_ms(std::chrono::system_clock::now()));
+        std::int64_t now = clock->NowMs();
+        it->second.Push(amount, now);
+        Store(name, amount, now);
         most_recent[name] = amount;
     }
 
+    // Consistent, zero-copy access to a series for callers that need more than the summaries below
+    template <typename Visitor>
+    auto read(const std::string& name, Visitor&& visit) const {
+        return log.at(name).Read(std::forward<Visitor>(visit));
+    }
+
     double average(const std::string& name, int range) const {
         if (log.count(name) != 1) {
             return 0;// no entry found
         }
-        int log_length = log.at(name).size();
-        if (log_length < range) {
-            range = log_length;
-        }
+        return read(name, [range](const SampleSeries::View& series) mutable {
+          int log_length = series.size();
+          if (log_length < range) {
+              range = log_length;
+          }
 
-        double total = 0;
-        for (int i = log_length - range; i < log_length; i++) {
-            total += log.at(name)[i].first;
-        }
-        return total/range;
+          double total = 0;
+          int remaining = range;
+          series.ForEachNewestFirst([&](const SampleSeries::Sample& sample) {
+            total += sample.value;
+            return --remaining > 0;
+          });
+          return total/range;
+        });
     }
     // time-based average
     double t_average(const std::string& name, std::int64_t duration) const {
@@ -73,73 +318,103 @@ public:
           return average(name, max_size);
         }
 
-        auto start_time = log.at(name).back().second - duration;
-        double total = 0;
-        int range = 0;
-        auto it = log.at(name).rbegin();
-        while (it != log.at(name).rend() && it->second >= start_time) {
-            total += it->first;
+        return read(name, [duration](const SampleSeries::View& series) {
+          auto start_time = series.back().time - duration;
+          double total = 0;
+          int range = 0;
+          series.ForEachNewestFirst([&](const SampleSeries::Sample& sample) {
+            if (sample.time < start_time) {
+              return false;
+            }
+            total += sample.value;
             range++;
-            it++;
-        }
-        return total/range;
+            return true;
+          });
+          return total/range;
+        });
     }
   double t_total(const std::string& name, std::int64_t duration) const {
       if (log.count(name) != 1) {
         return 0;// no entry found
       }
-      auto start_time = log.at(name).back().second - duration;
-      double total = 0;
-      auto it = log.at(name).rbegin();
-      while (it != log.at(name).rend() && it->second >= start_time) {
-        total += it->first;
-        it++;
-      }
-      return total;
+      return read(name, [duration](const SampleSeries::View& series) {
+        auto start_time = series.back().time - duration;
+        double total = 0;
+        series.ForEachNewestFirst([&](const SampleSeries::Sample& sample) {
+          if (sample.time < start_time) {
+            return false;
+          }
+          total += sample.value;
+          return true;
+        });
+        return total;
+      });
   }
     double percentage_change(const std::string& name, int window) const {
-        double prev_value;
-        if (window <= log.at(name).size()) {
-            prev_value = log.at(name)[log.at(name).size() - window].first;
-        } else {
-            prev_value = log.at(name)[0].first;
-        }
+        return read(name, [window](const SampleSeries::View& series) {
+          double prev_value = series.front().value;
+          if (window <= (int) series.size()) {
+              int remaining = window;
+              series.ForEachNewestFirst([&](const SampleSeries::Sample& sample) {
+                prev_value = sample.value;
+                return --remaining > 0;
+              });
+          }
 
-        double curr_value = log.at(name).back().first;
-        return 100*(curr_value- prev_value)/prev_value;
+          double curr_value = series.back().value;
+          return 100*(curr_value- prev_value)/prev_value;
+        });
     }
 
     double t_percentage_change(const std::string& name, std::int64_t duration) const {
         if (log.count(name) != 1) {
             return 0;// no entry found
         }
-        auto start_time = log.at(name).back().second - duration;
-        double prev_value;
-        auto it = log.at(name).rbegin();
-        while (it != log.at(name).rend() && it->second >= start_time) {
-            it++;
-        }
-        if (it == log.at(name).rend()) {
-            prev_value = log.at(name).front().first;
-        } else {
-            prev_value = it->first;
-        }
+        return read(name, [duration](const SampleSeries::View& series) {
+          auto start_time = series.back().time - duration;
+          // newest sample older than the window, or the oldest sample if there is none
+          bool found = false;
+          double prev_value = 0;
+          series.ForEachNewestFirst([&](const SampleSeries::Sample& sample) {
+            if (sample.time < start_time) {
+              prev_value = sample.value;
+              found = true;
+              return false;
+            }
+            return true;
+          });
+          if (!found) {
+              prev_value = series.front().value;
+          }
 
-        double curr_value = log.at(name).back().first;
-        return 100*(curr_value- prev_value)/prev_value;
+          double curr_value = series.back().value;
+          return 100*(curr_value- prev_value)/prev_value;
+        });
     }
 
-    std::vector<std::pair<double, double>> get_history(const std::string& name, std::int64_t start_time) {
+    std::vector<std::pair<double, double>> get_history(const std::string& name, std::int64_t start_time) const {
         std::vector<std::pair<double, double>> output = {};
         if (log.count(name) != 1) {
             return output;// no entry found
         }
-        for (auto& item : log[name]) {
-            if (item.second >= start_time) {
-                output.emplace_back(item.second, item.first);
-            }
+        return read(name, [start_time](const SampleSeries::View& series) {
+          std::vector<std::pair<double, double>> copy = {};
+          series.ForEachSince(start_time, [&copy](const SampleSeries::Sample& item) {
+            copy.emplace_back(item.time, item.value);
+            return true;
+          });
+          return copy;
+        });
+    }
+private:
+    void Store(const std::string& name, double amount, std::int64_t time) {
+        if (store_prefix.empty()) {
+            return;
+        }
+        auto it = store.find(name);
+        if (it != store.end() && it->second.IsOpen()) {
+            it->second.Append(amount, time);
         }
-        return output;
     }
 };
 
@@ -169,9 +444,26 @@ public:
         trades.initialise(name);
         net_supply.initialise(name);
     }
-    bool exists(const std::string& name) {
+    bool exists(const std::string& name) const {
       return (prices.exists(name));
     }
+    // Must be called before initialise(); see HistoryLog::persist
+    void persist(const std::string& directory) {
+        prices.persist(directory, "prices");
+        buy_prices.persist(directory, "buy_prices");
+        asks.persist(directory, "asks");
+        bids.persist(directory, "bids");
+        trades.persist(directory, "trades");
+        net_supply.persist(directory, "net_supply");
+    }
+    void use_clock(const SimClock& clock) {
+        prices.use_clock(clock);
+        buy_prices.use_clock(clock);
+        asks.use_clock(clock);
+        bids.use_clock(clock);
+        trades.use_clock(clock);
+        net_supply.use_clock(clock);
+    }
 };
 
 #endif//CPPBAZAARBOT_HISTORY_H
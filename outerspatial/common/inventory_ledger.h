@@ -0,0 +1,115 @@
+#ifndef OUTERSPATIALENGINE_INVENTORY_LEDGER_H
+#define OUTERSPATIALENGINE_INVENTORY_LEDGER_H
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "messages.h"
+#include "transport.h"
+
+// Local copies of trader Inventory components.
+// Item changes are sent as item_updated events rather than by rewriting the whole `inv` map, so an
+// update costs one entry per item touched. Events are not stored in the view, so both the AH (the
+// writer) and each trader keep a ledger and apply updates to it; every so often the AH also writes
+// the full map back to `inv` as a checkpoint, for anyone who checks the entity out later. A trader
+// about to change hands is checkpointed on the spot, so its new worker starts from current items.
+class InventoryLedger {
+public:
+  explicit InventoryLedger(transport::View& view)
+      : view(view) {};
+
+  // The entity's inventory, or nullptr if it isn't in view.
+  // First use takes a copy of the view's data; after that the ledger is kept current by Apply/SetItem.
+  trader::InventoryData* Find(worker::EntityId entity_id) {
+    auto entry = inventories.find(entity_id);
+    if (entry != inventories.end()) {
+      return &entry->second;
+    }
+    auto entity = view.Entities.find(entity_id);
+    if (entity == view.Entities.end()) {
+      return nullptr;
+    }
+    auto inv = entity->second.Get<trader::Inventory>();
+    if (!inv) {
+      return nullptr;
+    }
+    return &inventories.emplace(entity_id, *inv).first->second;
+  }
+
+  // Applies an update received from the AH: a checkpointed `inv` replaces the map, then item events
+  // are applied on top. Item events carry absolute values, so applying one twice is harmless.
+  void Apply(worker::EntityId entity_id, const trader::Inventory::Update& update) {
+    auto entry = inventories.find(entity_id);
+    if (entry == inventories.end()) {
+      Find(entity_id); // the view already has this update's fields
+      entry = inventories.find(entity_id);
+      if (entry == inventories.end()) {
+        return;
+      }
+    }
+    trader::InventoryData& data = entry->second;
+    if (update.cash()) {
+      data.set_cash(*update.cash());
+    }
+    if (update.capacity()) {
+      data.set_capacity(*update.capacity());
+    }
+    if (update.inv()) {
+      data.set_inv(*update.inv());
+    }
+    for (const auto& change : update.item_updated()) {
+      data.inv()[change.name()] = change.item();
+    }
+  }
+
+  // Sets one item in `data` and adds the matching event to `update`
+  void SetItem(worker::EntityId entity_id, trader::InventoryData& data, trader::Inventory::Update& update,
+               const std::string& name, const trader::InventoryItem& item) {
+    data.inv()[name] = item;
+    update.add_item_updated({name, item});
+    needs_checkpoint.insert(entity_id);
+  }
+
+  // Calls send(entity_id, update) with the full `inv` map for every entity changed since the last checkpoint
+  template<typename Send>
+  void Checkpoint(Send send) {
+    for (auto entity_id : needs_checkpoint) {
+      auto entry = inventories.find(entity_id);
+      if (entry == inventories.end()) {
+        continue;
+      }
+      trader::Inventory::Update update;
+      update.set_inv(entry->second.inv());
+      send(entity_id, update);
+    }
+    needs_checkpoint.clear();
+  }
+
+  // As Checkpoint, for one entity only
+  template<typename Send>
+  void Checkpoint(worker::EntityId entity_id, Send send) {
+    if (needs_checkpoint.erase(entity_id) == 0) {
+      return;
+    }
+    auto entry = inventories.find(entity_id);
+    if (entry == inventories.end()) {
+      return;
+    }
+    trader::Inventory::Update update;
+    update.set_inv(entry->second.inv());
+    send(entity_id, update);
+  }
+
+  void Erase(worker::EntityId entity_id) {
+    inventories.erase(entity_id);
+    needs_checkpoint.erase(entity_id);
+  }
+
+private:
+  transport::View& view;
+  std::unordered_map<worker::EntityId, trader::InventoryData> inventories;
+  std::unordered_set<worker::EntityId> needs_checkpoint; // changed by item events since the last checkpoint
+};
+
+#endif  // OUTERSPATIALENGINE_INVENTORY_LEDGER_H
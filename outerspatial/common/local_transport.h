@@ -0,0 +1,776 @@
+#ifndef OUTERSPATIALENGINE_LOCAL_TRANSPORT_H
+#define OUTERSPATIALENGINE_LOCAL_TRANSPORT_H
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <type_traits>
+#include <typeindex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <improbable/worker.h>
+#include <improbable/restricted/system_components.h>
+#include <improbable/standard_library.h>
+
+#include "sim_clock.h"
+
+// An in-process stand-in for SpatialOS, used by headless builds (OUTERSPATIAL_HEADLESS, see
+// transport.h): a Runtime, and Connections and Views with the subset of the worker SDK's interface
+// that the engine uses. Workers connect to the Runtime as they would to a deployment: whatever one
+// sends reaches the workers it concerns as ops from their own GetOpList, for their View to apply and
+// dispatch. So the AH and trader worker loops run unchanged, in one process, on one thread or several.
+// Schema types are still the generated ones; only the runtime is missing.
+namespace local {
+  template<typename T>
+  struct CommandRequestOp {
+    worker::EntityId EntityId;
+    worker::RequestId<worker::IncomingCommandRequest<T>> RequestId;
+    std::uint32_t TimeoutMillis;
+    std::string CallerWorkerId;
+    worker::EntityId CallerWorkerEntityId;
+    typename T::Request Request;
+  };
+  template<typename T>
+  struct CommandResponseOp {
+    worker::RequestId<worker::OutgoingCommandRequest<T>> RequestId;
+    worker::EntityId EntityId;
+    worker::StatusCode StatusCode;
+    std::string Message;
+    worker::Option<typename T::Response> Response;
+  };
+  template<typename T>
+  struct ComponentUpdateOp {
+    worker::EntityId EntityId;
+    typename T::Update Update;
+  };
+  template<typename T>
+  struct AddComponentOp {
+    worker::EntityId EntityId;
+    typename T::Data Data;
+  };
+  struct CreateEntityResponseOp {
+    worker::RequestId<worker::CreateEntityRequest> RequestId;
+    worker::StatusCode StatusCode;
+    std::string Message;
+    worker::Option<worker::EntityId> EntityId;
+  };
+  struct ReserveEntityIdsResponseOp {
+    worker::RequestId<worker::ReserveEntityIdsRequest> RequestId;
+    worker::StatusCode StatusCode;
+    std::string Message;
+    worker::Option<worker::EntityId> FirstEntityId;
+    std::size_t NumberOfEntityIds;
+  };
+  struct DisconnectOp {
+    std::string Reason;
+  };
+
+  // SendCreateEntityRequest's result; sending never fails locally
+  template<typename T>
+  class Result {
+  public:
+    explicit Result(T value)
+        : value(value) {};
+    explicit operator bool() const {
+      return true;
+    }
+    const T& operator*() const {
+      return value;
+    }
+    const T* operator->() const {
+      return &value;
+    }
+    std::string GetErrorMessage() const {
+      return "";
+    }
+  private:
+    T value;
+  };
+
+  class View;
+  using OpList = std::vector<std::function<void(View&)>>;
+
+  class View {
+  public:
+    worker::Map<worker::EntityId, worker::Entity> Entities;
+
+    template<typename T>
+    std::uint64_t OnCommandRequest(const std::function<void(const CommandRequestOp<T>&)>& callback) {
+      return Register(callback);
+    }
+    template<typename T>
+    std::uint64_t OnCommandResponse(const std::function<void(const CommandResponseOp<T>&)>& callback) {
+      return Register(callback);
+    }
+    template<typename T>
+    std::uint64_t OnComponentUpdate(const std::function<void(const ComponentUpdateOp<T>&)>& callback) {
+      return Register(callback);
+    }
+    // Only fires for entities added after the first callback for T is registered
+    template<typename T>
+    std::uint64_t OnAddComponent(const std::function<void(const AddComponentOp<T>&)>& callback) {
+      adders[T::ComponentId] = [this](worker::EntityId entity_id, const worker::Entity& entity) {
+        if (auto data = entity.Get<T>()) {
+          Dispatch(AddComponentOp<T>{entity_id, *data});
+        }
+      };
+      return Register(callback);
+    }
+    std::uint64_t OnCreateEntityResponse(const std::function<void(const CreateEntityResponseOp&)>& callback) {
+      return Register(callback);
+    }
+    std::uint64_t OnReserveEntityIdsResponse(const std::function<void(const ReserveEntityIdsResponseOp&)>& callback) {
+      return Register(callback);
+    }
+    std::uint64_t OnDisconnect(const std::function<void(const DisconnectOp&)>& callback) {
+      return Register(callback);
+    }
+    void Remove(std::uint64_t key) {
+      for (auto& registered : callbacks) {
+        auto& list = registered.second;
+        for (auto callback = list.begin(); callback != list.end(); ++callback) {
+          if (callback->first == key) {
+            list.erase(callback);
+            return;
+          }
+        }
+      }
+    }
+
+    // Authority isn't sent to Views: everything in one counts as authoritative. Only the AH asks,
+    // and only about its own entity.
+    template<typename T>
+    worker::Authority GetAuthority(worker::EntityId entity_id) const {
+      return (Entities.find(entity_id) != Entities.end()) ? worker::Authority::kAuthoritative
+                                                          : worker::Authority::kNotAuthoritative;
+    }
+
+    void Process(const OpList& ops) {
+      for (const auto& op : ops) {
+        op(*this);
+      }
+    }
+
+    // Called by ops as they are processed
+    template<typename Op>
+    void Dispatch(const Op& op) {
+      auto registered = callbacks.find(std::type_index(typeid(Op)));
+      if (registered == callbacks.end()) {
+        return;
+      }
+      // By index and by shared copy: a callback may register or remove callbacks, itself included
+      auto& list = registered->second;
+      for (std::size_t i = 0; i < list.size(); i++) {
+        std::shared_ptr<Callback> callback = list[i].second;
+        (*callback)(&op);
+      }
+    }
+    void AddEntity(worker::EntityId entity_id, const worker::Entity& entity) {
+      Entities[entity_id] = entity;
+      for (auto component_id : entity.GetComponentIds()) {
+        auto adder = adders.find(component_id);
+        if (adder != adders.end()) {
+          adder->second(entity_id, Entities[entity_id]);
+        }
+      }
+    }
+    template<typename T>
+    void UpdateComponent(worker::EntityId entity_id, const typename T::Update& update) {
+      auto entity = Entities.find(entity_id);
+      if (entity == Entities.end() || !entity->second.Get<T>()) {
+        return;
+      }
+      entity->second.Update<T>(update);
+      Dispatch(ComponentUpdateOp<T>{entity_id, update});
+    }
+    void RemoveEntity(worker::EntityId entity_id) {
+      Entities.erase(entity_id);
+    }
+
+  private:
+    using Callback = std::function<void(const void*)>;
+
+    template<typename Op>
+    std::uint64_t Register(const std::function<void(const Op&)>& callback) {
+      std::uint64_t key = next_key++;
+      auto erased = std::make_shared<Callback>([callback](const void* op) { callback(*static_cast<const Op*>(op)); });
+      callbacks[std::type_index(typeid(Op))].emplace_back(key, std::move(erased));
+      return key;
+    }
+
+    std::unordered_map<std::type_index, std::vector<std::pair<std::uint64_t, std::shared_ptr<Callback>>>> callbacks;
+    std::unordered_map<worker::ComponentId, std::function<void(worker::EntityId, const worker::Entity&)>> adders;
+    std::uint64_t next_key = 1;
+  };
+
+  // What every Connection made on it shares: the entities, which worker each partition is assigned
+  // to, commands awaiting a response, and each worker's queue of ops. Authority follows the entities'
+  // AuthorityDelegation as in SpatialOS; each worker sees the entities it is authoritative over, plus
+  // those matched by the Interest on them that it is authoritative over (entity ID and component
+  // constraints, alone or combined; other constraints match everything, since positions aren't modelled).
+  // Every op reaches its worker `latency_ms` after it was sent. Thread-safe: each Connection and its
+  // View may run on a thread of its own.
+  // Op delivery and command timeouts follow the steady clock, or the SimClock given, if any. On a
+  // SimClock, GetOpList never waits: time only passes when whoever owns the clock advances it.
+  class Runtime {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    const worker::EntityId FIRST_ENTITY_ID = 1000; // well clear of the snapshot's hardcoded IDs
+
+    explicit Runtime(std::uint32_t latency_ms = 0, const SimClock* clock = nullptr)
+        : latency_ms(latency_ms)
+        , clock(clock) {};
+    Runtime(const Runtime&) = delete;
+    Runtime& operator=(const Runtime&) = delete;
+
+    // Declares the components of component set `set_id`, as in schema. A command goes to the worker
+    // authoritative over the set its component is in, so each component with commands needs one.
+    void AddComponentSet(std::uint32_t set_id, const std::vector<worker::ComponentId>& components) {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (auto component_id : components) {
+        component_sets[component_id] = set_id;
+      }
+    }
+
+    std::uint64_t OpsDelivered() const {
+      std::lock_guard<std::mutex> lock(mutex);
+      return delivered;
+    }
+
+  private:
+    friend class Connection;
+    using Constraint = improbable::ComponentSetInterest_QueryConstraint;
+
+    struct Worker {
+      std::string worker_id;
+      std::deque<std::pair<std::int64_t, std::function<void(View&)>>> queue; // by time due, in ms
+      std::set<worker::EntityId> visible;
+      std::set<worker::EntityId> authoritative;
+      // The constraints of the interest this worker is authoritative over, by the entity they are on,
+      // and indexed for matching
+      std::map<worker::EntityId, std::vector<Constraint>> interest;
+      std::map<worker::EntityId, int> entity_constraints; // entity ID -> number of constraints on it
+      std::map<worker::ComponentId, int> component_constraints;
+      std::vector<std::pair<worker::EntityId, Constraint>> other_constraints;
+    };
+    struct PendingCommand {
+      worker::EntityId requester; // worker entity ID
+      worker::EntityId entity_id; // the command's target
+      std::multimap<std::int64_t, std::uint32_t>::iterator deadline;
+      std::function<void(worker::StatusCode, const std::string&)> respond; // sends a typed failure
+    };
+
+    mutable std::mutex mutex;
+    std::condition_variable pushed;
+    std::int64_t latency_ms;
+    const SimClock* clock; // nullptr: the steady clock
+    std::map<worker::EntityId, Worker> workers; // by worker entity ID
+    std::map<worker::EntityId, worker::Entity> entities;
+    std::unordered_map<worker::EntityId, worker::EntityId> partitions; // partition entity ID -> worker entity ID
+    std::unordered_map<worker::ComponentId, std::uint32_t> component_sets; // component ID -> set ID
+    std::unordered_map<std::uint32_t, PendingCommand> pending; // request ID -> unanswered command
+    std::multimap<std::int64_t, std::uint32_t> deadlines; // expiry (ms) -> request ID
+    std::uint32_t next_request_id = 1;
+    worker::EntityId next_entity_id = FIRST_ENTITY_ID;
+    std::uint64_t delivered = 0;
+
+    std::int64_t NowMs() const {
+      if (clock) {
+        return clock->NowMs();
+      }
+      return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now().time_since_epoch()).count();
+    }
+
+    // Everything below is called with `mutex` held
+
+    worker::EntityId Connect(const std::string& worker_id) {
+      worker::EntityId worker_entity_id = next_entity_id++;
+      workers[worker_entity_id].worker_id = worker_id;
+      return worker_entity_id;
+    }
+    void Disconnect(worker::EntityId worker_entity_id) {
+      for (auto partition = partitions.begin(); partition != partitions.end();) {
+        partition = (partition->second == worker_entity_id) ? partitions.erase(partition) : std::next(partition);
+      }
+      for (auto request = pending.begin(); request != pending.end();) {
+        if (request->second.requester == worker_entity_id) {
+          deadlines.erase(request->second.deadline);
+          request = pending.erase(request);
+        } else {
+          ++request;
+        }
+      }
+      workers.erase(worker_entity_id);
+      RefreshAll();
+    }
+
+    void Push(worker::EntityId worker_entity_id, std::function<void(View&)> op) {
+      auto worker = workers.find(worker_entity_id);
+      if (worker == workers.end()) {
+        return; // disconnected
+      }
+      worker->second.queue.emplace_back(NowMs() + latency_ms, std::move(op));
+      pushed.notify_all();
+    }
+    void PushToVisible(worker::EntityId entity_id, const std::function<void(View&)>& op) {
+      for (auto& worker : workers) {
+        if (worker.second.visible.count(entity_id)) {
+          Push(worker.first, op);
+        }
+      }
+    }
+
+    // AUTHORITY
+    worker::EntityId AuthoritativeWorker(const worker::Entity& entity, std::uint32_t set_id) const {
+      auto delegation = entity.Get<improbable::AuthorityDelegation>();
+      if (!delegation) {
+        return 0;
+      }
+      auto partition = delegation->delegations().find(set_id);
+      if (partition == delegation->delegations().end()) {
+        return 0;
+      }
+      auto worker = partitions.find(partition->second);
+      return (worker == partitions.end()) ? 0 : worker->second;
+    }
+    void AssignPartition(worker::EntityId worker_entity_id, worker::EntityId partition_id) {
+      partitions[partition_id] = worker_entity_id;
+      RefreshAll();
+    }
+
+    // INTEREST
+    // Re-derives what every worker sees of `entity_id` after it is created, deleted, or has its
+    // AuthorityDelegation or Interest changed
+    void Refresh(worker::EntityId entity_id) {
+      auto entity = entities.find(entity_id);
+      for (auto& worker : workers) {
+        Worker& w = worker.second;
+        bool authoritative = false;
+        std::vector<Constraint> constraints;
+        if (entity != entities.end()) {
+          authoritative = AuthoritativeInterest(worker.first, entity->second, constraints);
+        }
+        if (authoritative) {
+          w.authoritative.insert(entity_id);
+        } else {
+          w.authoritative.erase(entity_id);
+        }
+        std::set<worker::EntityId> changed = {entity_id};
+        bool changed_all = false;
+        auto interest = w.interest.find(entity_id);
+        if (interest != w.interest.end()) {
+          Unindex(w, entity_id, interest->second, changed, changed_all);
+          w.interest.erase(interest);
+        }
+        if (!constraints.empty()) {
+          Index(w, entity_id, constraints, changed, changed_all);
+          w.interest[entity_id] = std::move(constraints);
+        }
+        if (changed_all) {
+          RecheckAll(worker.first);
+        } else {
+          for (auto changed_id : changed) {
+            Recheck(worker.first, changed_id);
+          }
+        }
+      }
+    }
+    void RefreshAll() {
+      std::vector<worker::EntityId> ids;
+      for (const auto& entity : entities) {
+        ids.push_back(entity.first);
+      }
+      for (auto& worker : workers) {
+        for (auto id : worker.second.visible) {
+          if (!entities.count(id)) {
+            ids.push_back(id);
+          }
+        }
+      }
+      for (auto id : ids) {
+        Refresh(id);
+      }
+    }
+
+    // Whether the worker is authoritative over any part of the entity, and the constraints of the
+    // interest on it for those parts
+    bool AuthoritativeInterest(worker::EntityId worker_entity_id, const worker::Entity& entity,
+                               std::vector<Constraint>& constraints) const {
+      auto delegation = entity.Get<improbable::AuthorityDelegation>();
+      if (!delegation) {
+        return false;
+      }
+      auto interest = entity.Get<improbable::Interest>();
+      bool authoritative = false;
+      for (const auto& set : delegation->delegations()) {
+        auto worker = partitions.find(set.second);
+        if (worker == partitions.end() || worker->second != worker_entity_id) {
+          continue;
+        }
+        authoritative = true;
+        if (!interest) {
+          continue;
+        }
+        auto set_interest = interest->component_set_interest().find(set.first);
+        if (set_interest != interest->component_set_interest().end()) {
+          for (const auto& query : set_interest->second.queries()) {
+            constraints.push_back(query.constraint());
+          }
+        }
+      }
+      return authoritative;
+    }
+
+    // Entities whose visibility the constraints may change go in `changed`; all of them if that can't be narrowed down
+    static void Index(Worker& w, worker::EntityId source, const std::vector<Constraint>& constraints,
+                      std::set<worker::EntityId>& changed, bool& changed_all) {
+      for (const auto& constraint : constraints) {
+        if (constraint.entity_id_constraint()) {
+          w.entity_constraints[*constraint.entity_id_constraint()]++;
+          changed.insert(*constraint.entity_id_constraint());
+        } else if (constraint.component_constraint()) {
+          changed_all |= (w.component_constraints[*constraint.component_constraint()]++ == 0);
+        } else {
+          w.other_constraints.emplace_back(source, constraint);
+          changed_all = true;
+        }
+      }
+    }
+    static void Unindex(Worker& w, worker::EntityId source, const std::vector<Constraint>& constraints,
+                        std::set<worker::EntityId>& changed, bool& changed_all) {
+      for (const auto& constraint : constraints) {
+        if (constraint.entity_id_constraint()) {
+          worker::EntityId id = *constraint.entity_id_constraint();
+          if (--w.entity_constraints[id] == 0) {
+            w.entity_constraints.erase(id);
+          }
+          changed.insert(id);
+        } else if (constraint.component_constraint()) {
+          worker::ComponentId component_id = *constraint.component_constraint();
+          if (--w.component_constraints[component_id] == 0) {
+            w.component_constraints.erase(component_id);
+            changed_all = true;
+          }
+        }
+      }
+      auto& others = w.other_constraints;
+      auto from = std::remove_if(others.begin(), others.end(), [source](const std::pair<worker::EntityId, Constraint>& other) {
+        return other.first == source;
+      });
+      changed_all |= (from != others.end());
+      others.erase(from, others.end());
+    }
+
+    static bool Matches(const Constraint& constraint, worker::EntityId entity_id, const worker::Entity& entity) {
+      if (constraint.entity_id_constraint()) {
+        return *constraint.entity_id_constraint() == entity_id;
+      }
+      if (constraint.component_constraint()) {
+        auto ids = entity.GetComponentIds();
+        return std::find(ids.begin(), ids.end(), *constraint.component_constraint()) != ids.end();
+      }
+      if (!constraint.and_constraint().empty()) {
+        return std::all_of(constraint.and_constraint().begin(), constraint.and_constraint().end(),
+                           [&](const Constraint& term) { return Matches(term, entity_id, entity); });
+      }
+      if (!constraint.or_constraint().empty()) {
+        return std::any_of(constraint.or_constraint().begin(), constraint.or_constraint().end(),
+                           [&](const Constraint& term) { return Matches(term, entity_id, entity); });
+      }
+      return true;
+    }
+    bool Sees(const Worker& w, worker::EntityId entity_id, const worker::Entity& entity) const {
+      if (w.authoritative.count(entity_id) || w.entity_constraints.count(entity_id)) {
+        return true;
+      }
+      if (!w.component_constraints.empty()) {
+        for (auto component_id : entity.GetComponentIds()) {
+          if (w.component_constraints.count(component_id)) {
+            return true;
+          }
+        }
+      }
+      for (const auto& other : w.other_constraints) {
+        if (Matches(other.second, entity_id, entity)) {
+          return true;
+        }
+      }
+      return false;
+    }
+    // Adds the entity to, or removes it from, the worker's view if it has come into or gone out of sight
+    void Recheck(worker::EntityId worker_entity_id, worker::EntityId entity_id) {
+      Worker& w = workers.at(worker_entity_id);
+      auto entity = entities.find(entity_id);
+      bool visible = entity != entities.end() && Sees(w, entity_id, entity->second);
+      bool was_visible = w.visible.count(entity_id) > 0;
+      if (visible && !was_visible) {
+        w.visible.insert(entity_id);
+        worker::Entity snapshot = entity->second;
+        Push(worker_entity_id, [entity_id, snapshot](View& view) { view.AddEntity(entity_id, snapshot); });
+      } else if (!visible && was_visible) {
+        w.visible.erase(entity_id);
+        Push(worker_entity_id, [entity_id](View& view) { view.RemoveEntity(entity_id); });
+      }
+    }
+    void RecheckAll(worker::EntityId worker_entity_id) {
+      std::vector<worker::EntityId> ids(workers.at(worker_entity_id).visible.begin(), workers.at(worker_entity_id).visible.end());
+      for (const auto& entity : entities) {
+        ids.push_back(entity.first);
+      }
+      for (auto id : ids) {
+        Recheck(worker_entity_id, id);
+      }
+    }
+
+    // COMMANDS
+    void Forget(std::unordered_map<std::uint32_t, PendingCommand>::iterator command) {
+      deadlines.erase(command->second.deadline);
+      pending.erase(command);
+    }
+    void Fail(std::uint32_t id, worker::StatusCode status, const std::string& message) {
+      auto command = pending.find(id);
+      if (command == pending.end()) {
+        return;
+      }
+      auto respond = std::move(command->second.respond);
+      Forget(command);
+      respond(status, message);
+    }
+    void ExpireCommands() {
+      std::int64_t now = NowMs();
+      while (!deadlines.empty() && deadlines.begin()->first <= now) {
+        Fail(deadlines.begin()->second, worker::StatusCode::kTimeout, "Command timed out");
+      }
+    }
+  };
+
+  // One worker's connection to a Runtime. Like the SDK's, it is used from one thread at a time.
+  class Connection {
+  public:
+    using AssignPartitionCommand = improbable::restricted::Worker::Commands::AssignPartition;
+
+    const std::uint32_t DEFAULT_COMMAND_TIMEOUT_MS = 5000;
+
+    explicit Connection(Runtime& runtime, std::string worker_id = "Headless",
+                        worker::LogLevel min_log_level = worker::LogLevel::kWarn)
+        : runtime(runtime)
+        , worker_id(std::move(worker_id))
+        , min_log_level(min_log_level) {
+      std::lock_guard<std::mutex> lock(runtime.mutex);
+      worker_entity_id = runtime.Connect(this->worker_id);
+    }
+    ~Connection() {
+      std::lock_guard<std::mutex> lock(runtime.mutex);
+      runtime.Disconnect(worker_entity_id);
+    }
+    Connection(const Connection&) = delete;
+    Connection& operator=(const Connection&) = delete;
+
+    worker::ConnectionStatusCode GetConnectionStatusCode() const {
+      return worker::ConnectionStatusCode::kSuccess;
+    }
+    std::string GetConnectionStatusDetailString() const {
+      return "";
+    }
+    worker::EntityId GetWorkerEntityId() const {
+      return worker_entity_id;
+    }
+    void SendLogMessage(worker::LogLevel level, const std::string& logger_name, const std::string& message,
+                        const worker::Option<worker::EntityId>& = {}) {
+      if (level >= min_log_level) {
+        std::cerr << ("[" + worker_id + "] [" + logger_name + "] " + message + "\n");
+      }
+    }
+
+    // COMMANDS
+    // Every request gets exactly one response: the handler's, a failure, or kTimeout once it expires.
+    // AssignPartition requests to a worker entity are answered by the runtime itself.
+    template<typename T>
+    worker::RequestId<worker::OutgoingCommandRequest<T>> SendCommandRequest(
+        worker::EntityId entity_id, const typename T::Request& request, const worker::Option<std::uint32_t>& timeout_millis) {
+      std::lock_guard<std::mutex> lock(runtime.mutex);
+      std::uint32_t id = runtime.next_request_id++;
+      std::uint32_t timeout_ms = timeout_millis ? *timeout_millis : DEFAULT_COMMAND_TIMEOUT_MS;
+      auto& command = runtime.pending[id];
+      command.requester = worker_entity_id;
+      command.entity_id = entity_id;
+      command.deadline = runtime.deadlines.emplace(runtime.NowMs() + timeout_ms, id);
+      command.respond = [&runtime = runtime, requester = worker_entity_id, id, entity_id](worker::StatusCode status,
+                                                                                          const std::string& message) {
+        runtime.Push(requester, [id, entity_id, status, message](View& view) {
+          view.Dispatch(CommandResponseOp<T>{worker::RequestId<worker::OutgoingCommandRequest<T>>{id}, entity_id,
+                                             status, message, {}});
+        });
+      };
+
+      if constexpr (std::is_same<T, AssignPartitionCommand>::value) {
+        if (!runtime.workers.count(entity_id)) {
+          runtime.Fail(id, worker::StatusCode::kNotFound, "No worker entity " + std::to_string(entity_id));
+        } else {
+          runtime.AssignPartition(entity_id, request.partition_id());
+          Respond<T>(id, {});
+        }
+        return worker::RequestId<worker::OutgoingCommandRequest<T>>{id};
+      }
+      auto entity = runtime.entities.find(entity_id);
+      auto set = runtime.component_sets.find(T::ComponentMetaclass::ComponentId);
+      if (entity == runtime.entities.end()) {
+        runtime.Fail(id, worker::StatusCode::kNotFound, "No entity " + std::to_string(entity_id));
+      } else if (set == runtime.component_sets.end()) {
+        runtime.Fail(id, worker::StatusCode::kApplicationError,
+                     "Component " + std::to_string(T::ComponentMetaclass::ComponentId) + " is in no declared component set");
+      } else if (worker::EntityId target = runtime.AuthoritativeWorker(entity->second, set->second)) {
+        runtime.Push(target, [id, entity_id, timeout_ms, request, caller = worker_id, caller_entity_id = worker_entity_id](View& view) {
+          view.Dispatch(CommandRequestOp<T>{entity_id, worker::RequestId<worker::IncomingCommandRequest<T>>{id},
+                                            timeout_ms, caller, caller_entity_id, request});
+        });
+      } else {
+        runtime.Fail(id, worker::StatusCode::kAuthorityLost,
+                     "No worker is authoritative over component set " + std::to_string(set->second));
+      }
+      return worker::RequestId<worker::OutgoingCommandRequest<T>>{id};
+    }
+    template<typename T>
+    void SendCommandResponse(const worker::RequestId<worker::IncomingCommandRequest<T>>& request_id,
+                             const typename T::Response& response) {
+      std::lock_guard<std::mutex> lock(runtime.mutex);
+      Respond<T>(request_id.Id, response);
+    }
+    template<typename T>
+    void SendCommandFailure(const worker::RequestId<worker::IncomingCommandRequest<T>>& request_id,
+                            const std::string& message) {
+      std::lock_guard<std::mutex> lock(runtime.mutex);
+      runtime.Fail(request_id.Id, worker::StatusCode::kApplicationError, message);
+    }
+
+    // COMPONENTS AND ENTITIES
+    // An update goes to every worker that sees the entity, the sender included
+    template<typename T>
+    void SendComponentUpdate(worker::EntityId entity_id, const typename T::Update& update,
+                             const worker::UpdateParameters& = {}) {
+      std::lock_guard<std::mutex> lock(runtime.mutex);
+      auto entity = runtime.entities.find(entity_id);
+      if (entity == runtime.entities.end() || !entity->second.Get<T>()) {
+        return;
+      }
+      entity->second.Update<T>(update);
+      runtime.PushToVisible(entity_id, [entity_id, update](View& view) { view.UpdateComponent<T>(entity_id, update); });
+      if (std::is_same<T, improbable::AuthorityDelegation>::value || std::is_same<T, improbable::Interest>::value) {
+        runtime.Refresh(entity_id);
+      }
+    }
+    Result<worker::RequestId<worker::CreateEntityRequest>> SendCreateEntityRequest(
+        const worker::Entity& entity, const worker::Option<worker::EntityId>& entity_id,
+        const worker::Option<std::uint32_t>& = {}) {
+      std::lock_guard<std::mutex> lock(runtime.mutex);
+      std::uint32_t id = runtime.next_request_id++;
+      worker::EntityId created = entity_id ? *entity_id : runtime.next_entity_id++;
+      if (!runtime.entities.emplace(created, entity).second) {
+        runtime.Push(worker_entity_id, [id, created](View& view) {
+          view.Dispatch(CreateEntityResponseOp{worker::RequestId<worker::CreateEntityRequest>{id},
+                                               worker::StatusCode::kApplicationError,
+                                               "Entity ID " + std::to_string(created) + " is already in use", {}});
+        });
+      } else {
+        runtime.Refresh(created);
+        runtime.Push(worker_entity_id, [id, created](View& view) {
+          view.Dispatch(CreateEntityResponseOp{worker::RequestId<worker::CreateEntityRequest>{id},
+                                               worker::StatusCode::kSuccess, "", created});
+        });
+      }
+      return Result<worker::RequestId<worker::CreateEntityRequest>>(worker::RequestId<worker::CreateEntityRequest>{id});
+    }
+    worker::RequestId<worker::DeleteEntityRequest> SendDeleteEntityRequest(worker::EntityId entity_id,
+                                                                          const worker::Option<std::uint32_t>& = {}) {
+      std::lock_guard<std::mutex> lock(runtime.mutex);
+      runtime.entities.erase(entity_id);
+      runtime.Refresh(entity_id);
+      return worker::RequestId<worker::DeleteEntityRequest>{runtime.next_request_id++};
+    }
+    worker::RequestId<worker::ReserveEntityIdsRequest> SendReserveEntityIdsRequest(
+        std::uint32_t number_of_entity_ids, const worker::Option<std::uint32_t>& = {}) {
+      std::lock_guard<std::mutex> lock(runtime.mutex);
+      std::uint32_t id = runtime.next_request_id++;
+      worker::EntityId first = runtime.next_entity_id;
+      runtime.next_entity_id += number_of_entity_ids;
+      runtime.Push(worker_entity_id, [id, first, number_of_entity_ids](View& view) {
+        view.Dispatch(ReserveEntityIdsResponseOp{worker::RequestId<worker::ReserveEntityIdsRequest>{id},
+                                                 worker::StatusCode::kSuccess, "", first, number_of_entity_ids});
+      });
+      return worker::RequestId<worker::ReserveEntityIdsRequest>{id};
+    }
+
+    // Every op that has reached this worker. Waits up to timeout_millis for the first one if there are
+    // none yet (unless the runtime is on a SimClock).
+    OpList GetOpList(std::uint32_t timeout_millis) {
+      std::unique_lock<std::mutex> lock(runtime.mutex);
+      auto& queue = runtime.workers.at(worker_entity_id).queue;
+      std::int64_t until = runtime.NowMs() + timeout_millis;
+      while (true) {
+        runtime.ExpireCommands();
+        std::int64_t now = runtime.NowMs();
+        if ((!queue.empty() && queue.front().first <= now) || now >= until || runtime.clock) {
+          break;
+        }
+        std::int64_t wake = until;
+        if (!queue.empty()) {
+          wake = std::min(wake, queue.front().first);
+        }
+        if (!runtime.deadlines.empty()) {
+          wake = std::min(wake, runtime.deadlines.begin()->first);
+        }
+        runtime.pushed.wait_for(lock, std::chrono::milliseconds(wake - now));
+      }
+      OpList ops;
+      std::int64_t now = runtime.NowMs();
+      while (!queue.empty() && queue.front().first <= now) {
+        ops.push_back(std::move(queue.front().second));
+        queue.pop_front();
+      }
+      delivered += ops.size();
+      runtime.delivered += ops.size();
+      return ops;
+    }
+
+    std::uint64_t OpsDelivered() const {
+      return delivered;
+    }
+
+  private:
+    Runtime& runtime;
+    std::string worker_id;
+    worker::LogLevel min_log_level;
+    worker::EntityId worker_entity_id;
+    std::uint64_t delivered = 0;
+
+    // With runtime.mutex held
+    template<typename T>
+    void Respond(std::uint32_t id, const typename T::Response& response) {
+      auto command = runtime.pending.find(id);
+      if (command == runtime.pending.end()) {
+        return; // already answered, or timed out
+      }
+      worker::EntityId requester = command->second.requester;
+      worker::EntityId entity_id = command->second.entity_id;
+      runtime.Forget(command);
+      runtime.Push(requester, [id, entity_id, response](View& view) {
+        view.Dispatch(CommandResponseOp<T>{worker::RequestId<worker::OutgoingCommandRequest<T>>{id}, entity_id,
+                                           worker::StatusCode::kSuccess, "", response});
+      });
+    }
+  };
+}
+
+#endif  // OUTERSPATIALENGINE_LOCAL_TRANSPORT_H
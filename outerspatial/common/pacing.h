@@ -0,0 +1,99 @@
+#ifndef OUTERSPATIALENGINE_PACING_H
+#define OUTERSPATIALENGINE_PACING_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <unordered_map>
+
+// Additive-increase/multiplicative-decrease pacing of one client's commands to a busy server.
+// Two things are controlled from the same congestion signal:
+//  - the window: how many commands may be awaiting a response at once
+//  - the slowdown: how many times longer than normal the client waits between rounds of commands
+// Every timely, successful response opens the window by about one command per window's worth of
+// responses, and takes slowdown back towards 1 by about SLOWDOWN_STEP per window. A failure (which
+// includes a timeout) or a response slower than LATENCY_FACTOR times the fastest one seen halves the
+// window and doubles the slowdown; at most once per round trip, since every command already in
+// flight when the server got busy will report the same thing.
+class AimdPacer {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  const double MIN_WINDOW = 1;
+  const double MAX_WINDOW = 256;
+  const double MAX_SLOWDOWN = 32;
+  const double SLOWDOWN_STEP = 0.25;
+  const double BACKOFF = 0.5;
+  const double LATENCY_FACTOR = 4;
+  const double MIN_LATENCY_TARGET_MS = 50; // below this, latency alone is never a congestion signal
+
+  explicit AimdPacer(double initial_window = 16)
+      : window(std::clamp(initial_window, MIN_WINDOW, MAX_WINDOW)) {};
+
+  bool CanSend() const {
+    return static_cast<double>(in_flight.size()) + 1 <= window;
+  }
+  void Sent(std::uint32_t request_id) {
+    in_flight[request_id] = Clock::now();
+  }
+  // Call for every response to a command passed to Sent, whatever its status.
+  // Returns false if the request wasn't one of ours.
+  bool OnResponse(std::uint32_t request_id, bool success) {
+    auto request = in_flight.find(request_id);
+    if (request == in_flight.end()) {
+      return false;
+    }
+    Clock::time_point sent = request->second;
+    in_flight.erase(request);
+    auto now = Clock::now();
+    double rtt_ms = std::chrono::duration<double, std::milli>(now - sent).count();
+    if (success) {
+      min_rtt_ms = std::min(min_rtt_ms, rtt_ms);
+      smoothed_rtt_ms = (smoothed_rtt_ms < 0) ? rtt_ms : smoothed_rtt_ms + (rtt_ms - smoothed_rtt_ms)/8;
+    }
+    bool congested = !success || rtt_ms > std::max(MIN_LATENCY_TARGET_MS, LATENCY_FACTOR*min_rtt_ms);
+    if (!congested) {
+      window = std::min(MAX_WINDOW, window + 1/window);
+      slowdown = std::max(1.0, slowdown - SLOWDOWN_STEP/window);
+    } else if (sent >= last_backoff) {
+      window = std::max(MIN_WINDOW, window*BACKOFF);
+      slowdown = std::min(MAX_SLOWDOWN, slowdown/BACKOFF);
+      last_backoff = now;
+    }
+    return true;
+  }
+
+  // For a client on a fixed schedule: true on about one in every `slowdown` calls
+  bool TakeRound() {
+    credit += 1/slowdown;
+    if (credit < 1) {
+      return false;
+    }
+    credit -= 1;
+    return true;
+  }
+
+  double Window() const {
+    return window;
+  }
+  double Slowdown() const {
+    return slowdown;
+  }
+  std::size_t InFlight() const {
+    return in_flight.size();
+  }
+  double SmoothedRttMs() const {
+    return smoothed_rtt_ms;
+  }
+
+private:
+  double window;
+  double slowdown = 1;
+  double credit = 0;
+  double min_rtt_ms = 1e9;
+  double smoothed_rtt_ms = -1;
+  Clock::time_point last_backoff;
+  std::unordered_map<std::uint32_t, Clock::time_point> in_flight; // request ID -> time sent
+};
+
+#endif  // OUTERSPATIALENGINE_PACING_H
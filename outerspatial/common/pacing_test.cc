@@ -0,0 +1,114 @@
+#undef NDEBUG  // the checks are asserts
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+#include "pacing.h"
+
+// AimdPacer against the additive-increase/multiplicative-decrease recurrence worked by hand.
+// Responses arrive well inside MIN_LATENCY_TARGET_MS, so only failures count as congestion.
+
+bool Near(double a, double b) {
+  return std::abs(a - b) < 1e-9;
+}
+
+// Sends `count` commands starting at `first_id`, as far as the window allows
+std::uint32_t SendBurst(AimdPacer& pacer, std::uint32_t first_id, std::uint32_t count) {
+  std::uint32_t sent = 0;
+  while (sent < count && pacer.CanSend()) {
+    pacer.Sent(first_id + sent++);
+  }
+  return sent;
+}
+
+void TestIncrease() {
+  AimdPacer pacer(4);
+  double window = 4;
+  double slowdown = 1;
+  std::uint32_t id = 0;
+  for (int round = 0; round < 300; round++) {
+    std::uint32_t first = id;
+    std::uint32_t sent = SendBurst(pacer, first, 1000);
+    // the window, rounded down, is how many commands can be awaiting a response
+    assert(sent == static_cast<std::uint32_t>(std::floor(window)));
+    assert(pacer.InFlight() == sent && !pacer.CanSend());
+    id += sent;
+    for (std::uint32_t i = first; i < id; i++) {
+      assert(pacer.OnResponse(i, true));
+      window = std::min(pacer.MAX_WINDOW, window + 1/window);
+      slowdown = std::max(1.0, slowdown - pacer.SLOWDOWN_STEP/window);
+    }
+    assert(Near(pacer.Window(), window));
+    assert(Near(pacer.Slowdown(), slowdown));
+  }
+  assert(pacer.InFlight() == 0);
+  assert(!pacer.OnResponse(id + 1, true)); // not one of ours
+  assert(pacer.SmoothedRttMs() >= 0);
+}
+
+void TestDecrease() {
+  AimdPacer pacer(32);
+  std::uint32_t sent = SendBurst(pacer, 0, 32);
+  assert(sent == 32);
+  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+  // Everything in flight when the server got busy fails, but that only halves the window once
+  for (std::uint32_t i = 0; i < 16; i++) {
+    assert(pacer.OnResponse(i, false));
+  }
+  assert(Near(pacer.Window(), 16));
+  assert(Near(pacer.Slowdown(), 2));
+
+  // Another failure from a command sent after that backoff does count
+  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  for (std::uint32_t i = 16; i < 32; i++) {
+    assert(pacer.OnResponse(i, true)); // still successes from before the backoff
+  }
+  double window = 16;
+  double slowdown = 2;
+  for (int i = 0; i < 16; i++) {
+    window += 1/window;
+    slowdown = std::max(1.0, slowdown - pacer.SLOWDOWN_STEP/window);
+  }
+  assert(Near(pacer.Window(), window) && Near(pacer.Slowdown(), slowdown));
+  pacer.Sent(100);
+  assert(pacer.OnResponse(100, false));
+  assert(Near(pacer.Window(), window/2) && Near(pacer.Slowdown(), slowdown*2));
+
+  // Bounded below and above
+  for (std::uint32_t i = 200; i < 240; i++) {
+    std::this_thread::sleep_for(std::chrono::microseconds(10));
+    pacer.Sent(i);
+    pacer.OnResponse(i, false);
+  }
+  assert(Near(pacer.Window(), pacer.MIN_WINDOW));
+  assert(Near(pacer.Slowdown(), pacer.MAX_SLOWDOWN));
+  assert(pacer.CanSend());
+}
+
+void TestTakeRound() {
+  AimdPacer pacer(8);
+  for (int i = 0; i < 3; i++) {
+    std::this_thread::sleep_for(std::chrono::microseconds(10));
+    pacer.Sent(i);
+    pacer.OnResponse(i, false);
+  }
+  assert(Near(pacer.Slowdown(), 8));
+  int rounds = 0;
+  for (int call = 0; call < 800; call++) {
+    rounds += pacer.TakeRound() ? 1 : 0;
+  }
+  assert(rounds == 100);
+}
+
+int main() {
+  TestIncrease();
+  TestDecrease();
+  TestTakeRound();
+  std::cout << "pacing_test passed" << std::endl;
+  return 0;
+}
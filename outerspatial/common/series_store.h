@@ -0,0 +1,277 @@
+#ifndef OUTERSPATIALENGINE_SERIES_STORE_H
+#define OUTERSPATIALENGINE_SERIES_STORE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+
+#if defined(__linux__) || defined(__APPLE__)
+#define OUTERSPATIAL_HAS_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define OUTERSPATIAL_HAS_MMAP 0
+#endif
+
+// Append-only binary time series backed by a memory-mapped file.
+// One file holds one series (e.g. prices for "food"); the AH is the only writer, and any process on
+// the same host can map the file read-only and see new samples as they are appended.
+// Files are never truncated: whoever owns the directory is responsible for rotating them.
+//
+// Layout: a SeriesFileHeader followed by packed SeriesRecords. The writer fills in a record and only
+// then bumps `count` (release), so readers that load `count` (acquire) never see a half-written one.
+namespace series {
+  constexpr char kMagic[8] = {'O', 'S', 'S', 'E', 'R', 'I', 'E', 'S'};
+  constexpr std::uint32_t kVersion = 1;
+  constexpr std::uint64_t kDefaultCapacity = 4096; // records; the file doubles whenever it fills up
+
+  struct SeriesRecord {
+    double value;
+    std::int64_t time;
+  };
+
+  struct SeriesFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t record_size;
+    std::atomic<std::uint64_t> count;
+  };
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "count is shared between processes");
+
+  inline std::size_t FileSizeFor(std::uint64_t capacity) {
+    return sizeof(SeriesFileHeader) + capacity*sizeof(SeriesRecord);
+  }
+}
+
+class MappedSeriesWriter {
+public:
+  MappedSeriesWriter() = default;
+  MappedSeriesWriter(const MappedSeriesWriter&) = delete;
+  MappedSeriesWriter& operator=(const MappedSeriesWriter&) = delete;
+  ~MappedSeriesWriter() {
+    Close();
+  }
+
+  // Opens (or creates) the file at `path`. Existing samples are kept and can be read back with data().
+  bool Open(const std::string& path) {
+#if OUTERSPATIAL_HAS_MMAP
+    Close();
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat info{};
+    if (::fstat(fd, &info) != 0) {
+      Close();
+      return false;
+    }
+    bool fresh = (static_cast<std::size_t>(info.st_size) < sizeof(series::SeriesFileHeader));
+    std::uint64_t capacity = fresh ? series::kDefaultCapacity
+                                   : (info.st_size - sizeof(series::SeriesFileHeader))/sizeof(series::SeriesRecord);
+    if (fresh && ::ftruncate(fd, series::FileSizeFor(capacity)) != 0) {
+      Close();
+      return false;
+    }
+    if (!Map(capacity)) {
+      Close();
+      return false;
+    }
+    if (fresh) {
+      std::memcpy(header->magic, series::kMagic, sizeof(series::kMagic));
+      header->version = series::kVersion;
+      header->record_size = sizeof(series::SeriesRecord);
+      new (&header->count) std::atomic<std::uint64_t>(0);
+    } else if (std::memcmp(header->magic, series::kMagic, sizeof(series::kMagic)) != 0
+               || header->version != series::kVersion
+               || header->record_size != sizeof(series::SeriesRecord)
+               || header->count.load(std::memory_order_relaxed) > capacity) {
+      Close();
+      return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  bool IsOpen() const {
+    return header != nullptr;
+  }
+
+  void Append(double value, std::int64_t time) {
+#if OUTERSPATIAL_HAS_MMAP
+    if (!header) {
+      return;
+    }
+    std::uint64_t count = header->count.load(std::memory_order_relaxed);
+    if (count == mapped_capacity && !Grow()) {
+      return;
+    }
+    records[count] = {value, time};
+    header->count.store(count + 1, std::memory_order_release);
+#endif
+  }
+
+  std::size_t size() const {
+    return header ? header->count.load(std::memory_order_relaxed) : 0;
+  }
+  const series::SeriesRecord* data() const {
+    return records;
+  }
+
+private:
+  int fd = -1;
+  void* mapping = nullptr;
+  std::uint64_t mapped_capacity = 0;
+  series::SeriesFileHeader* header = nullptr;
+  series::SeriesRecord* records = nullptr;
+
+#if OUTERSPATIAL_HAS_MMAP
+  bool Map(std::uint64_t capacity) {
+    void* region = ::mmap(nullptr, series::FileSizeFor(capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) {
+      return false;
+    }
+    mapping = region;
+    mapped_capacity = capacity;
+    header = static_cast<series::SeriesFileHeader*>(region);
+    records = reinterpret_cast<series::SeriesRecord*>(static_cast<char*>(region) + sizeof(series::SeriesFileHeader));
+    return true;
+  }
+  void Unmap() {
+    if (mapping) {
+      ::munmap(mapping, series::FileSizeFor(mapped_capacity));
+    }
+    mapping = nullptr;
+    header = nullptr;
+    records = nullptr;
+    mapped_capacity = 0;
+  }
+  bool Grow() {
+    std::uint64_t new_capacity = mapped_capacity*2;
+    if (::ftruncate(fd, series::FileSizeFor(new_capacity)) != 0) {
+      return false;
+    }
+    Unmap();
+    return Map(new_capacity);
+  }
+#endif
+
+  void Close() {
+#if OUTERSPATIAL_HAS_MMAP
+    Unmap();
+    if (fd >= 0) {
+      ::close(fd);
+    }
+#endif
+    fd = -1;
+  }
+};
+
+// Read-only view of a series file, for analysis tools on the same host (nothing in the workers uses it;
+// the MonitorWorker gets its history over SpatialOS).
+// Records are read straight out of the shared mapping; call Refresh() to pick up samples appended
+// since the last call (it remaps if the writer has grown the file).
+class MappedSeriesReader {
+public:
+  MappedSeriesReader() = default;
+  MappedSeriesReader(const MappedSeriesReader&) = delete;
+  MappedSeriesReader& operator=(const MappedSeriesReader&) = delete;
+  ~MappedSeriesReader() {
+    Close();
+  }
+
+  bool Open(const std::string& path) {
+#if OUTERSPATIAL_HAS_MMAP
+    Close();
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    Refresh();
+    if (!header) {
+      Close();
+      return false;
+    }
+    return std::memcmp(header->magic, series::kMagic, sizeof(series::kMagic)) == 0
+        && header->version == series::kVersion;
+#else
+    return false;
+#endif
+  }
+
+  // Returns the number of complete records now visible
+  std::size_t Refresh() {
+#if OUTERSPATIAL_HAS_MMAP
+    if (fd < 0) {
+      return 0;
+    }
+    if (header && header->count.load(std::memory_order_acquire) <= mapped_capacity) {
+      visible = header->count.load(std::memory_order_acquire);
+      return visible;
+    }
+    struct stat info{};
+    if (::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(series::SeriesFileHeader)) {
+      return 0;
+    }
+    Unmap();
+    std::uint64_t capacity = (info.st_size - sizeof(series::SeriesFileHeader))/sizeof(series::SeriesRecord);
+    void* region = ::mmap(nullptr, series::FileSizeFor(capacity), PROT_READ, MAP_SHARED, fd, 0);
+    if (region == MAP_FAILED) {
+      return 0;
+    }
+    mapping = region;
+    mapped_capacity = capacity;
+    header = static_cast<const series::SeriesFileHeader*>(region);
+    records = reinterpret_cast<const series::SeriesRecord*>(static_cast<const char*>(region) + sizeof(series::SeriesFileHeader));
+    visible = std::min<std::uint64_t>(header->count.load(std::memory_order_acquire), mapped_capacity);
+    return visible;
+#else
+    return 0;
+#endif
+  }
+
+  std::size_t size() const {
+    return visible;
+  }
+  const series::SeriesRecord* data() const {
+    return records;
+  }
+
+private:
+  int fd = -1;
+  const void* mapping = nullptr;
+  std::uint64_t mapped_capacity = 0;
+  std::size_t visible = 0;
+  const series::SeriesFileHeader* header = nullptr;
+  const series::SeriesRecord* records = nullptr;
+
+  void Unmap() {
+#if OUTERSPATIAL_HAS_MMAP
+    if (mapping) {
+      ::munmap(const_cast<void*>(mapping), series::FileSizeFor(mapped_capacity));
+    }
+#endif
+    mapping = nullptr;
+    header = nullptr;
+    records = nullptr;
+    mapped_capacity = 0;
+  }
+  void Close() {
+    Unmap();
+#if OUTERSPATIAL_HAS_MMAP
+    if (fd >= 0) {
+      ::close(fd);
+    }
+#endif
+    fd = -1;
+    visible = 0;
+  }
+};
+
+#endif  // OUTERSPATIALENGINE_SERIES_STORE_H
@@ -0,0 +1,137 @@
+#undef NDEBUG  // the checks are asserts
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "history.h"
+#include "series_store.h"
+
+// MappedSeriesWriter and MappedSeriesReader against a plain vector of what was appended, and the
+// HistoryLog warm start from those files
+
+#if OUTERSPATIAL_HAS_MMAP
+
+void CheckMatches(const series::SeriesRecord* records, std::size_t size, const std::vector<series::SeriesRecord>& naive) {
+  assert(size == naive.size());
+  for (std::size_t i = 0; i < size; i++) {
+    assert(records[i].value == naive[i].value && records[i].time == naive[i].time);
+  }
+}
+
+void TestWriterAndReader(const std::string& directory) {
+  std::string path = directory + "/series.bin";
+  std::vector<series::SeriesRecord> naive;
+  {
+    MappedSeriesWriter writer;
+    assert(writer.Open(path));
+    assert(writer.size() == 0);
+    MappedSeriesReader reader;
+    assert(reader.Open(path));
+    assert(reader.size() == 0);
+
+    // Past the initial capacity twice over, so the file grows under a reader that is already mapped
+    for (std::uint64_t i = 0; i < 3*series::kDefaultCapacity; i++) {
+      series::SeriesRecord record{i*0.5 - 100, static_cast<std::int64_t>(1000 + i*10)};
+      writer.Append(record.value, record.time);
+      naive.push_back(record);
+      if (i % 1000 == 0 || i + 1 == series::kDefaultCapacity || i == series::kDefaultCapacity) {
+        assert(reader.Refresh() == naive.size());
+        CheckMatches(reader.data(), reader.size(), naive);
+      }
+    }
+    CheckMatches(writer.data(), writer.size(), naive);
+    assert(reader.Refresh() == naive.size());
+    CheckMatches(reader.data(), reader.size(), naive);
+  }
+
+  // Reopened, the writer keeps what is there and carries on after it
+  MappedSeriesWriter writer;
+  assert(writer.Open(path));
+  CheckMatches(writer.data(), writer.size(), naive);
+  writer.Append(42, 99);
+  naive.push_back({42, 99});
+  CheckMatches(writer.data(), writer.size(), naive);
+  MappedSeriesReader reader;
+  assert(reader.Open(path));
+  CheckMatches(reader.data(), reader.size(), naive);
+
+  // Anything that is not a series file is refused
+  std::string other = directory + "/other.bin";
+  std::FILE* file = std::fopen(other.c_str(), "wb");
+  std::fputs("not a series file, but long enough to hold a header", file);
+  std::fclose(file);
+  MappedSeriesWriter refused;
+  assert(!refused.Open(other) && !refused.IsOpen());
+  MappedSeriesReader refused_reader;
+  assert(!refused_reader.Open(other));
+  assert(!refused_reader.Open(directory + "/missing.bin"));
+}
+
+std::vector<std::pair<double, double>> History(const HistoryLog& log, const std::string& name) {
+  return log.get_history(name, std::numeric_limits<std::int64_t>::min());
+}
+
+void TestWarmStart(const std::string& directory) {
+  const std::size_t MAX_SIZE = 60000; // HistoryLog's window
+  LogicalClock clock(5000);
+  std::vector<std::pair<double, double>> written;
+  {
+    HistoryLog log(LogType::PRICE);
+    log.use_clock(clock);
+    log.persist(directory, "prices");
+    log.initialise("food");
+    log.initialise("wood");
+    for (int i = 0; i < 70000; i++) {
+      clock.Advance(10);
+      log.add("food", 10 + (i % 7)*0.25);
+    }
+    written = History(log, "food");
+    assert(written.size() == MAX_SIZE);
+  }
+
+  // A fresh log picks up the newest samples and the latest value from disk, for every series
+  HistoryLog restarted(LogType::PRICE);
+  restarted.use_clock(clock);
+  restarted.persist(directory, "prices");
+  restarted.initialise("food");
+  restarted.initialise("wood");
+  assert(History(restarted, "food") == written);
+  assert(restarted.most_recent["food"] == written.back().second);
+  assert(History(restarted, "wood").size() == 1 && restarted.most_recent["wood"] == 10);
+
+  // and keeps appending to the same files
+  clock.Advance(10);
+  restarted.add("food", 3);
+  MappedSeriesReader reader;
+  assert(reader.Open(directory + "/prices_food.bin"));
+  assert(reader.size() == 1 + 70000 + 1); // starting value, the run before, this one
+  assert(reader.data()[reader.size() - 1].value == 3 && reader.data()[reader.size() - 1].time == clock.NowMs());
+}
+
+int main() {
+  char pattern[] = "/tmp/series_store_test_XXXXXX";
+  const char* directory = mkdtemp(pattern);
+  assert(directory);
+  TestWriterAndReader(directory);
+  TestWarmStart(directory);
+  for (const char* name : {"series.bin", "other.bin", "prices_food.bin", "prices_wood.bin"}) {
+    std::remove((std::string(directory) + "/" + name).c_str());
+  }
+  std::remove(directory);
+  std::cout << "series_store_test passed" << std::endl;
+  return 0;
+}
+
+#else
+
+int main() {
+  std::cout << "series_store_test skipped: no mmap on this platform" << std::endl;
+  return 0;
+}
+
+#endif
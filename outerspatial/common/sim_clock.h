@@ -0,0 +1,54 @@
+#ifndef OUTERSPATIALENGINE_SIM_CLOCK_H
+#define OUTERSPATIALENGINE_SIM_CLOCK_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "concurrency.h"
+
+// Where simulated time comes from, in Unix milliseconds: market history, offer expiry and the
+// executor's timers all read it. Normally that is the wall clock; a LogicalClock instead only moves
+// when it is told to, so a headless run can skip straight to whatever is due next rather than wait
+// for it (see workers/Headless).
+class SimClock {
+public:
+  virtual ~SimClock() = default;
+  virtual std::int64_t NowMs() const = 0;
+
+  static const SimClock& Wall();
+};
+
+class WallClock : public SimClock {
+public:
+  std::int64_t NowMs() const override {
+    return to_unix_timestamp_ms(std::chrono::system_clock::now());
+  }
+};
+
+inline const SimClock& SimClock::Wall() {
+  static const WallClock wall;
+  return wall;
+}
+
+// Stays where it was last set. Also used to stamp a whole tick with one reading of another clock.
+class LogicalClock : public SimClock {
+public:
+  explicit LogicalClock(std::int64_t start_ms = 0)
+      : now_ms(start_ms) {};
+
+  std::int64_t NowMs() const override {
+    return now_ms.load(std::memory_order_relaxed);
+  }
+  void Set(std::int64_t time_ms) {
+    now_ms.store(time_ms, std::memory_order_relaxed);
+  }
+  void Advance(std::int64_t duration_ms) {
+    now_ms.fetch_add(duration_ms, std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<std::int64_t> now_ms;
+};
+
+#endif  // OUTERSPATIALENGINE_SIM_CLOCK_H
@@ -7,6 +7,7 @@
 
 #include "commodity.h"
 #include "messages.h"
+#include "transport.h"
 
 commodity::Commodity ToSchemaCommodity(Commodity& comm) {
   return {comm.name, comm.size, comm.market_component_id};
@@ -22,52 +23,14 @@ messages::AskOffer ToSchemaAskOffer(AskOffer& offer, worker::EntityId sender_ent
   return {sender_entity_id, offer.commodity, offer.expiry_ms, offer.quantity, offer.unit_price};
 }
 
-std::optional<market::PriceInfo> ToPriceInfo(worker::View& view, worker::EntityId ah_id, const std::string& commodity) {
-  if (commodity == "food") {
-    auto market = view.Entities[ah_id].Get<market::FoodMarket>();
-    if (!market) {
-      return {};
-    } else {
-      return market->listing().price_info();
-    }
-  } else if (commodity == "wood") {
-    auto market = view.Entities[ah_id].Get<market::WoodMarket>();
-    if (!market) {
-      return {};
-    } else {
-      return market->listing().price_info();
-    }
-  } else if (commodity == "fertilizer") {
-    auto market = view.Entities[ah_id].Get<market::FertilizerMarket>();
-    if (!market) {
-      return {};
-    } else {
-      return market->listing().price_info();
-    }
-  } else if (commodity == "ore") {
-    auto market = view.Entities[ah_id].Get<market::OreMarket>();
-    if (!market) {
-      return {};
-    } else {
-      return market->listing().price_info();
-    }
-  } else if (commodity == "metal") {
-    auto market = view.Entities[ah_id].Get<market::MetalMarket>();
-    if (!market) {
-      return {};
-    } else {
-      return market->listing().price_info();
-    }
-  } else if (commodity == "tools") {
-    auto market = view.Entities[ah_id].Get<market::ToolsMarket>();
-    if (!market) {
-      return {};
-    } else {
-      return market->listing().price_info();
-    }
-  } else {
+// Indexed lookup into the auction house's MarketSnapshot
+std::optional<market::PriceInfo> ToPriceInfo(transport::View& view, worker::EntityId ah_id, int market_component_id) {
+  auto snapshot = view.Entities[ah_id].Get<market::MarketSnapshot>();
+  int index = MarketIndex(market_component_id);
+  if (!snapshot || index < 0 || index >= (int) snapshot->listings().size()) {
     return {};
   }
+  return snapshot->listings()[index].price_info();
 }
 
 std::string ToString(messages::BidOffer& offer) {
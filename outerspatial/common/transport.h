@@ -0,0 +1,43 @@
+#ifndef OUTERSPATIALENGINE_TRANSPORT_H
+#define OUTERSPATIALENGINE_TRANSPORT_H
+
+// What agents talk through. Normally that is the worker SDK's Connection and View; headless builds
+// (OUTERSPATIAL_HEADLESS, see workers/Headless) swap in the in-process stand-ins from
+// local_transport.h, which have the same interface, so the engine itself is unchanged between them.
+// Engine code names the connection, the view and the op types it handles through here.
+#ifdef OUTERSPATIAL_HEADLESS
+
+#include "local_transport.h"
+
+namespace transport {
+  using Connection = local::Connection;
+  using View = local::View;
+  template<typename T> using CommandRequestOp = local::CommandRequestOp<T>;
+  template<typename T> using CommandResponseOp = local::CommandResponseOp<T>;
+  template<typename T> using ComponentUpdateOp = local::ComponentUpdateOp<T>;
+  template<typename T> using AddComponentOp = local::AddComponentOp<T>;
+  using CreateEntityResponseOp = local::CreateEntityResponseOp;
+  using ReserveEntityIdsResponseOp = local::ReserveEntityIdsResponseOp;
+  using DisconnectOp = local::DisconnectOp;
+}
+
+#else
+
+#include <improbable/view.h>
+#include <improbable/worker.h>
+
+namespace transport {
+  using Connection = worker::Connection;
+  using View = worker::View;
+  template<typename T> using CommandRequestOp = worker::CommandRequestOp<T>;
+  template<typename T> using CommandResponseOp = worker::CommandResponseOp<T>;
+  template<typename T> using ComponentUpdateOp = worker::ComponentUpdateOp<T>;
+  template<typename T> using AddComponentOp = worker::AddComponentOp<T>;
+  using CreateEntityResponseOp = worker::CreateEntityResponseOp;
+  using ReserveEntityIdsResponseOp = worker::ReserveEntityIdsResponseOp;
+  using DisconnectOp = worker::DisconnectOp;
+}
+
+#endif
+
+#endif  // OUTERSPATIALENGINE_TRANSPORT_H
@@ -11,6 +11,8 @@
 #include <iostream>
 #include <ostream>
 
+#include "../common/transport.h"
+
 namespace Log{
     enum LogLevel {
         SILENT,
@@ -78,9 +80,9 @@ private:
     }
 };
 class SpatialLogger : public Logger {
-  worker::Connection& conn;
+  transport::Connection& conn;
 public:
-  SpatialLogger(Log::LogLevel verbosity, std::string name, worker::Connection& connection)
+  SpatialLogger(Log::LogLevel verbosity, std::string name, transport::Connection& connection)
       : Logger(verbosity, name)
        , conn(connection){ };
 
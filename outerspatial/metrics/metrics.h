@@ -44,8 +44,8 @@ private:
     std::uint64_t offset;
     std::uint64_t start_time;
     std::uint64_t prev_time;
-    worker::Connection& connection;
-    worker::View& view;
+    transport::Connection& connection;
+    transport::View& view;
 
     bool initialised = false;
     worker::EntityId auction_house_id;
@@ -53,7 +53,7 @@ private:
   public:
     worker::EntityId monitor_entity_id;
 
-    LocalMetrics(worker::Connection& connection, worker::View& view, std::uint64_t start_time, worker::EntityId ah_id)
+    LocalMetrics(transport::Connection& connection, transport::View& view, std::uint64_t start_time, worker::EntityId ah_id)
     : start_time(start_time)
     , connection(connection)
     , auction_house_id(ah_id)
@@ -99,7 +99,7 @@ private:
   void MakeCallbacks() {
     using RegisterTraderCommand = market::RegisterCommandComponent::Commands::RegisterCommand;
     view.OnCommandResponse<RegisterTraderCommand>(
-        [&](const worker::CommandResponseOp<RegisterTraderCommand>& op) {
+        [&](const transport::CommandResponseOp<RegisterTraderCommand>& op) {
             if (op.StatusCode != worker::StatusCode::kSuccess) {
               // failed to register!
               return;
@@ -112,7 +112,7 @@ private:
             initialised = true;
         });
     view.OnComponentUpdate<market::DemographicInfo>(
-        [&](const worker::ComponentUpdateOp<market::DemographicInfo >& op) {
+        [&](const transport::ComponentUpdateOp<market::DemographicInfo >& op) {
           // TODO: Store time series for graphing
 //          market::DemographicInfo::Update update = op.Update;
 //          for (auto& demo : *update.role_counts()) {
@@ -120,59 +120,17 @@ private:
 //            demographics[role] = demo.second;
 //          }
         });
-    view.OnComponentUpdate<market::FoodMarket>(
-        [&](const worker::ComponentUpdateOp<market::FoodMarket >& op) {
-          std::string commodity = "food";
-          worker::EntityId entity_id = op.EntityId;
-          market::FoodMarket::Update update = op.Update;
-          local_history.prices.add(commodity, update.listing()->price_info().curr_price());
-          local_history.net_supply.add(commodity, update.listing()->price_info().curr_net_supply());
-          local_history.trades.add(commodity, update.listing()->price_info().recent_trade_volume());
-        });
-    view.OnComponentUpdate<market::WoodMarket>(
-        [&](const worker::ComponentUpdateOp<market::WoodMarket >& op) {
-          std::string commodity = "wood";
-          worker::EntityId entity_id = op.EntityId;
-          market::WoodMarket::Update update = op.Update;
-          local_history.prices.add(commodity, update.listing()->price_info().curr_price());
-          local_history.net_supply.add(commodity, update.listing()->price_info().curr_net_supply());
-          local_history.trades.add(commodity, update.listing()->price_info().recent_trade_volume());
-        });
-    view.OnComponentUpdate<market::FertilizerMarket>(
-        [&](const worker::ComponentUpdateOp<market::FertilizerMarket >& op) {
-          std::string commodity = "fertilizer";
-          worker::EntityId entity_id = op.EntityId;
-          market::FertilizerMarket::Update update = op.Update;
-          local_history.prices.add(commodity, update.listing()->price_info().curr_price());
-          local_history.net_supply.add(commodity, update.listing()->price_info().curr_net_supply());
-          local_history.trades.add(commodity, update.listing()->price_info().recent_trade_volume());
-        });
-    view.OnComponentUpdate<market::OreMarket>(
-        [&](const worker::ComponentUpdateOp<market::OreMarket >& op) {
-          std::string commodity = "ore";
-          worker::EntityId entity_id = op.EntityId;
-          market::OreMarket::Update update = op.Update;
-          local_history.prices.add(commodity, update.listing()->price_info().curr_price());
-          local_history.net_supply.add(commodity, update.listing()->price_info().curr_net_supply());
-          local_history.trades.add(commodity, update.listing()->price_info().recent_trade_volume());
-        });
-    view.OnComponentUpdate<market::MetalMarket>(
-        [&](const worker::ComponentUpdateOp<market::MetalMarket >& op) {
-          std::string commodity = "metal";
-          worker::EntityId entity_id = op.EntityId;
-          market::MetalMarket::Update update = op.Update;
-          local_history.prices.add(commodity, update.listing()->price_info().curr_price());
-          local_history.net_supply.add(commodity, update.listing()->price_info().curr_net_supply());
-          local_history.trades.add(commodity, update.listing()->price_info().recent_trade_volume());
-        });
-    view.OnComponentUpdate<market::ToolsMarket>(
-        [&](const worker::ComponentUpdateOp<market::ToolsMarket >& op) {
-          std::string commodity = "tools";
-          worker::EntityId entity_id = op.EntityId;
-          market::ToolsMarket::Update update = op.Update;
-          local_history.prices.add(commodity, update.listing()->price_info().curr_price());
-          local_history.net_supply.add(commodity, update.listing()->price_info().curr_net_supply());
-          local_history.trades.add(commodity, update.listing()->price_info().recent_trade_volume());
+    view.OnComponentUpdate<market::MarketSnapshot>(
+        [&](const transport::ComponentUpdateOp<market::MarketSnapshot >& op) {
+          if (!op.Update.listings()) {
+            return;
+          }
+          for (const auto& listing : *op.Update.listings()) {
+            const std::string& commodity = listing.item().name();
+            local_history.prices.add(commodity, listing.price_info().curr_price());
+            local_history.net_supply.add(commodity, listing.price_info().curr_net_supply());
+            local_history.trades.add(commodity, listing.price_info().recent_trade_volume());
+          }
         });
   }
 };
@@ -6,6 +6,8 @@
 
 #include "common/to_schema.h"
 #include "common/concurrency.h"
+#include "common/executor.h"
+#include "common/coroutine.h"
 #include "common/agent.h"
 #include "common/messages.h"
 #include "common/commodity.h"
@@ -19,6 +21,7 @@
 #include "metrics/display.h"
 
 #include "traders/AI_trader.h"
+#include "traders/trader_host.h"
 #include "traders/fake_trader.h"
 #include "traders/human_trader.h"
 
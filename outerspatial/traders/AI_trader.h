@@ -5,42 +5,67 @@
 #ifndef CPPBAZAARBOT_AI_TRADER_H
 #define CPPBAZAARBOT_AI_TRADER_H
 
+#include <functional>
 #include <utility>
 
 #include "inventory.h"
+#include "trading_range.h"
+#include "cohort.h"
+#include "decision_kernel.h"
 #include "../common/messages.h"
+#include "../common/coroutine.h"
+#include "../common/pacing.h"
+#include "../common/sim_clock.h"
 
 #include "../auction/auction_house.h"
 #include "../metrics/logger.h"
 
 class AITrader;
 
-namespace {
-    double PositionInRange(double value, double min, double max) {
-        value -= min;
-        max -= min;
-        min = 0;
-        value = (value / (max - min));
-
-        if (value < 0) { value = 0; }
-        if (value > 1) { value = 1; }
-
-        return value;
-    }
-}
-
 namespace {
   enum TraderStatus {
     UNINITIALISED = 0,
     ACTIVE = 1,
     PENDING_DESTRUCTION = 2,
-    DESTROYED = 3
+    DESTROYED = 3,
+    MIGRATING = 4, // state checkpointed, waiting to hear if the hand-off went ahead
+    MIGRATED = 5 // now run by another worker; this copy is dead but must not shut the trader down
 };
 }
 
+// Everything offer generation reads, gathered once per tick so that GenerateOffers needs no view
+// lookups, map lookups or copies. Per-commodity arrays are indexed by belief slot
+// (CommodityBeliefs::Slot), and keep their capacity from tick to tick.
+struct TraderSnapshot {
+  bool valid = false;
+  double cash = 0;
+  double free_space = 0;
+  double idle_tax = 0;
+  std::vector<int> quantity;
+  std::vector<double> unit_size;
+  std::vector<char> has_price;
+  std::vector<double> recent_price;
+  std::vector<int> ideal;
+  std::vector<double> cost;
+
+  void Reset(std::size_t commodities) {
+    valid = false;
+    cash = 0;
+    free_space = 0;
+    idle_tax = 0;
+    quantity.assign(commodities, 0);
+    unit_size.assign(commodities, 0);
+    has_price.assign(commodities, 0);
+    recent_price.assign(commodities, 0);
+    ideal.assign(commodities, 0);
+    cost.assign(commodities, 0);
+  }
+};
+
 class AITrader : public Trader {
 private:
     int TICK_TIME_MS;
+    const SimClock& clock; // offer expiry and, as coroutines, tick pacing
     int MAX_PROCESSED_MESSAGES_PER_FLUSH = 100;
     double MIN_COST = 10;
     double MIN_PRICE = 0.10;
@@ -52,25 +77,64 @@ private:
     int auction_house_id = -1;
 
     double tracked_costs = 0;
-    std::map<std::string, std::vector<double>> observed_trading_range;
+    std::vector<TradingRange> trading_ranges; // by belief slot: prices of the last internal_lookback units traded
     CommodityBeliefs commodity_beliefs;
+    std::map<std::string, int> market_ids; // commodity name -> market component id, from registration
+    std::vector<int> slot_market_index; // belief slot -> index into the AH's MarketSnapshot, or -1
+    TraderSnapshot snapshot;
+    int offers_this_tick = 0;
 
     int external_lookback = 50*TICK_TIME_MS; //history range (num ticks)
     int internal_lookback = 50; //history range (num trades)
 
+    // COHORTS
+    // A trader registered with members > 1 stands for that many similar traders sharing one pooled
+    // Inventory. Its snapshot holds the average member's share, so offer arithmetic (scalar or batched)
+    // is unchanged, and its offers are scaled back up to the whole cohort as they are sent.
+    // The AH only keeps the pool, so the spread of members' holdings is estimated from how the average
+    // member's holdings move tick to tick; the spread of their beliefs from the prices the cohort trades
+    // and produces at. Both are per belief slot.
+    std::int32_t members = 1;
+    double COHORT_SMOOTHING = 0.1;
+    double MAX_COHORT_PRICE_SPREAD = 0.25; // relative sd of tier prices
+    std::vector<cohort::Moments> holdings_moments;
+    std::vector<cohort::Moments> price_moments;
+    std::vector<cohort::Tier> tiers; // offers for the commodity being sent, reused
+
+    // PACING
+    // Offers are only sent while the pacer's window has room, and a tick only runs when the pacer
+    // grants it a round, so a trader whose offers come back slowly or fail backs off on its own.
+    // Responses reach OnOfferResponse through whoever owns the View (see RouteOfferResponses).
+    AimdPacer pacing;
+    std::function<void(std::uint32_t)> route_offer_response;
+    int deferred_offers = 0; // offers not sent this tick for want of room in the window
+
     std::unique_ptr<Logger> logger;
 
+#if OUTERSPATIAL_HAS_COROUTINES
+    std::uint32_t REGISTER_TIMEOUT_MS = 1000;
+    struct OfferResult {
+      std::string commodity;
+      double price;
+      int quantity;
+    };
+    coro::Mailbox<OfferResult> offer_results; // results waiting to be observed by Run
+    bool running = false;
+#endif
+
 public:
     std::atomic<TraderStatus> status = TraderStatus::UNINITIALISED;
 
-    AITrader(worker::Connection& connection, worker::View& view, int auction_house_id, messages::AIRole role, int tick_time_ms, Log::LogLevel verbosity = Log::WARN)
+    AITrader(transport::Connection& connection, transport::View& view, int auction_house_id, messages::AIRole role, int tick_time_ms, Log::LogLevel verbosity = Log::WARN,
+             std::int32_t members = 1, const SimClock& clock = SimClock::Wall())
     : Trader(-1, "unassigned_class",  connection, view) //id is -1 until set by the SpatialOS Registration procedure
     , unique_name("unregistered")
     , TICK_TIME_MS(tick_time_ms)
+    , clock(clock)
     , role(role)
-    , auction_house_id(auction_house_id) {
+    , auction_house_id(auction_house_id)
+    , members(std::max(1, members)) {
         //construct inv_inventory = Inventory(inv_capacity, starting_inv);
-      MakeCallbacks();
       logger = std::make_unique<SpatialLogger>(verbosity, "unregistered", connection);
     }
 
@@ -78,30 +142,96 @@ public:
         logger->Log(Log::DEBUG, "Destroying AI trader");
     }
 
-private:
-    void MakeCallbacks() override;
-
     // MESSAGE PROCESSING
+    // Ops are routed here by the TraderHost that owns this trader's View
+    using RegisterTraderCommand = market::RegisterCommandComponent::Commands::RegisterCommand;
+    using ReportBidResultCommand = trader::ReportOfferResultComponent::Commands::ReportBidOffer;
+    using ReportAskResultCommand = trader::ReportOfferResultComponent::Commands::ReportAskOffer;
+    void OnRegistered(const transport::CommandResponseOp<RegisterTraderCommand>& op);
+    // HAND-OFFS
+    // Checkpoint, move and resume this trader on another worker. The state is everything the trader
+    // has learned; its Inventory never leaves the AH. Between BeginHandOff and EndHandOff the trader
+    // is paused, and EndHandOff(false) resumes it where it left off.
+    trader::AITraderState SaveState() const;
+    void Restore(worker::EntityId entity_id, const trader::AITraderState& state);
+    trader::AITraderState BeginHandOff();
+    void EndHandOff(bool succeeded);
+    void OnBidResult(const transport::CommandRequestOp<ReportBidResultCommand>& op);
+    void OnAskResult(const transport::CommandRequestOp<ReportAskResultCommand>& op);
+    void OnInventoryUpdate(const transport::ComponentUpdateOp<trader::Inventory>& op);
+    // Every offer sent is passed to `route` by request ID; its response must then be passed back to
+    // OnOfferResponse. Until this is called, offers are sent unpaced.
+    void RouteOfferResponses(std::function<void(std::uint32_t)> route);
+    void OnOfferResponse(std::uint32_t request_id, worker::StatusCode status);
+
+#if OUTERSPATIAL_HAS_COROUTINES
+    // COROUTINE FLOW
+    // The whole life of the trader as one coroutine: register, then offer -> await results -> observe
+    // every tick_interval_ms until shut down. on_active is called once registered, so the owner can
+    // start routing this trader's ops to it. Production reports still arrive via OnInventoryUpdate.
+    coro::Task Run(coro::CommandRouter& commands, Executor& executor, int tick_interval_ms,
+                   std::function<void(AITrader&)> on_active);
+#endif
+
+private:
+    void Activate(worker::EntityId entity_id, messages::AIRole assigned_role, std::int32_t cohort_members);
+    void OnProductionReport(const messages::ProductionResponse& report);
     void UpdatePriceModelFromProduction(worker::Map<std::basic_string<char>, int>& useful_production,
                                         worker::Map<std::basic_string<char>, int>& overproduction,
                                         worker::Map<std::basic_string<char>, int>& consumption);
 
     // INTERNAL LOGIC
-    void GenerateOffers(const std::string& commodity);
-    BidOffer CreateBid(const std::string& commodity, int min_limit, int max_limit, double desperation = 0);
-    AskOffer CreateAsk(const std::string& commodity, int min_limit);
+    void TakeSnapshot();
+    void GenerateOffers(std::size_t slot);
+    BidOffer CreateBid(std::size_t slot, int min_limit, int max_limit, double desperation = 0);
+    AskOffer CreateAsk(std::size_t slot, int min_limit);
     void SendAskOffer(AskOffer& offer);
     void SendBidOffer(BidOffer& offer);
-    int DetermineBuyQuantity(const std::string& commodity, double bid_price);
-    int DetermineSaleQuantity(const std::string& commodity);
+    void PaceOffer(std::uint32_t request_id);
+    // An offer still unanswered when it would have expired is as good as refused
+    std::uint32_t OfferTimeoutMs() const {
+      return static_cast<std::uint32_t>(std::max(1, TICK_TIME_MS));
+    }
+    const std::vector<cohort::Tier>& CohortTiers(const std::string& commodity, int quantity, double unit_price, bool ask);
+    int DetermineBuyQuantity(std::size_t slot, double bid_price);
+    int DetermineSaleQuantity(std::size_t slot);
 
-    std::pair<double, double> ObserveTradingRange(const std::string& commodity, int window);
+    void ObserveTrade(const std::string& commodity, double price, int quantity);
+    std::optional<market::PriceInfo> MarketPriceInfo(const std::string& commodity);
+    double InitialPrice(const std::string& commodity);
     CommodityBeliefs SetDefaultCommodityBeliefs(messages::AIRole assigned_role);
 
 public:
     void RequestShutdown();
-    void Tick();
     void TickOnce();
+    // The register request this trader sends (as a cohort, if it was constructed with members > 1)
+    messages::RegisterRequest MakeRegisterRequest() const;
+
+    // EVENT-DRIVEN WAKE-UPS
+    // True if the last tick found nothing to offer; a TraderHost can then put the trader to sleep
+    bool Idle() const;
+    // Calls subscribe(market_index, price) with the last seen price of every commodity traded
+    template<typename Subscribe>
+    void ForEachPrice(Subscribe subscribe) const {
+      for (std::size_t slot = 0; slot < slot_market_index.size(); slot++) {
+        if (snapshot.valid && snapshot.has_price[slot]) {
+          subscribe(slot_market_index[slot], snapshot.recent_price[slot]);
+        }
+      }
+    }
+
+    // BATCHED TICKS
+    // The same tick as TickOnce, split so a TraderHost can run the offer arithmetic for many
+    // same-role traders in one decision::RoleBatch (one row per belief slot, from first_row):
+    // BeginBatchTick, LoadBatch, DecidePrices, ResolveBatch, DecideQuantities, FinishBatchTick
+    bool BeginBatchTick();
+    std::size_t BatchRows() const;
+    messages::AIRole Role() const;
+    bool ClampsFulfillment() const;
+    double MinPrice() const;
+    void LoadBatch(decision::RoleBatch& batch, std::size_t first_row) const;
+    void ResolveBatch(decision::RoleBatch& batch, std::size_t first_row);
+    void FinishBatchTick(const decision::RoleBatch& batch, std::size_t first_row);
 
     void PrintInventory();
     int GetIdeal(const std::string& name);
@@ -123,7 +253,7 @@ void AITrader::PrintInventory() {
   if (status == UNINITIALISED) {
     return;
   }
-  auto inv = view.Entities[id].Get<trader::Inventory>();
+  auto inv = OwnInventory();
   std::cout << "Printing inventory for trader #" << id << std::endl;
   if (!inv) {
     std::cout << "\tERR: Can't get inventory object!" << std::endl;
@@ -135,96 +265,170 @@ void AITrader::PrintInventory() {
   }
   std::cout << "\t" << "Money : " << inv->cash() << std::endl;
 }
-void AITrader::MakeCallbacks() {
-  using RegisterTraderCommand = market::RegisterCommandComponent::Commands::RegisterCommand;
-  using ReportBidResultCommand = trader::ReportOfferResultComponent::Commands::ReportBidOffer;
-  using ReportAskResultCommand = trader::ReportOfferResultComponent::Commands::ReportAskOffer;
-  using RequestShutdownCommand = market::RequestShutdownComponent::Commands::RequestShutdown;
-  using RequestProductionCommand = market::RequestProductionComponent::Commands::RequestProduction;
-  view.OnCommandResponse<RegisterTraderCommand>(
-      [&](const worker::CommandResponseOp<RegisterTraderCommand>& op) {
-        if (op.StatusCode != worker::StatusCode::kSuccess) {
-          status = TraderStatus::PENDING_DESTRUCTION;
-          RequestShutdown();
-          return;
-        }
-        id = op.Response->entity_id();
-        // Name accordingly
-        role = op.Response->assigned_role();
-        class_name = RoleToString(op.Response->assigned_role());
-        unique_name = class_name + std::to_string(id);
-        // Re-initialize logger
-        logger = std::make_unique<SpatialLogger>(logger->verbosity, unique_name, connection);
-        // Initialize commodities
-        commodity_beliefs = SetDefaultCommodityBeliefs(op.Response->assigned_role());
-        status = ACTIVE;
-      });
-  view.OnCommandRequest<ReportBidResultCommand>(
-      [&](const worker::CommandRequestOp<ReportBidResultCommand>& op) {
-        connection.SendCommandResponse<ReportBidResultCommand>(op.RequestId, {true});
-        auto commodity = op.Request.good();
-        auto bought_price = op.Request.avg_price();
-        auto quantity_traded= op.Request.quantity_bought();
-        // TODO: Mutex lock this?
-        for (int i = 0; i < quantity_traded; i++) {
-          observed_trading_range[commodity].push_back(bought_price);
-        }
-        while ((int) observed_trading_range[commodity].size() > internal_lookback) {
-          observed_trading_range[commodity].erase(observed_trading_range[commodity].begin());
-        }
+void AITrader::OnRegistered(const transport::CommandResponseOp<RegisterTraderCommand>& op) {
+  if (op.StatusCode != worker::StatusCode::kSuccess) {
+    status = TraderStatus::PENDING_DESTRUCTION;
+    RequestShutdown();
+    return;
+  }
+  // Initialize commodities
+  for (const auto& item : op.Response->listed_items()) {
+    market_ids[item.name()] = item.component_id();
+  }
+  commodity_beliefs = SetDefaultCommodityBeliefs(op.Response->assigned_role());
+  Activate(op.Response->entity_id(), op.Response->assigned_role(), op.Response->members());
+}
+// Everything registration sets up once market_ids and commodity_beliefs are known
+void AITrader::Activate(worker::EntityId entity_id, messages::AIRole assigned_role, std::int32_t cohort_members) {
+  id = static_cast<int>(entity_id);
+  // Name accordingly
+  role = assigned_role;
+  class_name = RoleToString(assigned_role);
+  unique_name = class_name + std::to_string(id);
+  members = std::max(1, cohort_members);
+  if (members > 1) {
+    unique_name += "x" + std::to_string(members);
+  }
+  // Re-initialize logger
+  logger = std::make_unique<SpatialLogger>(logger->verbosity, unique_name, connection);
+  slot_market_index.assign(commodity_beliefs.size(), -1);
+  trading_ranges.assign(commodity_beliefs.size(), TradingRange(internal_lookback));
+  holdings_moments.assign(members > 1 ? commodity_beliefs.size() : 0, {});
+  price_moments.assign(members > 1 ? commodity_beliefs.size() : 0, {});
+  for (std::size_t slot = 0; slot < commodity_beliefs.size(); slot++) {
+    auto market_id = market_ids.find(commodity_beliefs.beliefs[slot].name);
+    if (market_id != market_ids.end()) {
+      slot_market_index[slot] = MarketIndex(market_id->second);
+    }
+  }
+  status = ACTIVE;
+}
+trader::AITraderState AITrader::SaveState() const {
+  trader::AITraderState state{role, members, tracked_costs, ticks, {}, {}, {}, 0};
+  for (const auto& market_id : market_ids) {
+    state.market_ids()[market_id.first] = market_id.second;
+  }
+  for (std::size_t slot = 0; slot < commodity_beliefs.size(); slot++) {
+    const auto& belief = commodity_beliefs.beliefs[slot];
+    state.beliefs().emplace_back(belief.name, belief.ideal, belief.cost);
+    trader::TradingRangeState range{belief.name, {}};
+    trading_ranges[slot].ForEachRun([&](double price, int units) {
+      range.runs().emplace_back(price, units);
     });
-  view.OnCommandRequest<ReportAskResultCommand>(
-      [&](const worker::CommandRequestOp<ReportAskResultCommand>& op) {
-        connection.SendCommandResponse<ReportAskResultCommand>(op.RequestId, {true});
-        auto commodity = op.Request.good();
-        auto sold_price = op.Request.avg_price();
-        auto quantity_traded= op.Request.quantity_sold();
-        for (int i = 0; i < quantity_traded; i++) {
-          observed_trading_range[commodity].push_back(sold_price);
-        }
-
-        while ((int) observed_trading_range[commodity].size() > internal_lookback) {
-          observed_trading_range[commodity].erase(observed_trading_range[commodity].begin());
-        }
-      });
-  view.OnCommandResponse<RequestProductionCommand>(
-      [&](const worker::CommandResponseOp<RequestProductionCommand>& op) {
-        if (op.StatusCode == worker::StatusCode::kSuccess) {
-          if (op.Response->bankrupt()) {
-            logger->Log(Log::INFO, "Bankrupt after production on tick " + std::to_string(ticks) + ", requesting shutdown");
-            RequestShutdown();
-            return;
-          }
-          auto useful_production = op.Response->useful_production_result();
-          auto wasted_production = op.Response->overproduction_result();
-          auto consumption = op.Response->consumption_result();
-          UpdatePriceModelFromProduction(useful_production, wasted_production, consumption);
-        } else {
-          logger->Log(Log::ERROR, "RequestProductionCommand failed!");
-        }
-      });
+    state.trading_ranges().emplace_back(range);
+  }
+  return state;
+}
+// The cohort's holdings and price spreads are not carried over; they are re-estimated within a few ticks
+void AITrader::Restore(worker::EntityId entity_id, const trader::AITraderState& state) {
+  market_ids.clear();
+  for (const auto& market_id : state.market_ids()) {
+    market_ids[market_id.first] = market_id.second;
+  }
+  commodity_beliefs = {};
+  for (const auto& belief : state.beliefs()) {
+    commodity_beliefs.InitializeBelief(belief.name(), belief.ideal(), belief.cost());
+  }
+  Activate(entity_id, state.role(), state.members());
+  tracked_costs = state.tracked_costs();
+  ticks = static_cast<int>(state.ticks());
+  for (const auto& range : state.trading_ranges()) {
+    int slot = commodity_beliefs.Slot(range.commodity());
+    if (slot < 0 || slot >= (int) trading_ranges.size()) {
+      continue;
+    }
+    for (const auto& run : range.runs()) {
+      trading_ranges[slot].Add(run.price(), run.units());
+    }
+  }
+}
+trader::AITraderState AITrader::BeginHandOff() {
+  status = MIGRATING;
+  return SaveState();
+}
+void AITrader::EndHandOff(bool succeeded) {
+  if (status != MIGRATING) {
+    return;
+  }
+  status = succeeded ? MIGRATED : ACTIVE;
+  if (succeeded) {
+    logger->Log(Log::INFO, unique_name + std::string(" handed off to another worker."));
+  }
+}
+void AITrader::OnBidResult(const transport::CommandRequestOp<ReportBidResultCommand>& op) {
+  connection.SendCommandResponse<ReportBidResultCommand>(op.RequestId, {true});
+  auto commodity = op.Request.good();
+  auto bought_price = op.Request.avg_price();
+  auto quantity_traded= op.Request.quantity_bought();
+#if OUTERSPATIAL_HAS_COROUTINES
+  if (running) {
+    offer_results.Push({commodity, bought_price, quantity_traded});
+    return;
+  }
+#endif
+  ObserveTrade(commodity, bought_price, quantity_traded);
+}
+void AITrader::OnAskResult(const transport::CommandRequestOp<ReportAskResultCommand>& op) {
+  connection.SendCommandResponse<ReportAskResultCommand>(op.RequestId, {true});
+  auto commodity = op.Request.good();
+  auto sold_price = op.Request.avg_price();
+  auto quantity_traded= op.Request.quantity_sold();
+#if OUTERSPATIAL_HAS_COROUTINES
+  if (running) {
+    offer_results.Push({commodity, sold_price, quantity_traded});
+    return;
+  }
+#endif
+  ObserveTrade(commodity, sold_price, quantity_traded);
+}
+// Item changes and production results (production is run by the AH) arrive as events on our Inventory
+void AITrader::OnInventoryUpdate(const transport::ComponentUpdateOp<trader::Inventory>& op) {
+  inventory_ledger.Apply(id, op.Update);
+  for (const auto& report : op.Update.production_report()) {
+    OnProductionReport(report);
+    if (status == DESTROYED) {
+      return;
+    }
+  }
+}
+void AITrader::OnProductionReport(const messages::ProductionResponse& report) {
+    if (report.bankrupt()) {
+      logger->Log(Log::INFO, "Bankrupt after production on tick " + std::to_string(ticks) + ", requesting shutdown");
+      RequestShutdown();
+      return;
+    }
+    auto useful_production = report.useful_production_result();
+    auto wasted_production = report.overproduction_result();
+    auto consumption = report.consumption_result();
+    UpdatePriceModelFromProduction(useful_production, wasted_production, consumption);
 }
 void AITrader::UpdatePriceModelFromProduction(worker::Map<std::basic_string<char>, int>& useful_production,
                                               worker::Map<std::basic_string<char>, int>& overproduction,
                                               worker::Map<std::basic_string<char>, int>& consumption) {
+    // A cohort's report is for all its members; costs are tracked for the average one
     //For everything consumed, track_costs incremented by personal value
     for (auto& item : consumption) {
-      tracked_costs += item.second*QueryCost(item.first);
+      tracked_costs += item.second*QueryCost(item.first) / members;
     }
     //For everything produced, split the tracked costs across and set to zero
     int quantity = 0;
     for (auto& item : useful_production) {
       quantity += item.second;
     }
-    tracked_costs = std::max(QueryMoney() / 50, tracked_costs);
+    tracked_costs = std::max(QueryMoney() / members / 50, tracked_costs);
     tracked_costs = std::max(MIN_COST, tracked_costs); //the richer you are, the greedier you get (the higher your minimum cost becomes)
-    double unit_price = tracked_costs /  quantity;
+    double unit_price = tracked_costs / (static_cast<double>(quantity) / members);
     for (auto& item : useful_production) {
-      commodity_beliefs.UpdateCostFromProduction(item.first, item.second, unit_price);
+      int produced = (item.second + members - 1) / members;
+      commodity_beliefs.UpdateCostFromProduction(item.first, produced, unit_price);
+      int slot = commodity_beliefs.Slot(item.first);
+      if (members > 1 && slot >= 0 && produced > 0 && std::isfinite(unit_price)) {
+        price_moments[slot].Add(unit_price, COHORT_SMOOTHING);
+      }
     }
     //For OVERPRODUCED items, drop the perceived value of the good (encourage selling it off)
     for (auto& item : overproduction) {
-      commodity_beliefs.commodity_beliefs[item.first].cost *= std::pow(1.3, -1*item.second);
+      commodity_beliefs.ScaleCost(item.first, std::pow(1.3, -1.0*item.second / members));
     }
 };
 
@@ -232,7 +436,7 @@ int AITrader::GetIdeal(const std::string& name) {
     return commodity_beliefs.GetIdeal(name);
 }
 int AITrader::Query(const std::string& name) {
-  auto inv = view.Entities[id].Get<trader::Inventory>();
+  auto inv = OwnInventory();
   if (!inv) {
     return 0;
   }
@@ -261,7 +465,7 @@ double AITrader::GetIdleTax() {
   return res->idle_tax();
 }
 double AITrader::QueryMoney() {
-  auto res =  view.Entities[id].Get<trader::Inventory>();
+  auto res =  OwnInventory();
   if (!res) {
     logger->Log(Log::ERROR, "Failed to get cash from Inventory!");
     return 0;
@@ -269,7 +473,7 @@ double AITrader::QueryMoney() {
   return res->cash();
 }
 double AITrader::QuerySpace() {
-  auto inv = view.Entities[id].Get<trader::Inventory>();
+  auto inv = OwnInventory();
   if (!inv) {
     // TODO: Report error instead of failing silently & misleadingly
     return 0;
@@ -281,7 +485,7 @@ double AITrader::QuerySpace() {
   return inv->capacity() - used_space;
 }
 double AITrader::QueryUnitSize(const std::string& commodity) {
-  auto inv = view.Entities[id].Get<trader::Inventory>();
+  auto inv = OwnInventory();
   if (!inv) {
     // TODO: Report error instead of failing silently & misleadingly
     return 0;
@@ -293,145 +497,262 @@ double AITrader::QueryUnitSize(const std::string& commodity) {
 }
 
 void AITrader::SendAskOffer(AskOffer& offer) {
-  messages::AskOffer msg = {id,
-                            offer.commodity,
-                            offer.expiry_ms,
-                            offer.quantity,
-                            offer.unit_price};
-  using MakeAskOffer = market::MakeOfferCommandComponent::Commands::MakeAskOffer;
-  logger->Log(Log::INFO, "Making offer: " + ToString(msg));
-  connection.SendCommandRequest<MakeAskOffer>(auction_house_id, msg, {});
+  for (const auto& tier : CohortTiers(offer.commodity, offer.quantity, offer.unit_price, true)) {
+    if (route_offer_response && !pacing.CanSend()) {
+      deferred_offers++;
+      continue;
+    }
+    messages::AskOffer msg = {id,
+                              offer.commodity,
+                              offer.expiry_ms,
+                              tier.quantity,
+                              tier.price};
+    using MakeAskOffer = market::MakeOfferCommandComponent::Commands::MakeAskOffer;
+    logger->Log(Log::INFO, "Making offer: " + ToString(msg));
+    offers_this_tick++;
+    PaceOffer(connection.SendCommandRequest<MakeAskOffer>(auction_house_id, msg, {OfferTimeoutMs()}).Id);
+  }
 }
 void AITrader::SendBidOffer(BidOffer& offer) {
-  messages::BidOffer msg = {id,
-                            offer.commodity,
-                            offer.expiry_ms,
-                            offer.quantity,
-                            offer.unit_price};
-  using MakeBidOffer = market::MakeOfferCommandComponent::Commands::MakeBidOffer;
-  logger->Log(Log::INFO, "Making offer: " + ToString(msg));
-  connection.SendCommandRequest<MakeBidOffer>(auction_house_id, msg, {});
-}
-void AITrader::GenerateOffers(const std::string& commodity) {
-    int surplus = QuerySurplus(commodity);
+  for (const auto& tier : CohortTiers(offer.commodity, offer.quantity, offer.unit_price, false)) {
+    if (route_offer_response && !pacing.CanSend()) {
+      deferred_offers++;
+      continue;
+    }
+    messages::BidOffer msg = {id,
+                              offer.commodity,
+                              offer.expiry_ms,
+                              tier.quantity,
+                              tier.price};
+    using MakeBidOffer = market::MakeOfferCommandComponent::Commands::MakeBidOffer;
+    logger->Log(Log::INFO, "Making offer: " + ToString(msg));
+    offers_this_tick++;
+    PaceOffer(connection.SendCommandRequest<MakeBidOffer>(auction_house_id, msg, {OfferTimeoutMs()}).Id);
+  }
+}
+void AITrader::PaceOffer(std::uint32_t request_id) {
+  if (route_offer_response) {
+    pacing.Sent(request_id);
+    route_offer_response(request_id);
+  }
+}
+void AITrader::RouteOfferResponses(std::function<void(std::uint32_t)> route) {
+  route_offer_response = std::move(route);
+}
+void AITrader::OnOfferResponse(std::uint32_t request_id, worker::StatusCode status) {
+  // An offer the AH turned down was still answered; only timeouts and delivery failures mean overload
+  bool answered = status == worker::StatusCode::kSuccess || status == worker::StatusCode::kApplicationError;
+  if (!pacing.OnResponse(request_id, answered)) {
+    return;
+  }
+  if (!answered) {
+    logger->Log(Log::DEBUG, "Offer unanswered; pacing window now " + std::to_string(pacing.Window()) +
+                ", slowdown " + std::to_string(pacing.Slowdown()));
+  }
+}
+// The average member's offer, as the offers the whole cohort makes (just the offer itself for a
+// single trader). Members whose holdings sit further from ideal than the average want more than it
+// does, so the quantity is the expected surplus or shortage over the spread of holdings rather than
+// the average's; and members' prices differ as their beliefs do, so it is split across price tiers.
+const std::vector<cohort::Tier>& AITrader::CohortTiers(const std::string& commodity, int quantity, double unit_price, bool ask) {
+  tiers.clear();
+  int slot = commodity_beliefs.Slot(commodity);
+  if (members <= 1 || slot < 0 || slot >= (int) holdings_moments.size()) {
+    tiers.push_back({quantity, unit_price});
+    return tiers;
+  }
+  double held = snapshot.quantity[slot];
+  double ideal = snapshot.ideal[slot];
+  double spread = holdings_moments[slot].StdDev();
+  double average_gap = ask ? held - ideal : ideal - held;
+  double expected_gap = ask ? cohort::ExpectedExcess(held, spread, ideal) : cohort::ExpectedShortfall(held, spread, ideal);
+  double scale = (average_gap >= 1) ? expected_gap / average_gap : 1;
+  double total = std::round(quantity * scale * members);
+  // never more than the pool holds (asks) or has room for (bids)
+  if (ask) {
+    total = std::min(total, static_cast<double>(Query(commodity)));
+  } else if (snapshot.unit_size[slot] > 0) {
+    total = std::min(total, std::floor(snapshot.free_space * members / snapshot.unit_size[slot]));
+  }
+
+  const auto& prices = price_moments[slot];
+  double relative_sd = (prices.seeded && prices.mean > 0) ? prices.StdDev() / prices.mean : 0;
+  cohort::SplitTiers(static_cast<std::int32_t>(total), unit_price, std::min(relative_sd, MAX_COHORT_PRICE_SPREAD), tiers);
+  for (auto& tier : tiers) {
+    if (!ask) {
+      tier.price = std::min(snapshot.cash, tier.price); // the average member's cash
+    }
+    tier.price = std::max(MIN_PRICE, tier.price);
+  }
+  return tiers;
+}
+void AITrader::TakeSnapshot() {
+  snapshot.Reset(commodity_beliefs.size());
+  auto inv = OwnInventory();
+  if (!inv) {
+    return;
+  }
+  snapshot.cash = inv->cash();
+  double used_space = 0;
+  for (const auto& item : inv->inv()) {
+    used_space += item.second.size()*item.second.quantity();
+    int slot = commodity_beliefs.Slot(item.first);
+    if (slot >= 0) {
+      snapshot.quantity[slot] = item.second.quantity();
+      snapshot.unit_size[slot] = item.second.size();
+    }
+  }
+  snapshot.free_space = inv->capacity() - used_space;
+
+  auto entity = view.Entities.find(id);
+  if (entity != view.Entities.end()) {
+    auto buildings = entity->second.Get<trader::AIBuildings>();
+    if (buildings) {
+      snapshot.idle_tax = buildings->idle_tax();
+    } else {
+      logger->Log(Log::ERROR, "Failed to get Idle Tax from AIBuildings!");
+    }
+  }
+
+  auto ah = view.Entities.find(auction_house_id);
+  if (ah != view.Entities.end()) {
+    auto markets = ah->second.Get<market::MarketSnapshot>();
+    if (markets) {
+      const auto& listings = markets->listings();
+      for (std::size_t slot = 0; slot < slot_market_index.size(); slot++) {
+        int index = slot_market_index[slot];
+        if (index >= 0 && index < (int) listings.size()) {
+          snapshot.has_price[slot] = 1;
+          snapshot.recent_price[slot] = listings[index].price_info().recent_price();
+        }
+      }
+    }
+  }
+
+  for (std::size_t slot = 0; slot < commodity_beliefs.size(); slot++) {
+    snapshot.ideal[slot] = commodity_beliefs.beliefs[slot].ideal;
+    snapshot.cost[slot] = commodity_beliefs.beliefs[slot].cost;
+  }
+  if (members > 1) {
+    // From here on the snapshot is the average member's
+    for (std::size_t slot = 0; slot < commodity_beliefs.size(); slot++) {
+      holdings_moments[slot].Add(static_cast<double>(snapshot.quantity[slot]) / members, COHORT_SMOOTHING);
+      snapshot.quantity[slot] /= members;
+    }
+    snapshot.cash /= members;
+    snapshot.free_space /= members;
+  }
+  snapshot.valid = true;
+}
+void AITrader::GenerateOffers(std::size_t slot) {
+    const std::string& commodity = commodity_beliefs.beliefs[slot].name;
+    int quantity_held = snapshot.quantity[slot];
+    int ideal = snapshot.ideal[slot];
+    int surplus = decision::SaleQuantity(quantity_held, ideal);
     if (surplus >= 1) {
-        auto offer = CreateAsk(commodity, 1);
+        auto offer = CreateAsk(slot, 1);
         if (offer.quantity > 0) {
             SendAskOffer(offer);
         }
     }
 
-    int shortage = QueryShortage(commodity);
-    double space = QuerySpace();
-    double unit_size = QueryUnitSize(commodity);
+    int shortage = std::max(0, ideal - quantity_held);
+    double space = snapshot.free_space;
+    double unit_size = snapshot.unit_size[slot];
 
 
-    double fulfillment;
-    if (class_name == "refiner" || class_name == "blacksmith") {
-        fulfillment = Query(commodity) / (0.001 + GetIdeal(commodity));
-        fulfillment = std::max(0.5, fulfillment);
-    } else {
-        fulfillment = Query(commodity) / (0.001 + GetIdeal(commodity));
-    }
+    double fulfillment = decision::Fulfillment(quantity_held, ideal, ClampsFulfillment());
 
     if (fulfillment < 1 && space >= unit_size) {
-        int max_limit = (shortage*unit_size <= space) ? shortage : (int) space/shortage;
+        int max_limit = decision::BidMaxLimit(shortage, space, unit_size);
         if (max_limit > 0)
         {
-            int min_limit = ( Query(commodity) == 0) ? 1 : 0;
+            int min_limit = (quantity_held == 0) ? 1 : 0;
             logger->Log(Log::DEBUG, "Considering bid for "+commodity + std::string(" - Current shortage = ") + std::to_string(shortage));
 
-            double desperation = 1;
-            double days_savings = QueryMoney() / GetIdleTax();
-            desperation *= ( 5 /(days_savings*days_savings)) + 1;
-            desperation *= 1 - (0.4*(fulfillment - 0.5))/(1 + 0.4*std::abs(fulfillment-0.5));
-            auto offer = CreateBid(commodity, min_limit, max_limit, desperation);
+            double desperation = decision::Desperation(snapshot.cash, snapshot.idle_tax, fulfillment);
+            auto offer = CreateBid(slot, min_limit, max_limit, desperation);
             if (offer.quantity > 0) {
                 SendBidOffer(offer);
             }
         }
     }
 }
-BidOffer AITrader::CreateBid(const std::string& commodity, int min_limit, int max_limit, double desperation) {
+BidOffer AITrader::CreateBid(std::size_t slot, int min_limit, int max_limit, double desperation) {
+    const std::string& commodity = commodity_beliefs.beliefs[slot].name;
     double fair_bid_price;
-    auto price_info = ToPriceInfo(view, auction_house_id, commodity);
-    if (!price_info) {
+    if (!snapshot.has_price[slot]) {
         // quantity 0 BidOffers are never sent
         // (Yes this is hacky)
         return BidOffer(id, commodity, 0, -1, 0);
     }
-    fair_bid_price = price_info->recent_price();
-    //scale between price based on need
-    double max_price = QueryMoney();
-    double min_price = MIN_PRICE;
-    double bid_price = fair_bid_price *desperation;
-    bid_price = std::max(std::min(max_price, bid_price), min_price);
+    fair_bid_price = snapshot.recent_price[slot];
+    //scale between price based on need, between MIN_PRICE and all our cash
+    double bid_price = decision::BidPrice(fair_bid_price, desperation, snapshot.cash, MIN_PRICE);
 
-    int ideal = DetermineBuyQuantity(commodity, bid_price);
+    int ideal = DetermineBuyQuantity(slot, bid_price);
     int quantity = std::max(std::min(ideal, max_limit), min_limit);
 
     //set to expire just before next tick
-    std::uint64_t expiry_ms = to_unix_timestamp_ms(std::chrono::system_clock::now()) + TICK_TIME_MS;
+    std::uint64_t expiry_ms = clock.NowMs() + TICK_TIME_MS;
     return BidOffer(id, commodity, quantity, bid_price, expiry_ms);
 }
-AskOffer AITrader::CreateAsk(const std::string& commodity, int min_limit) {
+AskOffer AITrader::CreateAsk(std::size_t slot, int min_limit) {
+    const std::string& commodity = commodity_beliefs.beliefs[slot].name;
     //AI agents offer a fair ask price - costs + 15% profit
     double market_price;
     double ask_price;
-    auto price_info = ToPriceInfo(view, auction_house_id, commodity);
-    if (!price_info) {
+    if (!snapshot.has_price[slot]) {
       // quantity 0 AskOffers are never sent
       // (Yes this is hacky)
       return AskOffer(id, commodity, 0, -1, 0);
     }
-    market_price = price_info->recent_price();
-    double fair_price = QueryCost(commodity) * 1.15;
+    market_price = snapshot.recent_price[slot];
+    double fair_price = snapshot.cost[slot] * 1.15;
 
     std::uniform_real_distribution<> random_price(fair_price, market_price);
     ask_price = random_price(rng_gen);
     ask_price = std::max(MIN_PRICE, ask_price);
-    int quantity = DetermineSaleQuantity(commodity);
+    int quantity = DetermineSaleQuantity(slot);
     //can't sell less than limit
     quantity = quantity < min_limit ? min_limit : quantity;
 
     //set to expire just before next tick
-    std::uint64_t expiry_ms = to_unix_timestamp_ms(std::chrono::system_clock::now()) + TICK_TIME_MS;
+    std::uint64_t expiry_ms = clock.NowMs() + TICK_TIME_MS;
     return AskOffer(id, commodity, quantity, ask_price, expiry_ms);
 }
 
-int AITrader::DetermineBuyQuantity(const std::string& commodity, double avg_price) {
-    std::pair<double, double> range = ObserveTradingRange(commodity, internal_lookback);
+int AITrader::DetermineBuyQuantity(std::size_t slot, double avg_price) {
+    TradingRange& trading_range = trading_ranges[slot];
+    std::pair<double, double> range = trading_range.Range();
     if (range.first == 0 && range.second == 0) {
         //uninitialised range
         logger->Log(Log::WARN, "Tried to make bid with unitialised trading range");
         // initialize and retry with 0 and current_price * 2
-        observed_trading_range[commodity].push_back(0);
-        observed_trading_range[commodity].push_back(commodity_beliefs.GetCost(commodity)*2);
-        range = ObserveTradingRange(commodity, internal_lookback);
+        trading_range.Add(0, 1);
+        trading_range.Add(snapshot.cost[slot]*2, 1);
+        range = trading_range.Range();
     }
-    double favorability = PositionInRange(avg_price, range.first, range.second);
-    favorability = 1 - favorability; //do 1 - favorability to see how close we are to the low end
-    double amount_to_buy = favorability * QueryShortage(commodity);//double
-
-    return std::ceil(amount_to_buy);
+    return decision::BuyQuantity(avg_price, range.first, range.second,
+                                 std::max(0, snapshot.ideal[slot] - snapshot.quantity[slot]));
 }
-int AITrader::DetermineSaleQuantity(const std::string& commodity) {
-    return QuerySurplus(commodity); //Sell all surplus
+int AITrader::DetermineSaleQuantity(std::size_t slot) {
+    return decision::SaleQuantity(snapshot.quantity[slot], snapshot.ideal[slot]);
 }
 
-std::pair<double, double> AITrader::ObserveTradingRange(const std::string& commodity, int window) {
-    if (observed_trading_range.count(commodity) < 1 || observed_trading_range[commodity].empty()) {
-        return {0,0};
+void AITrader::ObserveTrade(const std::string& commodity, double price, int quantity) {
+    int slot = commodity_beliefs.Slot(commodity);
+    if (slot < 0 || slot >= (int) trading_ranges.size()) {
+        return; // not a commodity we make offers for
     }
-    double min_observed = observed_trading_range[commodity][0];
-    double max_observed = observed_trading_range[commodity][0];
-    window = std::min(window, (int) observed_trading_range[commodity].size());
-
-    for (int i = 0; i < window; i++) {
-        min_observed = std::min(min_observed, observed_trading_range[commodity][i]);
-        max_observed = std::max(max_observed, observed_trading_range[commodity][i]);
+    if (members > 1) {
+      // The range covers the last internal_lookback units the average member traded
+      quantity = (quantity + members - 1) / members;
+      if (quantity > 0) {
+        price_moments[slot].Add(price, COHORT_SMOOTHING);
+      }
     }
-    return {min_observed, max_observed};
+    trading_ranges[slot].Add(price, quantity);
 }
 
 // Misc
@@ -442,91 +763,195 @@ void AITrader::RequestShutdown() {
     logger->Log(Log::INFO, unique_name+std::string(" destroyed."));
 }
 
-void AITrader::Tick() {
-    using ProductionCommand = market::RequestProductionComponent::Commands::RequestProduction;
-    using std::chrono::milliseconds;
-    using std::chrono::duration;
-    using std::chrono::duration_cast;
-    //Stagger starts
-    std::this_thread::sleep_for(std::chrono::milliseconds{std::uniform_int_distribution<>(0, TICK_TIME_MS)(rng_gen)});
-    view.Process(connection.GetOpList(100));
-    logger->Log(Log::INFO, "Beginning tickloop");
-    while (status > UNINITIALISED) {
-        view.Process(connection.GetOpList(100));
-        auto t1 = std::chrono::high_resolution_clock::now();
-        if (status == ACTIVE) {
-            connection.SendCommandRequest<ProductionCommand>(auction_house_id, {id}, {});
-            for (const auto &commodity : commodity_beliefs.commodity_beliefs) {
-                GenerateOffers(commodity.first);
-            }
-        }
-        if (QueryMoney() <= 0) {
-          RequestShutdown();
-        }
-        if (status == ACTIVE) {
-            ticks++;
-        }
-        std::chrono::duration<double, std::milli> elapsed_ms = std::chrono::high_resolution_clock::now() - t1;
-        int elapsed = elapsed_ms.count();
-        if (elapsed < TICK_TIME_MS) {
-            std::this_thread::sleep_for(std::chrono::milliseconds{TICK_TIME_MS - elapsed});
-        } else {
-            logger->Log(Log::WARN, "Trader thread overran on tick "+ std::to_string(ticks) + ": took " + std::to_string(elapsed) +"/" + std::to_string(TICK_TIME_MS) + "ms )");
-        }
-    }
-}
-
 void AITrader::TickOnce() {
     if (status == DESTROYED) return;
-    using ProductionCommand = market::RequestProductionComponent::Commands::RequestProduction;
-    view.Process(connection.GetOpList(100));
     if (status != ACTIVE) {
         logger->Log(Log::DEBUG, "Not yet active, aborting tick");
         return;
     }
 
     if (status == ACTIVE) {
-      connection.SendCommandRequest<ProductionCommand>(auction_house_id, {id}, {});
-      for (const auto& commodity : commodity_beliefs.commodity_beliefs) {
-        GenerateOffers(commodity.first);
+      if (route_offer_response && !pacing.TakeRound()) {
+        return; // backing off
+      }
+      offers_this_tick = 0;
+      deferred_offers = 0;
+      TakeSnapshot();
+      if (snapshot.valid) {
+        for (std::size_t slot = 0; slot < commodity_beliefs.size(); slot++) {
+          GenerateOffers(slot);
+        }
       }
       ticks++;
     }
 }
 
+messages::RegisterRequest AITrader::MakeRegisterRequest() const {
+  return {messages::AgentType::AI_TRADER, role, members};
+}
+
+#if OUTERSPATIAL_HAS_COROUTINES
+coro::Task AITrader::Run(coro::CommandRouter& commands, Executor& executor, int tick_interval_ms,
+                         std::function<void(AITrader&)> on_active) {
+  if (status != ACTIVE) { // a restored trader is already registered
+    OnRegistered(co_await commands.Send<RegisterTraderCommand>(auction_house_id, MakeRegisterRequest(), {REGISTER_TIMEOUT_MS}));
+    if (status != ACTIVE) {
+      co_return;
+    }
+  }
+  on_active(*this);
+  running = true;
+  while (status == ACTIVE || status == MIGRATING) {
+    std::int64_t next_round_ms = clock.NowMs() + tick_interval_ms;
+    TickOnce();
+    // Observe results as they come in, until the next round of offers is due
+    for (;;) {
+      std::int64_t remaining_ms = next_round_ms - clock.NowMs();
+      auto result = co_await offer_results.Next(executor, static_cast<int>(remaining_ms));
+      if (!result) {
+        break;
+      }
+      ObserveTrade(result->commodity, result->price, result->quantity);
+    }
+  }
+  running = false;
+}
+#endif
+
+bool AITrader::Idle() const {
+  return status == ACTIVE && snapshot.valid && offers_this_tick == 0 && deferred_offers == 0;
+}
+
+// Returns false if the trader has nothing to add to the batch this tick
+bool AITrader::BeginBatchTick() {
+    if (status == DESTROYED) return false;
+    if (status != ACTIVE) {
+        logger->Log(Log::DEBUG, "Not yet active, aborting tick");
+        return false;
+    }
+    if (route_offer_response && !pacing.TakeRound()) {
+      return false; // backing off
+    }
+    offers_this_tick = 0;
+    deferred_offers = 0;
+    TakeSnapshot();
+    if (!snapshot.valid) {
+      ticks++;
+      return false;
+    }
+    return true;
+}
+std::size_t AITrader::BatchRows() const {
+  return commodity_beliefs.size();
+}
+messages::AIRole AITrader::Role() const {
+  return role;
+}
+bool AITrader::ClampsFulfillment() const {
+  return role == messages::AIRole::REFINER || role == messages::AIRole::BLACKSMITH;
+}
+double AITrader::MinPrice() const {
+  return MIN_PRICE;
+}
+void AITrader::LoadBatch(decision::RoleBatch& batch, std::size_t first_row) const {
+  for (std::size_t slot = 0; slot < commodity_beliefs.size(); slot++) {
+    std::size_t row = first_row + slot;
+    batch.quantity[row] = snapshot.quantity[slot];
+    batch.ideal[row] = snapshot.ideal[slot];
+    batch.unit_size[row] = snapshot.unit_size[slot];
+    batch.free_space[row] = snapshot.free_space;
+    batch.cash[row] = snapshot.cash;
+    batch.idle_tax[row] = snapshot.idle_tax;
+    batch.has_price[row] = snapshot.has_price[slot] ? 1 : 0;
+    batch.recent_price[row] = snapshot.recent_price[slot];
+  }
+}
+// The per-trader part of the batch: ask prices come from this trader's own RNG, drawn in slot order
+// as CreateAsk would, and bids read this trader's trading ranges
+void AITrader::ResolveBatch(decision::RoleBatch& batch, std::size_t first_row) {
+  for (std::size_t slot = 0; slot < commodity_beliefs.size(); slot++) {
+    std::size_t row = first_row + slot;
+    if (batch.wants_ask[row]) {
+      double fair_price = snapshot.cost[slot] * 1.15;
+      std::uniform_real_distribution<> random_price(fair_price, snapshot.recent_price[slot]);
+      batch.ask_price[row] = std::max(MIN_PRICE, random_price(rng_gen));
+    }
+    if (batch.wants_bid[row]) {
+      TradingRange& trading_range = trading_ranges[slot];
+      std::pair<double, double> range = trading_range.Range();
+      if (range.first == 0 && range.second == 0) {
+        logger->Log(Log::WARN, "Tried to make bid with unitialised trading range");
+        trading_range.Add(0, 1);
+        trading_range.Add(snapshot.cost[slot]*2, 1);
+        range = trading_range.Range();
+      }
+      batch.range_min[row] = range.first;
+      batch.range_max[row] = range.second;
+    }
+  }
+}
+void AITrader::FinishBatchTick(const decision::RoleBatch& batch, std::size_t first_row) {
+  std::uint64_t expiry_ms = clock.NowMs() + TICK_TIME_MS;
+  for (std::size_t slot = 0; slot < commodity_beliefs.size(); slot++) {
+    std::size_t row = first_row + slot;
+    const std::string& commodity = commodity_beliefs.beliefs[slot].name;
+    if (batch.wants_ask[row]) {
+      AskOffer offer(id, commodity, batch.ask_quantity[row], batch.ask_price[row], expiry_ms);
+      SendAskOffer(offer);
+    }
+    if (batch.wants_bid[row]) {
+      BidOffer offer(id, commodity, batch.bid_quantity[row], batch.bid_price[row], expiry_ms);
+      SendBidOffer(offer);
+    }
+  }
+  ticks++;
+}
+
+std::optional<market::PriceInfo> AITrader::MarketPriceInfo(const std::string& commodity) {
+  auto market_id = market_ids.find(commodity);
+  if (market_id == market_ids.end()) {
+    return {};
+  }
+  return ToPriceInfo(view, auction_house_id, market_id->second);
+}
+double AITrader::InitialPrice(const std::string& commodity) {
+  auto price_info = MarketPriceInfo(commodity);
+  return price_info ? price_info->recent_price() : MIN_COST;
+}
+
 CommodityBeliefs AITrader::SetDefaultCommodityBeliefs(messages::AIRole assigned_role) {
   CommodityBeliefs initial_beliefs = {};
   switch (assigned_role) {
   case messages::AIRole::FARMER:
-    initial_beliefs.InitializeBelief("food", 0, view.Entities[auction_house_id].Get<market::FoodMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("tools", 2, view.Entities[auction_house_id].Get<market::ToolsMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("wood", 6, view.Entities[auction_house_id].Get<market::WoodMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("fertilizer", 6, view.Entities[auction_house_id].Get<market::FertilizerMarket>()->listing().price_info().recent_price());
+    initial_beliefs.InitializeBelief("food", 0, InitialPrice("food"));
+    initial_beliefs.InitializeBelief("tools", 2, InitialPrice("tools"));
+    initial_beliefs.InitializeBelief("wood", 6, InitialPrice("wood"));
+    initial_beliefs.InitializeBelief("fertilizer", 6, InitialPrice("fertilizer"));
     break;
   case messages::AIRole::WOODCUTTER:
-    initial_beliefs.InitializeBelief("food", 6, view.Entities[auction_house_id].Get<market::FoodMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("tools", 2, view.Entities[auction_house_id].Get<market::ToolsMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("wood", 0, view.Entities[auction_house_id].Get<market::WoodMarket>()->listing().price_info().recent_price());
+    initial_beliefs.InitializeBelief("food", 6, InitialPrice("food"));
+    initial_beliefs.InitializeBelief("tools", 2, InitialPrice("tools"));
+    initial_beliefs.InitializeBelief("wood", 0, InitialPrice("wood"));
     break;
   case messages::AIRole::COMPOSTER:
-    initial_beliefs.InitializeBelief("food", 6, view.Entities[auction_house_id].Get<market::FoodMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("fertilizer", 0, view.Entities[auction_house_id].Get<market::FertilizerMarket>()->listing().price_info().recent_price());
+    initial_beliefs.InitializeBelief("food", 6, InitialPrice("food"));
+    initial_beliefs.InitializeBelief("fertilizer", 0, InitialPrice("fertilizer"));
     break;
   case messages::AIRole::MINER:
-    initial_beliefs.InitializeBelief("food", 6, view.Entities[auction_house_id].Get<market::FoodMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("tools", 2, view.Entities[auction_house_id].Get<market::ToolsMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("ore", 0, view.Entities[auction_house_id].Get<market::OreMarket>()->listing().price_info().recent_price());
+    initial_beliefs.InitializeBelief("food", 6, InitialPrice("food"));
+    initial_beliefs.InitializeBelief("tools", 2, InitialPrice("tools"));
+    initial_beliefs.InitializeBelief("ore", 0, InitialPrice("ore"));
     break;
   case messages::AIRole::REFINER:
-    initial_beliefs.InitializeBelief("food", 6, view.Entities[auction_house_id].Get<market::FoodMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("tools", 2, view.Entities[auction_house_id].Get<market::ToolsMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("metal", 0, view.Entities[auction_house_id].Get<market::MetalMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("ore", 10, view.Entities[auction_house_id].Get<market::OreMarket>()->listing().price_info().recent_price());
+    initial_beliefs.InitializeBelief("food", 6, InitialPrice("food"));
+    initial_beliefs.InitializeBelief("tools", 2, InitialPrice("tools"));
+    initial_beliefs.InitializeBelief("metal", 0, InitialPrice("metal"));
+    initial_beliefs.InitializeBelief("ore", 10, InitialPrice("ore"));
     break;
   case messages::AIRole::BLACKSMITH:
-    initial_beliefs.InitializeBelief("food", 6, view.Entities[auction_house_id].Get<market::FoodMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("tools", 0, view.Entities[auction_house_id].Get<market::ToolsMarket>()->listing().price_info().recent_price());
-    initial_beliefs.InitializeBelief("metal", 10, view.Entities[auction_house_id].Get<market::MetalMarket>()->listing().price_info().recent_price());
+    initial_beliefs.InitializeBelief("food", 6, InitialPrice("food"));
+    initial_beliefs.InitializeBelief("tools", 0, InitialPrice("tools"));
+    initial_beliefs.InitializeBelief("metal", 10, InitialPrice("metal"));
     break;
   default:
     break; //noop
@@ -0,0 +1,80 @@
+#ifndef OUTERSPATIALENGINE_COHORT_H
+#define OUTERSPATIALENGINE_COHORT_H
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Distributional state for an AITrader that stands for a cohort of statistically similar traders.
+// The cohort's offer arithmetic runs once for its average member; what is kept here turns that one
+// member's offer into the cohort's: its quantity resized by how holdings are spread across members,
+// and its price spread across tiers by how far members' beliefs differ.
+namespace cohort {
+  // Exponentially weighted mean and variance of one quantity
+  struct Moments {
+    double mean = 0;
+    double variance = 0;
+    bool seeded = false;
+
+    void Add(double value, double alpha) {
+      if (!seeded) {
+        mean = value;
+        variance = 0;
+        seeded = true;
+        return;
+      }
+      double diff = value - mean;
+      double increment = alpha*diff;
+      mean += increment;
+      variance = (1 - alpha)*(variance + diff*increment);
+    }
+    double StdDev() const {
+      return std::sqrt(variance);
+    }
+  };
+
+  // E[max(0, X - threshold)] for X ~ N(mean, sd^2)
+  inline double ExpectedExcess(double mean, double sd, double threshold) {
+    if (sd <= 0) {
+      return std::max(0.0, mean - threshold);
+    }
+    double z = (mean - threshold)/sd;
+    double density = 0.3989422804014327*std::exp(-0.5*z*z); // 1/sqrt(2 pi)
+    double above = 0.5*std::erfc(-z/std::sqrt(2.0)); // P(X > threshold)
+    return (mean - threshold)*above + sd*density;
+  }
+  // E[max(0, threshold - X)] for X ~ N(mean, sd^2)
+  inline double ExpectedShortfall(double mean, double sd, double threshold) {
+    return ExpectedExcess(-mean, sd, -threshold);
+  }
+
+  struct Tier {
+    std::int32_t quantity;
+    double price;
+  };
+
+  // Mean of a standard normal within each quarter of its distribution, lowest first
+  constexpr std::array<double, 4> TIER_Z = {-1.2711, -0.3246, 0.3246, 1.2711};
+
+  // Splits `total` units into up to TIER_Z.size() equal-quantity tiers priced across
+  // N(price, (price*relative_sd)^2). With no spread (or too few units) it is one offer at `price`.
+  inline void SplitTiers(std::int32_t total, double price, double relative_sd, std::vector<Tier>& tiers) {
+    tiers.clear();
+    if (total <= 0) {
+      return;
+    }
+    auto count = static_cast<std::int32_t>(TIER_Z.size());
+    if (relative_sd <= 0 || total < count) {
+      tiers.push_back({total, price});
+      return;
+    }
+    for (std::int32_t i = 0; i < count; i++) {
+      std::int32_t quantity = total/count + (i < total % count ? 1 : 0);
+      tiers.push_back({quantity, price*(1 + TIER_Z[i]*relative_sd)});
+    }
+  }
+}
+
+#endif  // OUTERSPATIALENGINE_COHORT_H
@@ -0,0 +1,115 @@
+#undef NDEBUG  // the checks are asserts
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "cohort.h"
+
+// Moments against the exponentially weighted mean and variance computed from scratch over the whole
+// history, and the normal-distribution helpers against numerical integration
+
+bool Near(double a, double b, double tolerance) {
+  return std::abs(a - b) <= tolerance*std::max(1.0, std::abs(b));
+}
+
+// The first value carries the weight (1 - alpha)^(n - 1), and value i after it alpha*(1 - alpha)^(n - 1 - i)
+void NaiveMoments(const std::vector<double>& values, double alpha, double& mean, double& variance) {
+  std::size_t n = values.size();
+  std::vector<double> weights(n);
+  for (std::size_t i = 0; i < n; i++) {
+    weights[i] = (i == 0 ? 1 : alpha)*std::pow(1 - alpha, static_cast<double>(n - 1 - i));
+  }
+  mean = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    mean += weights[i]*values[i];
+  }
+  variance = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    variance += weights[i]*(values[i] - mean)*(values[i] - mean);
+  }
+}
+
+void TestMoments() {
+  std::mt19937 gen(1);
+  for (double alpha : {0.05, 0.2, 0.5, 1.0}) {
+    std::normal_distribution<double> value(40, 7);
+    cohort::Moments moments;
+    std::vector<double> history;
+    for (int i = 0; i < 300; i++) {
+      double x = (i % 50 == 49) ? value(gen)*3 : value(gen); // with the odd outlier
+      moments.Add(x, alpha);
+      history.push_back(x);
+      double mean, variance;
+      NaiveMoments(history, alpha, mean, variance);
+      assert(moments.seeded);
+      assert(Near(moments.mean, mean, 1e-9));
+      assert(Near(moments.variance, variance, 1e-7));
+      assert(moments.variance >= 0 && Near(moments.StdDev(), std::sqrt(variance), 1e-7));
+    }
+  }
+}
+
+// E[max(0, X - threshold)] by the midpoint rule over mean +- 12 sd
+double NaiveExpectedExcess(double mean, double sd, double threshold) {
+  const int STEPS = 200000;
+  double from = mean - 12*sd, to = mean + 12*sd;
+  double step = (to - from)/STEPS;
+  double total = 0;
+  for (int i = 0; i < STEPS; i++) {
+    double x = from + (i + 0.5)*step;
+    double density = std::exp(-0.5*((x - mean)/sd)*((x - mean)/sd))/(sd*std::sqrt(2*3.141592653589793));
+    total += std::max(0.0, x - threshold)*density*step;
+  }
+  return total;
+}
+
+void TestExpectations() {
+  for (double sd : {0.5, 3.0, 20.0}) {
+    for (double threshold : {-10.0, 0.0, 4.0, 10.0, 35.0}) {
+      double mean = 5;
+      double excess = NaiveExpectedExcess(mean, sd, threshold);
+      assert(Near(cohort::ExpectedExcess(mean, sd, threshold), excess, 1e-6));
+      // X - t = max(0, X - t) - max(0, t - X)
+      assert(Near(cohort::ExpectedExcess(mean, sd, threshold) - cohort::ExpectedShortfall(mean, sd, threshold),
+                  mean - threshold, 1e-9));
+    }
+  }
+  assert(cohort::ExpectedExcess(5, 0, 3) == 2 && cohort::ExpectedExcess(5, 0, 8) == 0);
+  assert(cohort::ExpectedShortfall(5, 0, 8) == 3);
+}
+
+void TestSplitTiers() {
+  std::vector<cohort::Tier> tiers;
+  cohort::SplitTiers(0, 10, 0.1, tiers);
+  assert(tiers.empty());
+  cohort::SplitTiers(3, 10, 0.1, tiers);
+  assert(tiers.size() == 1 && tiers[0].quantity == 3 && tiers[0].price == 10);
+  cohort::SplitTiers(100, 10, 0, tiers);
+  assert(tiers.size() == 1 && tiers[0].quantity == 100);
+  for (std::int32_t total = 4; total < 200; total++) {
+    cohort::SplitTiers(total, 10, 0.2, tiers);
+    assert(tiers.size() == cohort::TIER_Z.size());
+    std::int32_t quantity = 0;
+    double price_sum = 0;
+    for (std::size_t i = 0; i < tiers.size(); i++) {
+      quantity += tiers[i].quantity;
+      price_sum += tiers[i].price;
+      assert(tiers[i].quantity >= total/4 && tiers[i].quantity <= total/4 + 1);
+      assert(i == 0 || tiers[i].price > tiers[i - 1].price);
+    }
+    assert(quantity == total);
+    assert(Near(price_sum/tiers.size(), 10, 1e-12)); // tiers centred on the price
+  }
+}
+
+int main() {
+  TestMoments();
+  TestExpectations();
+  TestSplitTiers();
+  std::cout << "cohort_test passed" << std::endl;
+  return 0;
+}
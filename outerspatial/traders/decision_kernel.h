@@ -0,0 +1,214 @@
+#ifndef OUTERSPATIALENGINE_DECISION_KERNEL_H
+#define OUTERSPATIALENGINE_DECISION_KERNEL_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Rows never overlap, so the compiler can vectorise the passes without runtime aliasing checks
+#if defined(__clang__)
+#define OUTERSPATIAL_IVDEP _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define OUTERSPATIAL_IVDEP _Pragma("GCC ivdep")
+#else
+#define OUTERSPATIAL_IVDEP
+#endif
+
+// AITrader's offer arithmetic (GenerateOffers, CreateBid, CreateAsk, DetermineBuyQuantity) for a whole
+// batch of same-role traders at once. Each row is one (trader, commodity) pair, and each input is a
+// contiguous array, so the passes below are plain branch-free loops the compiler can vectorise
+// (GCC needs -fno-trapping-math for the rounding calls). The arithmetic is kept identical to the
+// scalar path, so both give the same offers.
+//
+// A batch tick is three passes:
+//  1. DecidePrices: which rows want to ask or bid, bid prices, and bid quantity limits
+//  2. (per trader, in slot order) ask prices drawn from the trader's own RNG, and trading ranges
+//  3. DecideQuantities: bid quantities from the trading ranges
+namespace decision {
+  struct RoleBatch {
+    // Inputs, from each trader's TraderSnapshot
+    std::vector<std::int32_t> quantity;
+    std::vector<std::int32_t> ideal;
+    std::vector<double> unit_size;
+    std::vector<double> free_space;
+    std::vector<double> cash;
+    std::vector<double> idle_tax;
+    std::vector<std::uint8_t> has_price;
+    std::vector<double> recent_price;
+
+    // Pass 1 outputs
+    std::vector<std::uint8_t> wants_ask;
+    std::vector<std::int32_t> ask_quantity;
+    std::vector<std::uint8_t> wants_bid;
+    std::vector<std::int32_t> shortage;
+    std::vector<std::int32_t> max_limit;
+    std::vector<std::int32_t> min_limit;
+    std::vector<double> bid_price;
+
+    // Pass 2 outputs
+    std::vector<double> ask_price;
+    std::vector<double> range_min;
+    std::vector<double> range_max;
+
+    // Pass 3 outputs
+    std::vector<std::int32_t> bid_quantity;
+
+    std::size_t size() const {
+      return quantity.size();
+    }
+
+    // Keeps capacity, so a batch reused across ticks stops allocating once it has grown
+    void Resize(std::size_t rows) {
+      for (auto* column : {&quantity, &ideal, &ask_quantity, &shortage, &max_limit, &min_limit, &bid_quantity}) {
+        column->assign(rows, 0);
+      }
+      for (auto* column : {&unit_size, &free_space, &cash, &idle_tax, &recent_price, &bid_price, &ask_price,
+                           &range_min}) {
+        column->assign(rows, 0);
+      }
+      range_max.assign(rows, 1); // keeps rows without a bid finite in DecideQuantities
+      for (auto* column : {&has_price, &wants_ask, &wants_bid}) {
+        column->assign(rows, 0);
+      }
+    }
+  };
+
+  // The same arithmetic for one (trader, commodity) pair, as AITrader's GenerateOffers, CreateBid,
+  // CreateAsk and DetermineBuyQuantity use it outside a batch. decision_kernel_test.cc checks the
+  // passes below against these.
+  inline std::int32_t SaleQuantity(std::int32_t quantity, std::int32_t ideal) {
+    return std::max(0, quantity - ideal); // sell all surplus
+  }
+  inline double Fulfillment(std::int32_t quantity, std::int32_t ideal, bool clamp_fulfillment) {
+    double fulfillment = quantity / (0.001 + ideal);
+    return clamp_fulfillment ? std::max(0.5, fulfillment) : fulfillment;
+  }
+  // The most a bid can be for; only called with a shortage
+  inline std::int32_t BidMaxLimit(std::int32_t shortage, double space, double unit_size) {
+    return (shortage*unit_size <= space) ? shortage : (int) space/shortage;
+  }
+  inline double Desperation(double cash, double idle_tax, double fulfillment) {
+    double desperation = 1;
+    double days_savings = cash / idle_tax;
+    desperation *= ( 5 /(days_savings*days_savings)) + 1;
+    desperation *= 1 - (0.4*(fulfillment - 0.5))/(1 + 0.4*std::abs(fulfillment-0.5));
+    return desperation;
+  }
+  inline double BidPrice(double fair_price, double desperation, double cash, double min_price) {
+    double bid_price = fair_price *desperation;
+    return std::max(std::min(cash, bid_price), min_price);
+  }
+  inline double PositionInRange(double value, double min, double max) {
+    value -= min;
+    max -= min;
+    min = 0;
+    value = (value / (max - min));
+
+    if (value < 0) { value = 0; }
+    if (value > 1) { value = 1; }
+
+    return value;
+  }
+  inline std::int32_t BuyQuantity(double bid_price, double range_min, double range_max, std::int32_t shortage) {
+    double favorability = PositionInRange(bid_price, range_min, range_max);
+    favorability = 1 - favorability; //do 1 - favorability to see how close we are to the low end
+    double amount_to_buy = favorability * shortage;
+    return static_cast<std::int32_t>(std::ceil(amount_to_buy));
+  }
+
+  // clamp_fulfillment: refiners and blacksmiths never count themselves as less than half supplied.
+  // min_price: the lowest price a bid goes out at (AITrader::MinPrice)
+  inline void DecidePrices(RoleBatch& batch, bool clamp_fulfillment, double min_price) {
+    const std::size_t rows = batch.size();
+    const std::int32_t* quantity = batch.quantity.data();
+    const std::int32_t* ideal = batch.ideal.data();
+    const double* unit_size = batch.unit_size.data();
+    const double* free_space = batch.free_space.data();
+    const double* cash = batch.cash.data();
+    const double* idle_tax = batch.idle_tax.data();
+    const std::uint8_t* has_price = batch.has_price.data();
+    const double* recent_price = batch.recent_price.data();
+    std::uint8_t* wants_ask = batch.wants_ask.data();
+    std::int32_t* ask_quantity = batch.ask_quantity.data();
+    std::uint8_t* wants_bid = batch.wants_bid.data();
+    std::int32_t* shortages = batch.shortage.data();
+    std::int32_t* max_limits = batch.max_limit.data();
+    std::int32_t* min_limits = batch.min_limit.data();
+    double* bid_prices = batch.bid_price.data();
+    // fulfillment is never negative, so a floor of -1 leaves it as is
+    const double min_fulfillment = clamp_fulfillment ? 0.5 : -1.0;
+
+    // Asks: sell all surplus
+    OUTERSPATIAL_IVDEP
+    for (std::size_t i = 0; i < rows; i++) {
+      std::int32_t surplus = std::max(0, quantity[i] - ideal[i]);
+      ask_quantity[i] = surplus;
+      wants_ask[i] = (surplus >= 1) & (has_price[i] != 0);
+    }
+
+    // Bids: how much is wanted, and how much the trader will pay for it
+    OUTERSPATIAL_IVDEP
+    for (std::size_t i = 0; i < rows; i++) {
+      std::int32_t shortage = std::max(0, ideal[i] - quantity[i]);
+      double fulfillment = quantity[i] / (0.001 + ideal[i]);
+      fulfillment = std::max(min_fulfillment, fulfillment);
+      double space = free_space[i];
+      double unit = unit_size[i];
+
+      // The scalar path's (shortage*unit_size <= space) ? shortage : (int) space/shortage.
+      // There is no SIMD integer division, but for 32-bit operands the truncated double quotient is
+      // exactly the integer one; and both sides are whole numbers, so blending them is exact too.
+      double divisor = (shortage > 0) ? shortage : 1; // only used when shortage > 0
+      double space_limit = std::trunc(std::trunc(space) / divisor);
+      double fits = (shortage*unit <= space) ? 1.0 : 0.0;
+      std::int32_t max_limit = static_cast<std::int32_t>(space_limit + fits*(shortage - space_limit));
+      bool considered = (fulfillment < 1) & (space >= unit) & (max_limit > 0);
+
+      double desperation = 1;
+      double days_savings = cash[i] / idle_tax[i];
+      desperation *= ( 5 /(days_savings*days_savings)) + 1;
+      desperation *= 1 - (0.4*(fulfillment - 0.5))/(1 + 0.4*std::abs(fulfillment-0.5));
+      double bid_price = recent_price[i] *desperation;
+      bid_price = std::max(std::min(cash[i], bid_price), min_price);
+
+      shortages[i] = shortage;
+      max_limits[i] = max_limit;
+      min_limits[i] = (quantity[i] == 0) ? 1 : 0;
+      bid_prices[i] = bid_price;
+      wants_bid[i] = considered & (has_price[i] != 0);
+    }
+  }
+
+  inline void DecideQuantities(RoleBatch& batch) {
+    const std::size_t rows = batch.size();
+    const double* bid_price = batch.bid_price.data();
+    const double* range_min = batch.range_min.data();
+    const double* range_max = batch.range_max.data();
+    const std::int32_t* shortage = batch.shortage.data();
+    const std::int32_t* max_limit = batch.max_limit.data();
+    const std::int32_t* min_limit = batch.min_limit.data();
+    std::uint8_t* wants_bid = batch.wants_bid.data();
+    std::int32_t* bid_quantity = batch.bid_quantity.data();
+
+    OUTERSPATIAL_IVDEP
+    for (std::size_t i = 0; i < rows; i++) {
+      // PositionInRange, then DetermineBuyQuantity
+      double value = bid_price[i] - range_min[i];
+      double max = range_max[i] - range_min[i];
+      value = value / max;
+      value = std::min(std::max(value, 0.0), 1.0);
+      double favorability = 1 - value;
+      double amount_to_buy = favorability * shortage[i];
+      std::int32_t wanted = static_cast<std::int32_t>(std::ceil(amount_to_buy)); // ignored unless wants_bid
+
+      std::int32_t quantity = std::max(std::min(wanted, max_limit[i]), min_limit[i]);
+      bid_quantity[i] = quantity;
+      wants_bid[i] = (wants_bid[i] != 0) & (quantity > 0);
+    }
+  }
+}
+
+#undef OUTERSPATIAL_IVDEP
+
+#endif  // OUTERSPATIALENGINE_DECISION_KERNEL_H
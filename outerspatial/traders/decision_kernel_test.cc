@@ -0,0 +1,120 @@
+#undef NDEBUG  // the checks are asserts
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <random>
+
+#include "decision_kernel.h"
+
+// DecidePrices and DecideQuantities against the scalar path row by row: the offers GenerateOffers
+// would make through CreateAsk and CreateBid, on random snapshots
+
+struct ScalarOffers {
+  bool asks = false;
+  std::int32_t ask_quantity = 0;
+  bool bids = false;
+  double bid_price = 0;
+  std::int32_t bid_quantity = 0;
+};
+
+// GenerateOffers for one row. range_min/range_max: the trading range CreateBid would see.
+ScalarOffers GenerateOffers(const decision::RoleBatch& batch, std::size_t i, bool clamp_fulfillment, double min_price,
+                            double range_min, double range_max) {
+  ScalarOffers offers;
+  std::int32_t quantity_held = batch.quantity[i];
+  std::int32_t ideal = batch.ideal[i];
+  // CreateAsk: no offer without a market price
+  std::int32_t surplus = decision::SaleQuantity(quantity_held, ideal);
+  if (surplus >= 1 && batch.has_price[i]) {
+    offers.asks = true;
+    offers.ask_quantity = std::max(decision::SaleQuantity(quantity_held, ideal), 1);
+  }
+
+  std::int32_t shortage = std::max(0, ideal - quantity_held);
+  double space = batch.free_space[i];
+  double unit_size = batch.unit_size[i];
+  double fulfillment = decision::Fulfillment(quantity_held, ideal, clamp_fulfillment);
+  if (fulfillment < 1 && space >= unit_size) {
+    std::int32_t max_limit = decision::BidMaxLimit(shortage, space, unit_size);
+    if (max_limit > 0 && batch.has_price[i]) {
+      std::int32_t min_limit = (quantity_held == 0) ? 1 : 0;
+      double desperation = decision::Desperation(batch.cash[i], batch.idle_tax[i], fulfillment);
+      // CreateBid
+      double bid_price = decision::BidPrice(batch.recent_price[i], desperation, batch.cash[i], min_price);
+      std::int32_t wanted = decision::BuyQuantity(bid_price, range_min, range_max, shortage);
+      std::int32_t quantity = std::max(std::min(wanted, max_limit), min_limit);
+      if (quantity > 0) { // quantity 0 offers are never sent
+        offers.bids = true;
+        offers.bid_price = bid_price;
+        offers.bid_quantity = quantity;
+      }
+    }
+  }
+  return offers;
+}
+
+void Compare(unsigned seed, bool clamp_fulfillment, double min_price) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<std::int32_t> amount(0, 40);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  const double UNIT_SIZES[] = {0.1, 0.5, 1, 2};
+
+  const std::size_t ROWS = 4096;
+  decision::RoleBatch batch;
+  batch.Resize(ROWS);
+  for (std::size_t i = 0; i < ROWS; i++) {
+    batch.quantity[i] = amount(gen);
+    batch.ideal[i] = amount(gen);
+    batch.unit_size[i] = UNIT_SIZES[gen() % 4];
+    batch.free_space[i] = uniform(gen) < 0.1 ? 0 : uniform(gen)*60;
+    // including traders poorer than the minimum price, or in debt
+    batch.cash[i] = uniform(gen) < 0.1 ? -uniform(gen)*5 : uniform(gen)*(uniform(gen) < 0.2 ? 0.2 : 200);
+    batch.idle_tax[i] = 0.1 + uniform(gen)*5;
+    batch.has_price[i] = uniform(gen) < 0.9 ? 1 : 0;
+    batch.recent_price[i] = uniform(gen) < 0.1 ? uniform(gen)*0.1 : uniform(gen)*20;
+  }
+  std::vector<double> range_min(ROWS), range_max(ROWS);
+  for (std::size_t i = 0; i < ROWS; i++) {
+    range_min[i] = uniform(gen)*10;
+    range_max[i] = range_min[i] + 0.01 + uniform(gen)*10;
+  }
+
+  decision::DecidePrices(batch, clamp_fulfillment, min_price);
+  for (std::size_t i = 0; i < ROWS; i++) {
+    if (batch.wants_bid[i]) { // as ResolveBatch fills in the trader's range
+      batch.range_min[i] = range_min[i];
+      batch.range_max[i] = range_max[i];
+    }
+  }
+  decision::DecideQuantities(batch);
+
+  std::size_t asks = 0, bids = 0;
+  for (std::size_t i = 0; i < ROWS; i++) {
+    ScalarOffers expected = GenerateOffers(batch, i, clamp_fulfillment, min_price, range_min[i], range_max[i]);
+    assert((batch.wants_ask[i] != 0) == expected.asks);
+    if (expected.asks) {
+      assert(batch.ask_quantity[i] == expected.ask_quantity);
+      asks++;
+    }
+    assert((batch.wants_bid[i] != 0) == expected.bids);
+    if (expected.bids) {
+      assert(batch.bid_price[i] == expected.bid_price);
+      assert(batch.bid_price[i] >= min_price);
+      assert(batch.bid_quantity[i] == expected.bid_quantity);
+      bids++;
+    }
+  }
+  // the random snapshots reach both kinds of offer
+  assert(asks > ROWS/8 && bids > ROWS/8);
+}
+
+int main() {
+  for (unsigned seed = 1; seed <= 20; seed++) {
+    Compare(seed, seed % 2 == 0, 0.10);
+  }
+  Compare(21, false, 1.5);
+  Compare(22, true, 0.01);
+  std::cout << "decision_kernel_test passed" << std::endl;
+  return 0;
+}
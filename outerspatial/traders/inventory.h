@@ -8,6 +8,7 @@
 #include <map>
 #include <vector>
 #include <algorithm>
+#include <cmath>
 #include <unordered_set>
 
 // Cut-down version of Inventory with only metadata
@@ -24,52 +25,90 @@ public:
     , cost(original_cost) {}
 };
 
+// Beliefs are kept densely, in name order; Slot() maps a name to its index in `beliefs`
 class CommodityBeliefs {
 public:
-  std::map<std::string, CommodityBelief> commodity_beliefs;
+  std::vector<CommodityBelief> beliefs;
   CommodityBeliefs() = default;
 
   void InitializeBelief(std::string commodity, int ideal_quantity = 0, double original_cost = 0.0) {
     CommodityBelief belief(commodity, ideal_quantity, original_cost);
-    commodity_beliefs[commodity] = belief;
+    auto existing = slots.find(commodity);
+    if (existing != slots.end()) {
+      beliefs[existing->second] = belief;
+      return;
+    }
+    auto position = std::lower_bound(beliefs.begin(), beliefs.end(), commodity,
+                                     [](const CommodityBelief& b, const std::string& name) { return b.name < name; });
+    beliefs.insert(position, belief);
+    slots.clear();
+    for (std::size_t i = 0; i < beliefs.size(); i++) {
+      slots[beliefs[i].name] = i;
+    }
+  }
+
+  // Index into `beliefs`, or -1 if there is no belief for this commodity
+  int Slot(const std::string& name) const {
+    auto slot = slots.find(name);
+    return (slot == slots.end()) ? -1 : static_cast<int>(slot->second);
+  }
+
+  std::size_t size() const {
+    return beliefs.size();
   }
 
   void UpdateCostFromProduction(const std::string& name, int quantity, double unit_price) {
-    if (commodity_beliefs.count(name) != 1) {
+    int slot = Slot(name);
+    if (slot < 0) {
       return;// no entry found
     }
     double alpha = 0.2;
     if (unit_price > 0) {
-      if (commodity_beliefs[name].cost == 0.0) {
-        commodity_beliefs[name].cost = unit_price;
+      auto& belief = beliefs[slot];
+      if (belief.cost == 0.0) {
+        belief.cost = unit_price;
       }
-      for (int i = 0; i < quantity; i++) {
-        // update EWMA
-        commodity_beliefs[name].cost = alpha*unit_price + (1 - alpha)*commodity_beliefs[name].cost;
+      // `quantity` EWMA steps towards the same price, in closed form
+      if (quantity > 0) {
+        belief.cost = unit_price + std::pow(1 - alpha, quantity)*(belief.cost - unit_price);
       }
     }
   }
 
+  void ScaleCost(const std::string& name, double factor) {
+    int slot = Slot(name);
+    if (slot < 0) {
+      return;// no entry found
+    }
+    beliefs[slot].cost *= factor;
+  }
+
   double GetCost(const std::string& name) const {
-    if (commodity_beliefs.count(name) != 1) {
+    int slot = Slot(name);
+    if (slot < 0) {
       return 0;// no entry found
     }
-    return commodity_beliefs.at(name).cost;
+    return beliefs[slot].cost;
   }
 
   int GetIdeal(const std::string& name) const {
-    if (commodity_beliefs.count(name) != 1) {
+    int slot = Slot(name);
+    if (slot < 0) {
       return 0;// no entry found
     }
-    return commodity_beliefs.at(name).ideal;
+    return beliefs[slot].ideal;
   }
 
   void SetIdeal(const std::string& name, int new_ideal) {
-    if (commodity_beliefs.count(name) != 1) {
+    int slot = Slot(name);
+    if (slot < 0) {
       return;// no entry found
     }
-    commodity_beliefs[name].ideal = new_ideal;
+    beliefs[slot].ideal = new_ideal;
   }
+
+private:
+  std::map<std::string, std::size_t> slots;
 };
 
 class InventoryItem {
@@ -0,0 +1,76 @@
+#ifndef OUTERSPATIALENGINE_PRICE_WATCH_H
+#define OUTERSPATIALENGINE_PRICE_WATCH_H
+
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+// Price-band subscriptions: a subscriber asks to hear when a market's price falls to `low` or rises
+// to `high`. Thresholds are kept sorted per market, so a price update only touches the subscribers
+// it actually wakes. A woken subscriber loses all its subscriptions and must subscribe again.
+template<typename Key>
+class PriceWatch {
+public:
+  void Subscribe(int market, double low, double high, Key key) {
+    Bands& bands = markets[market];
+    subscriptions[key].push_back({market, bands.below.emplace(low, key), bands.above.emplace(high, key)});
+  }
+
+  // Returns false if `key` had no subscriptions
+  bool Unsubscribe(Key key) {
+    auto subscribed = subscriptions.find(key);
+    if (subscribed == subscriptions.end()) {
+      return false;
+    }
+    for (const auto& subscription : subscribed->second) {
+      Bands& bands = markets[subscription.market];
+      bands.below.erase(subscription.below);
+      bands.above.erase(subscription.above);
+    }
+    subscriptions.erase(subscribed);
+    return true;
+  }
+
+  // Unsubscribes, then calls wake(key) for, everyone whose band `price` has left
+  template<typename Wake>
+  void Update(int market, double price, Wake wake) {
+    auto bands = markets.find(market);
+    if (bands == markets.end()) {
+      return;
+    }
+    woken.clear();
+    for (auto low = bands->second.below.begin(); low != bands->second.below.end() && price <= low->first; ++low) {
+      woken.push_back(low->second);
+    }
+    for (auto high = bands->second.above.begin(); high != bands->second.above.end() && price >= high->first; ++high) {
+      woken.push_back(high->second);
+    }
+    for (auto key : woken) {
+      if (Unsubscribe(key)) {
+        wake(key);
+      }
+    }
+  }
+
+  std::size_t size() const {
+    return subscriptions.size();
+  }
+
+private:
+  struct Bands {
+    std::multimap<double, Key, std::greater<double>> below; // highest threshold first
+    std::multimap<double, Key> above; // lowest threshold first
+  };
+  struct Subscription {
+    int market;
+    typename std::multimap<double, Key, std::greater<double>>::iterator below;
+    typename std::multimap<double, Key>::iterator above;
+  };
+
+  std::map<int, Bands> markets;
+  std::unordered_map<Key, std::vector<Subscription>> subscriptions;
+  std::vector<Key> woken;
+};
+
+#endif  // OUTERSPATIALENGINE_PRICE_WATCH_H
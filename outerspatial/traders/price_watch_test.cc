@@ -0,0 +1,76 @@
+#undef NDEBUG  // the checks are asserts
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <set>
+#include <vector>
+
+#include "price_watch.h"
+
+// PriceWatch against a flat list of every subscription, scanned in full on each update
+
+struct NaiveSubscription {
+  int market;
+  double low;
+  double high;
+  int key;
+};
+
+void Unsubscribe(std::vector<NaiveSubscription>& naive, int key) {
+  naive.erase(std::remove_if(naive.begin(), naive.end(), [&](const NaiveSubscription& s) { return s.key == key; }),
+              naive.end());
+}
+
+std::size_t Subscribers(const std::vector<NaiveSubscription>& naive) {
+  std::set<int> keys;
+  for (const auto& subscription : naive) {
+    keys.insert(subscription.key);
+  }
+  return keys.size();
+}
+
+int main() {
+  std::mt19937 gen(1);
+  std::uniform_int_distribution<int> market(0, 3);
+  std::uniform_int_distribution<int> key(0, 40);
+  std::uniform_int_distribution<int> tick(0, 80);
+  PriceWatch<int> watch;
+  std::vector<NaiveSubscription> naive;
+  for (int step = 0; step < 20000; step++) {
+    int action = std::uniform_int_distribution<int>(0, 9)(gen);
+    if (action < 5) {
+      // Prices on a coarse grid, so updates often land exactly on a threshold
+      double a = tick(gen)*0.25;
+      double b = tick(gen)*0.25;
+      NaiveSubscription subscription{market(gen), std::min(a, b), std::max(a, b), key(gen)};
+      watch.Subscribe(subscription.market, subscription.low, subscription.high, subscription.key);
+      naive.push_back(subscription);
+    } else if (action < 6) {
+      int unsubscribed = key(gen);
+      bool had = std::any_of(naive.begin(), naive.end(), [&](const NaiveSubscription& s) { return s.key == unsubscribed; });
+      assert(watch.Unsubscribe(unsubscribed) == had);
+      Unsubscribe(naive, unsubscribed);
+    } else {
+      int updated = market(gen);
+      double price = tick(gen)*0.25;
+      std::set<int> expected;
+      for (const auto& subscription : naive) {
+        if (subscription.market == updated && (price <= subscription.low || price >= subscription.high)) {
+          expected.insert(subscription.key);
+        }
+      }
+      std::vector<int> woken;
+      watch.Update(updated, price, [&](int woken_key) { woken.push_back(woken_key); });
+      // Each key is woken once, however many of its bands the price left
+      assert(std::set<int>(woken.begin(), woken.end()).size() == woken.size());
+      assert(std::set<int>(woken.begin(), woken.end()) == expected);
+      for (int woken_key : expected) {
+        Unsubscribe(naive, woken_key);
+      }
+    }
+    assert(watch.size() == Subscribers(naive));
+  }
+  std::cout << "price_watch_test passed" << std::endl;
+  return 0;
+}
@@ -0,0 +1,441 @@
+#ifndef OUTERSPATIALENGINE_TRADER_HOST_H
+#define OUTERSPATIALENGINE_TRADER_HOST_H
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "AI_trader.h"
+#include "price_watch.h"
+#include "../common/executor.h"
+
+// Runs a population of AITraders over one shared connection and View.
+// The host owns the View's callbacks and hands each op to the trader it concerns: register responses
+// by request ID (the trader has no entity yet), everything else by entity ID. Traders that shut down
+// are retired and replaced within the same process.
+// Each trader ticks as its own task on the executor's main lane, jittered so the population's ticks
+// are spread across the interval rather than all landing at once.
+// In BATCHED mode the whole population instead ticks together in one task: traders are grouped by
+// role and each role's offers are worked out in one pass of the decision kernel (decision_kernel.h).
+// The offers are the same either way; batching trades the spread of ticks for fewer, tighter loops.
+// In EVENT_DRIVEN mode a trader ticks as in TICKED mode until a tick finds nothing to offer, and then
+// sleeps (no tick task at all) until an offer result arrives, its inventory changes, the price of
+// something it trades moves by WAKE_PRICE_MOVE, or MAX_IDLE_MS passes.
+// In COROUTINES mode (C++20 builds only) each trader runs as one coroutine (AITrader::Run) that
+// registers, offers and awaits its results in sequence.
+// In every mode, responses to traders' offers are routed back to them by request ID, so each trader can
+// pace itself (AITrader's AimdPacer) against how quickly the AH is answering.
+// In any mode, cohort_members > 1 makes every hosted trader a cohort standing for that many traders
+// (see AITrader), so `population` counts cohorts rather than traders.
+// Traders can move between hosts: when the AH asks for one of ours (RequestHandOff), its state goes to
+// the AH, which re-delegates it to another worker; that worker's host adopts it from its TraderState.
+// `population` moves with it, so neither host spawns or retires traders to make up the difference.
+class TraderHost {
+public:
+  enum Mode {
+    TICKED,
+    BATCHED,
+    EVENT_DRIVEN,
+#if OUTERSPATIAL_HAS_COROUTINES
+    COROUTINES,
+#endif
+  };
+
+  TraderHost(transport::Connection& connection, transport::View& view, Executor& executor, int auction_house_id,
+             std::size_t population, int tick_interval_ms, int tick_time_ms, Log::LogLevel verbosity = Log::WARN,
+             Mode mode = TICKED, std::int32_t cohort_members = 1, const SimClock& clock = SimClock::Wall())
+      : connection(connection)
+      , view(view)
+      , executor(executor)
+      , auction_house_id(auction_house_id)
+      , population(population)
+      , TICK_INTERVAL_MS(tick_interval_ms)
+      , TICK_TIME_MS(tick_time_ms)
+      , verbosity(verbosity)
+      , mode(mode)
+      , cohort_members(cohort_members)
+      , clock(clock) {
+    MakeCallbacks();
+    housekeeping = executor.Every(TICK_INTERVAL_MS, 0, [this] {
+      Retire();
+      Spawn();
+    });
+    if (mode == BATCHED) {
+      batch_tick = executor.Every(TICK_INTERVAL_MS, TICK_INTERVAL_MS/10, [this] { TickBatches(); });
+    }
+  }
+  ~TraderHost() {
+    executor.Cancel(housekeeping);
+    executor.Cancel(batch_tick);
+    for (auto& hosted : traders) {
+      executor.Cancel(hosted.tick);
+    }
+    for (const auto& state : wake_states) {
+      executor.Cancel(state.second.tick);
+      executor.Cancel(state.second.idle_timer);
+    }
+  }
+
+  std::size_t size() const {
+    return traders.size();
+  }
+  std::size_t active() const {
+    return by_entity.size();
+  }
+
+private:
+  using RegisterTraderCommand = AITrader::RegisterTraderCommand;
+  using ReportBidResultCommand = AITrader::ReportBidResultCommand;
+  using ReportAskResultCommand = AITrader::ReportAskResultCommand;
+  using MakeBidOfferCommand = market::MakeOfferCommandComponent::Commands::MakeBidOffer;
+  using MakeAskOfferCommand = market::MakeOfferCommandComponent::Commands::MakeAskOffer;
+  using HandOffCommand = market::HandOffCommandComponent::Commands::HandOffTrader;
+  using RequestHandOffCommand = trader::HandOffRequestComponent::Commands::RequestHandOff;
+
+  // New traders registered per tick, so a fresh host doesn't flood the AH with registrations
+  const std::size_t MAX_SPAWNS_PER_TICK = 64;
+  const std::uint32_t REGISTER_TIMEOUT_MS = 1000;
+  const std::uint32_t HAND_OFF_TIMEOUT_MS = 1000;
+  // EVENT_DRIVEN: sleeping traders wake at least this often, and when a price moves this far
+  const int MAX_IDLE_MS = 2000;
+  const double WAKE_PRICE_MOVE = 0.10;
+
+  transport::Connection& connection;
+  transport::View& view;
+  Executor& executor;
+  int auction_house_id;
+  std::size_t population;
+  int TICK_INTERVAL_MS; // how often each trader ticks
+  int TICK_TIME_MS; // the traders' own notion of a tick, used for history lookbacks
+  Log::LogLevel verbosity;
+  Mode mode;
+  std::int32_t cohort_members;
+  const SimClock& clock; // the simulation's; handed to every trader
+
+  struct HostedTrader {
+    std::unique_ptr<AITrader> trader;
+    Executor::TaskId tick; // 0 unless TICKED
+#if OUTERSPATIAL_HAS_COROUTINES
+    coro::Task flow; // COROUTINES only; declared after the trader so it is destroyed first
+#endif
+  };
+#if OUTERSPATIAL_HAS_COROUTINES
+  coro::CommandRouter commands = coro::CommandRouter(connection, view); // must outlive the flows in `traders`
+#endif
+  Executor::TaskId housekeeping;
+  Executor::TaskId batch_tick = 0;
+  std::map<messages::AIRole, std::vector<AITrader*>> roles; // batch members, rebuilt every batch tick
+  decision::RoleBatch batch;
+  std::vector<HostedTrader> traders;
+  std::map<std::uint32_t, AITrader*> registering; // register request ID -> trader
+  std::unordered_map<std::uint32_t, AITrader*> offers_in_flight; // offer request ID -> trader
+  std::map<std::uint32_t, AITrader*> handing_off; // hand-off request ID -> trader
+  std::unordered_map<worker::EntityId, AITrader*> by_entity;
+
+  struct WakeState {
+    Executor::TaskId tick = 0; // while awake
+    Executor::TaskId idle_timer = 0; // while asleep
+    bool asleep = false;
+  };
+  std::unordered_map<AITrader*, WakeState> wake_states; // EVENT_DRIVEN only
+  PriceWatch<AITrader*> price_watch;
+
+  void Spawn() {
+    std::size_t spawns = std::min(population - std::min(population, traders.size()), MAX_SPAWNS_PER_TICK);
+    for (std::size_t i = 0; i < spawns; i++) {
+      AITrader* raw = Host(std::make_unique<AITrader>(connection, view, auction_house_id, messages::AIRole::NONE,
+                                                      TICK_TIME_MS, verbosity, cohort_members, clock));
+#if OUTERSPATIAL_HAS_COROUTINES
+      if (mode == COROUTINES) {
+        continue; // Run registers it
+      }
+#endif
+      auto request = connection.SendCommandRequest<RegisterTraderCommand>(auction_house_id, raw->MakeRegisterRequest(),
+                                                                           {REGISTER_TIMEOUT_MS});
+      registering[request.Id] = raw;
+    }
+  }
+
+  // Starts a trader ticking in the host's mode. A trader that isn't yet active ticks as a no-op.
+  AITrader* Host(std::unique_ptr<AITrader> trader) {
+    AITrader* raw = trader.get();
+    raw->RouteOfferResponses([this, raw](std::uint32_t request_id) { offers_in_flight[request_id] = raw; });
+#if OUTERSPATIAL_HAS_COROUTINES
+    if (mode == COROUTINES) {
+      auto on_active = [this](AITrader& active) { by_entity[active.id] = &active; };
+      traders.push_back({std::move(trader), 0, raw->Run(commands, executor, TICK_INTERVAL_MS, on_active)});
+      return raw;
+    }
+#endif
+    Executor::TaskId tick = 0;
+    if (mode == TICKED) {
+      tick = executor.Every(TICK_INTERVAL_MS, TICK_INTERVAL_MS/10, [raw] { raw->TickOnce(); });
+    } else if (mode == EVENT_DRIVEN) {
+      StartTicking(raw);
+    }
+    traders.push_back({std::move(trader), tick});
+    return raw;
+  }
+
+  void HandOff(AITrader* trader, worker::EntityId target_worker_entity_id) {
+    trader::HandOff hand_off{trader->id, target_worker_entity_id, trader->BeginHandOff()};
+    auto request = connection.SendCommandRequest<HandOffCommand>(auction_house_id, hand_off, {HAND_OFF_TIMEOUT_MS});
+    handing_off[request.Id] = trader;
+  }
+
+  // A trader handed off to this worker: its TraderState now holds what it had learned.
+  // The source sees the same TraderState update, possibly after its HandOffCommand response has already
+  // dropped the trader, so the state says which worker it went to.
+  void Adopt(worker::EntityId entity_id, const trader::AITraderState& state) {
+    if (state.role() == messages::AIRole::NONE || state.worker_entity_id() != connection.GetWorkerEntityId()
+        || Find(entity_id)) {
+      return; // never handed off, handed to another worker, or already ours
+    }
+    auto trader = std::make_unique<AITrader>(connection, view, auction_house_id, state.role(), TICK_TIME_MS,
+                                             verbosity, state.members(), clock);
+    trader->Restore(entity_id, state);
+    by_entity[entity_id] = Host(std::move(trader));
+    population++;
+  }
+
+  void Retire() {
+    auto destroyed = [](const HostedTrader& hosted) {
+      return hosted.trader->status == DESTROYED || hosted.trader->status == MIGRATED;
+    };
+#if OUTERSPATIAL_HAS_COROUTINES
+    for (auto& hosted : traders) {
+      if (mode == COROUTINES && hosted.flow.done() && !destroyed(hosted)) {
+        try {
+          hosted.flow.Check();
+        } catch (const std::exception& e) {
+          connection.SendLogMessage(worker::LogLevel::kError, "TraderHost", std::string("Trader failed: ") + e.what());
+        }
+        hosted.trader->RequestShutdown();
+      }
+    }
+#endif
+    bool any_destroyed = false;
+    for (auto& hosted : traders) {
+      if (destroyed(hosted)) {
+        any_destroyed = true;
+        by_entity.erase(hosted.trader->id);
+        executor.Cancel(hosted.tick);
+        ForgetWakeState(hosted.trader.get());
+#if OUTERSPATIAL_HAS_COROUTINES
+        hosted.flow = coro::Task(); // while the trader it refers to is still alive
+#endif
+      }
+    }
+    if (!any_destroyed) {
+      return;
+    }
+    // Responses to a retired trader's offers still arrive, and are dropped
+    auto gone = [](AITrader* trader) { return trader->status == DESTROYED || trader->status == MIGRATED; };
+    for (auto offer = offers_in_flight.begin(); offer != offers_in_flight.end();) {
+      offer = gone(offer->second) ? offers_in_flight.erase(offer) : std::next(offer);
+    }
+    for (auto hand_off = handing_off.begin(); hand_off != handing_off.end();) {
+      hand_off = gone(hand_off->second) ? handing_off.erase(hand_off) : std::next(hand_off);
+    }
+    traders.erase(std::remove_if(traders.begin(), traders.end(), destroyed), traders.end());
+  }
+
+  void StartTicking(AITrader* trader) {
+    WakeState& state = wake_states[trader];
+    state.asleep = false;
+    state.tick = executor.Every(TICK_INTERVAL_MS, TICK_INTERVAL_MS/10, [this, trader] { TickOrSleep(trader); });
+  }
+
+  void TickOrSleep(AITrader* trader) {
+    trader->TickOnce();
+    if (!trader->Idle()) {
+      return;
+    }
+    WakeState& state = wake_states[trader];
+    executor.Cancel(std::exchange(state.tick, 0));
+    state.asleep = true;
+    state.idle_timer = executor.After(MAX_IDLE_MS, [this, trader] {
+      wake_states[trader].idle_timer = 0;
+      Wake(trader);
+    });
+    trader->ForEachPrice([&](int market, double price) {
+      price_watch.Subscribe(market, price*(1 - WAKE_PRICE_MOVE), price*(1 + WAKE_PRICE_MOVE), trader);
+    });
+  }
+
+  // Ticks a sleeping trader straight away; it goes back to sleep if there is still nothing to do
+  void Wake(AITrader* trader) {
+    auto state = wake_states.find(trader);
+    if (state == wake_states.end() || !state->second.asleep) {
+      return;
+    }
+    executor.Cancel(std::exchange(state->second.idle_timer, 0));
+    price_watch.Unsubscribe(trader);
+    state->second.asleep = false;
+    TickOrSleep(trader);
+    if (!wake_states[trader].asleep) {
+      StartTicking(trader);
+    }
+  }
+
+  void ForgetWakeState(AITrader* trader) {
+    auto state = wake_states.find(trader);
+    if (state == wake_states.end()) {
+      return;
+    }
+    executor.Cancel(state->second.tick);
+    executor.Cancel(state->second.idle_timer);
+    price_watch.Unsubscribe(trader);
+    wake_states.erase(state);
+  }
+
+  void TickBatches() {
+    for (auto& members : roles) {
+      members.second.clear();
+    }
+    for (const auto& hosted : traders) {
+      AITrader* trader = hosted.trader.get();
+      if (trader->BeginBatchTick()) {
+        roles[trader->Role()].push_back(trader);
+      }
+    }
+    for (const auto& members : roles) {
+      if (members.second.empty()) {
+        continue;
+      }
+      std::size_t rows = 0;
+      for (auto trader : members.second) {
+        rows += trader->BatchRows();
+      }
+      batch.Resize(rows);
+      std::size_t row = 0;
+      for (auto trader : members.second) {
+        trader->LoadBatch(batch, row);
+        row += trader->BatchRows();
+      }
+      decision::DecidePrices(batch, members.second.front()->ClampsFulfillment(),
+                             members.second.front()->MinPrice());
+      row = 0;
+      for (auto trader : members.second) {
+        trader->ResolveBatch(batch, row);
+        row += trader->BatchRows();
+      }
+      decision::DecideQuantities(batch);
+      row = 0;
+      for (auto trader : members.second) {
+        trader->FinishBatchTick(batch, row);
+        row += trader->BatchRows();
+      }
+    }
+  }
+
+  template<typename T>
+  void RouteOfferResponse(const transport::CommandResponseOp<T>& op) {
+    auto offer = offers_in_flight.find(op.RequestId.Id);
+    if (offer == offers_in_flight.end()) {
+      return;
+    }
+    AITrader* trader = offer->second;
+    offers_in_flight.erase(offer);
+    trader->OnOfferResponse(op.RequestId.Id, op.StatusCode);
+  }
+
+  AITrader* Find(worker::EntityId entity_id) {
+    auto trader = by_entity.find(entity_id);
+    return (trader == by_entity.end()) ? nullptr : trader->second;
+  }
+
+  void MakeCallbacks() {
+    view.OnCommandResponse<RegisterTraderCommand>(
+        [&](const transport::CommandResponseOp<RegisterTraderCommand>& op) {
+          auto request = registering.find(op.RequestId.Id);
+          if (request == registering.end()) {
+            return;
+          }
+          AITrader* trader = request->second;
+          registering.erase(request);
+          trader->OnRegistered(op);
+          if (trader->status == ACTIVE) {
+            by_entity[trader->id] = trader;
+          }
+        });
+    view.OnCommandResponse<MakeBidOfferCommand>(
+        [&](const transport::CommandResponseOp<MakeBidOfferCommand>& op) { RouteOfferResponse(op); });
+    view.OnCommandResponse<MakeAskOfferCommand>(
+        [&](const transport::CommandResponseOp<MakeAskOfferCommand>& op) { RouteOfferResponse(op); });
+    view.OnCommandRequest<ReportBidResultCommand>(
+        [&](const transport::CommandRequestOp<ReportBidResultCommand>& op) {
+          if (auto trader = Find(op.EntityId)) {
+            trader->OnBidResult(op);
+            Wake(trader);
+          } else {
+            connection.SendCommandFailure<ReportBidResultCommand>(op.RequestId, "No such trader");
+          }
+        });
+    view.OnCommandRequest<ReportAskResultCommand>(
+        [&](const transport::CommandRequestOp<ReportAskResultCommand>& op) {
+          if (auto trader = Find(op.EntityId)) {
+            trader->OnAskResult(op);
+            Wake(trader);
+          } else {
+            connection.SendCommandFailure<ReportAskResultCommand>(op.RequestId, "No such trader");
+          }
+        });
+    view.OnComponentUpdate<trader::Inventory>(
+        [&](const transport::ComponentUpdateOp<trader::Inventory>& op) {
+          if (auto trader = Find(op.EntityId)) {
+            trader->OnInventoryUpdate(op);
+            Wake(trader);
+          }
+        });
+    view.OnCommandRequest<RequestHandOffCommand>(
+        [&](const transport::CommandRequestOp<RequestHandOffCommand>& op) {
+          auto trader = Find(op.EntityId);
+          if (!trader || trader->status != ACTIVE) {
+            connection.SendCommandFailure<RequestHandOffCommand>(op.RequestId, "No such trader");
+            return;
+          }
+          HandOff(trader, op.Request.target_worker_entity_id());
+          connection.SendCommandResponse<RequestHandOffCommand>(op.RequestId, {true});
+        });
+    view.OnCommandResponse<HandOffCommand>(
+        [&](const transport::CommandResponseOp<HandOffCommand>& op) {
+          auto request = handing_off.find(op.RequestId.Id);
+          if (request == handing_off.end()) {
+            return;
+          }
+          AITrader* trader = request->second;
+          handing_off.erase(request);
+          // On any failure the trader carries on here; the AH only re-delegates it once it has accepted
+          bool succeeded = op.StatusCode == worker::StatusCode::kSuccess;
+          trader->EndHandOff(succeeded);
+          if (succeeded) {
+            by_entity.erase(trader->id);
+            population -= std::min<std::size_t>(population, 1);
+          }
+        });
+    view.OnAddComponent<trader::TraderState>(
+        [&](const transport::AddComponentOp<trader::TraderState>& op) { Adopt(op.EntityId, op.Data.state()); });
+    view.OnComponentUpdate<trader::TraderState>(
+        [&](const transport::ComponentUpdateOp<trader::TraderState>& op) {
+          if (op.Update.state()) {
+            Adopt(op.EntityId, *op.Update.state());
+          }
+        });
+    view.OnComponentUpdate<market::MarketSnapshot>(
+        [&](const transport::ComponentUpdateOp<market::MarketSnapshot>& op) {
+          if (op.EntityId != auction_house_id || !op.Update.listings() || price_watch.size() == 0) {
+            return;
+          }
+          const auto& listings = *op.Update.listings();
+          for (std::size_t market = 0; market < listings.size(); market++) {
+            price_watch.Update(static_cast<int>(market), listings[market].price_info().recent_price(),
+                               [this](AITrader* trader) { Wake(trader); });
+          }
+        });
+  }
+};
+
+#endif  // OUTERSPATIALENGINE_TRADER_HOST_H
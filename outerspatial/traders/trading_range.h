@@ -0,0 +1,145 @@
+#ifndef OUTERSPATIALENGINE_TRADING_RANGE_H
+#define OUTERSPATIALENGINE_TRADING_RANGE_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Fixed-capacity double-ended queue over a ring; never allocates after construction
+template<typename T>
+class FixedDeque {
+public:
+  explicit FixedDeque(std::size_t capacity)
+      : items(capacity) {};
+  bool empty() const {
+    return count == 0;
+  }
+  std::size_t size() const {
+    return count;
+  }
+  T& front() {
+    return items[head];
+  }
+  const T& front() const {
+    return items[head];
+  }
+  const T& operator[](std::size_t i) const {
+    return items[(head + i) % items.size()];
+  }
+  T& back() {
+    return items[(head + count - 1) % items.size()];
+  }
+  void push_back(const T& item) {
+    items[(head + count) % items.size()] = item;
+    count++;
+  }
+  void pop_front() {
+    head = (head + 1) % items.size();
+    count--;
+  }
+  void pop_back() {
+    count--;
+  }
+  void clear() {
+    head = 0;
+    count = 0;
+  }
+private:
+  std::vector<T> items;
+  std::size_t head = 0;
+  std::size_t count = 0;
+};
+
+// Min and max of the last `capacity` units traded.
+// A fill of n units at one price is stored as a single weighted run rather than n copies, and the
+// oldest run is trimmed (or evicted) as new units push it out of the window. Monotonic deques of runs
+// keep the current min and max at their fronts, so Add and Range are O(1) amortised whatever the fill
+// size, and nothing is allocated after construction.
+class TradingRange {
+public:
+  explicit TradingRange(int capacity = 50)
+      : capacity(capacity > 0 ? capacity : 1)
+      , runs(this->capacity + 1)
+      , mins(this->capacity + 1)
+      , maxs(this->capacity + 1) {};
+
+  void Add(double price, int units) {
+    if (units <= 0) {
+      return;
+    }
+    if (units >= capacity) {
+      // pushes out everything already in the window
+      runs.clear();
+      mins.clear();
+      maxs.clear();
+      total = 0;
+      units = capacity;
+    }
+    Run run{price, units, next_sequence++};
+    runs.push_back(run);
+    total += units;
+    while (!mins.empty() && mins.back().price >= price) {
+      mins.pop_back();
+    }
+    mins.push_back(run);
+    while (!maxs.empty() && maxs.back().price <= price) {
+      maxs.pop_back();
+    }
+    maxs.push_back(run);
+
+    while (total > capacity) {
+      Run& oldest = runs.front();
+      int excess = total - capacity;
+      if (oldest.units > excess) {
+        oldest.units -= excess;
+        total -= excess;
+        break;
+      }
+      total -= oldest.units;
+      if (mins.front().sequence == oldest.sequence) {
+        mins.pop_front();
+      }
+      if (maxs.front().sequence == oldest.sequence) {
+        maxs.pop_front();
+      }
+      runs.pop_front();
+    }
+  }
+
+  bool empty() const {
+    return total == 0;
+  }
+
+  // Calls visit(price, units) for every run in the window, oldest first. Adding the same runs to an
+  // empty TradingRange of the same capacity rebuilds this one.
+  template<typename Visit>
+  void ForEachRun(Visit visit) const {
+    for (std::size_t i = 0; i < runs.size(); i++) {
+      visit(runs[i].price, runs[i].units);
+    }
+  }
+
+  // {min, max} over the window, or {0, 0} if nothing has been traded
+  std::pair<double, double> Range() const {
+    if (empty()) {
+      return {0, 0};
+    }
+    return {mins.front().price, maxs.front().price};
+  }
+
+private:
+  struct Run {
+    double price = 0;
+    int units = 0;
+    std::uint64_t sequence = 0;
+  };
+
+  int capacity;
+  int total = 0;
+  std::uint64_t next_sequence = 0;
+  FixedDeque<Run> runs;
+  FixedDeque<Run> mins; // increasing prices, oldest first
+  FixedDeque<Run> maxs; // decreasing prices, oldest first
+};
+
+#endif  // OUTERSPATIALENGINE_TRADING_RANGE_H
@@ -0,0 +1,92 @@
+#undef NDEBUG  // the checks are asserts
+#include <algorithm>
+#include <cassert>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "trading_range.h"
+
+// FixedDeque against std::deque, and TradingRange against the min and max of the last `capacity`
+// units kept one by one.
+
+void TestFixedDeque() {
+  std::mt19937 gen(1);
+  const std::size_t CAPACITY = 7;
+  FixedDeque<int> ring(CAPACITY);
+  std::deque<int> naive;
+  for (int step = 0; step < 20000; step++) {
+    int action = std::uniform_int_distribution<int>(0, 3)(gen);
+    if (action <= 1 && naive.size() < CAPACITY) {
+      ring.push_back(step);
+      naive.push_back(step);
+    } else if (action == 2 && !naive.empty()) {
+      ring.pop_front();
+      naive.pop_front();
+    } else if (action == 3 && !naive.empty()) {
+      ring.pop_back();
+      naive.pop_back();
+    }
+    assert(ring.size() == naive.size());
+    assert(ring.empty() == naive.empty());
+    if (!naive.empty()) {
+      assert(ring.front() == naive.front());
+      assert(ring.back() == naive.back());
+    }
+    for (std::size_t i = 0; i < naive.size(); i++) {
+      assert(ring[i] == naive[i]);
+    }
+  }
+  ring.clear();
+  assert(ring.empty());
+}
+
+void TestTradingRange(int capacity, int max_units, unsigned seed) {
+  std::mt19937 gen(seed);
+  std::uniform_int_distribution<int> price(1, 40);
+  std::uniform_int_distribution<int> units(-1, max_units);
+  TradingRange range(capacity);
+  std::deque<double> naive; // one entry per unit, oldest first
+  for (int step = 0; step < 5000; step++) {
+    double p = price(gen)*0.25;
+    int n = units(gen);
+    range.Add(p, n);
+    for (int i = 0; i < n; i++) {
+      naive.push_back(p);
+    }
+    while (naive.size() > static_cast<std::size_t>(capacity)) {
+      naive.pop_front();
+    }
+
+    assert(range.empty() == naive.empty());
+    auto bounds = range.Range();
+    if (naive.empty()) {
+      assert(bounds.first == 0 && bounds.second == 0);
+      continue;
+    }
+    assert(bounds.first == *std::min_element(naive.begin(), naive.end()));
+    assert(bounds.second == *std::max_element(naive.begin(), naive.end()));
+
+    // The weighted runs expand back to the naive window, and replaying them rebuilds the range
+    std::vector<double> expanded;
+    TradingRange rebuilt(capacity);
+    range.ForEachRun([&](double run_price, int run_units) {
+      assert(run_units > 0);
+      expanded.insert(expanded.end(), run_units, run_price);
+      rebuilt.Add(run_price, run_units);
+    });
+    assert(std::equal(expanded.begin(), expanded.end(), naive.begin(), naive.end()));
+    assert(rebuilt.Range() == bounds);
+  }
+}
+
+int main() {
+  TestFixedDeque();
+  TestTradingRange(50, 3, 1);    // mostly single-unit fills
+  TestTradingRange(50, 30, 2);   // runs trimmed and evicted
+  TestTradingRange(10, 25, 3);   // fills that push out the whole window
+  TestTradingRange(1, 2, 4);
+  std::cout << "trading_range_test passed" << std::endl;
+  return 0;
+}
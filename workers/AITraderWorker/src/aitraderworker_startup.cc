@@ -20,21 +20,19 @@
 // Used to make a worker::ComponentRegistry.
 using ComponentRegistry =
 worker::Schema<
-    market::MetalMarket,
-    market::FoodMarket,
-    market::FertilizerMarket,
-    market::WoodMarket,
-    market::MetalMarket,
-    market::OreMarket,
-    market::ToolsMarket,
+    market::MarketSnapshot,
+    market::RecipeRegistry,
     market::RegisterCommandComponent,
     market::MakeOfferCommandComponent,
     market::RequestShutdownComponent,
     market::RequestProductionComponent,
+    market::HandOffCommandComponent,
     market::DemographicInfo,
     trader::Inventory,
     trader::AIBuildings,
     trader::ReportOfferResultComponent,
+    trader::TraderState,
+    trader::HandOffRequestComponent,
     sample::LoginListenerSet,
     sample::PositionSet,
     improbable::Interest,
@@ -182,51 +180,50 @@ int main(int argc, char** argv) {
       });
   // MY STUFF STARTS HERE
 
-  using RegisterTraderCommand = market::RegisterCommandComponent::Commands::RegisterCommand;
   int ah_id = 10;
-  auto rng_gen = std::mt19937(std::random_device()());
 
   const int TARGET_TICK_TIME_MS = 50;
-  int timedelta_ms;
 
-  std::shared_ptr<AITrader> ai_trader_ptr;
-  messages::AIRole requested_role;
-
-  while (is_connected) {
-    messages::RegisterRequest reg_req{messages::AgentType::AI_TRADER, messages::AIRole::NONE};
-    connection.SendCommandRequest<RegisterTraderCommand>(ah_id, reg_req, {1000});
-    ai_trader_ptr = std::make_shared<AITrader>(connection, *view, ah_id, requested_role, 1000, Log::WARN);
-    connection.SendLogMessage(worker::LogLevel::kInfo, "AITraderWorkerStartup", "Creating new trader of type: " + RoleToString(requested_role));
-    auto last_tick_time = std::chrono::steady_clock::now();
-    while (ai_trader_ptr->status != DESTROYED) {
-      view->Process(connection.GetOpList(kGetOpListTimeoutInMilliseconds));
-
-      ai_trader_ptr->PrintInventory();
-      ai_trader_ptr->TickOnce();
-
-      auto t_now = std::chrono::steady_clock::now();
-      timedelta_ms = std::chrono::duration<double, std::milli>(t_now - last_tick_time)
-          .count();  // Amount of time since last tick, in seconds
-      while (timedelta_ms < TARGET_TICK_TIME_MS) {
-        view->Process(connection.GetOpList(kGetOpListTimeoutInMilliseconds));
-        t_now = std::chrono::steady_clock::now();
-        timedelta_ms = std::chrono::duration<double, std::milli>(t_now - last_tick_time)
-            .count();  // Amount of time since last tick, in milliseconds
-      }
-      last_tick_time = t_now;
+  // Number of AI traders run by this worker process
+  std::size_t population = 1;
+  if (const char* traders_per_worker = std::getenv("OUTERSPATIAL_TRADERS_PER_WORKER")) {
+    population = std::max(1, std::atoi(traders_per_worker));
+  }
+  // Traders run as coroutines when built with OUTERSPATIAL_COROUTINES, and otherwise tick one by one;
+  // either way, OUTERSPATIAL_BATCH_DECISIONS=1 works out each role's offers in one batch per tick instead,
+  // and OUTERSPATIAL_EVENT_DRIVEN=1 lets traders with nothing to offer sleep until something changes
+#if OUTERSPATIAL_HAS_COROUTINES
+  TraderHost::Mode mode = TraderHost::COROUTINES;
+#else
+  TraderHost::Mode mode = TraderHost::TICKED;
+#endif
+  if (const char* batch = std::getenv("OUTERSPATIAL_BATCH_DECISIONS")) {
+    if (std::atoi(batch) != 0) {
+      mode = TraderHost::BATCHED;
     }
-
-    std::cout << "Worker destroyed! Creating replacement..." << std::endl;
-    //terrible hack to give "shutdown confirmed" message time to send
-    ai_trader_ptr.reset();
-    connection.AlphaFlush();
-
-    view.reset();
-    view = std::make_unique<worker::View>(ComponentRegistry{});
-    view->OnDisconnect([&](const worker::DisconnectOp& op) {
-      std::cerr << "[disconnect] " << op.Reason << std::endl;
-      is_connected = false;
-    });
+  }
+  if (const char* event_driven = std::getenv("OUTERSPATIAL_EVENT_DRIVEN")) {
+    if (std::atoi(event_driven) != 0) {
+      mode = TraderHost::EVENT_DRIVEN;
+    }
+  }
+  // OUTERSPATIAL_COHORT_SIZE=K makes each hosted trader a cohort standing for K traders of its role
+  std::int32_t cohort_members = 1;
+  if (const char* cohort_size = std::getenv("OUTERSPATIAL_COHORT_SIZE")) {
+    cohort_members = std::max(1, std::atoi(cohort_size));
+  }
+  // Traders all touch the View, so their ticks run on the executor's main lane (this thread)
+  Executor executor;
+  TraderHost host(connection, *view, executor, ah_id, population, TARGET_TICK_TIME_MS, 1000, Log::WARN, mode,
+                  cohort_members);
+  connection.SendLogMessage(worker::LogLevel::kInfo, "AITraderWorkerStartup",
+                            "Hosting " + std::to_string(population) + " trader(s)" +
+                            (cohort_members > 1 ? " of " + std::to_string(cohort_members) + " members each" : ""));
+
+  // Block on the connection until either ops arrive or the next tick is due
+  while (is_connected) {
+    int wait_ms = executor.RunMain(kGetOpListTimeoutInMilliseconds);
+    view->Process(connection.GetOpList(wait_ms));
   }
   return ErrorExitStatus;
 }
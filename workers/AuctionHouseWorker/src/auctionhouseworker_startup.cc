@@ -23,21 +23,19 @@
 // Used to make a worker::ComponentRegistry.
 using ComponentRegistry =
     worker::Schema<
-        market::MetalMarket,
-        market::FoodMarket,
-        market::FertilizerMarket,
-        market::WoodMarket,
-        market::MetalMarket,
-        market::OreMarket,
-        market::ToolsMarket,
+        market::MarketSnapshot,
+        market::RecipeRegistry,
         market::DemographicInfo,
         market::RegisterCommandComponent,
         market::MakeOfferCommandComponent,
         market::RequestShutdownComponent,
         market::RequestProductionComponent,
+        market::HandOffCommandComponent,
         trader::Inventory,
         trader::AIBuildings,
         trader::ReportOfferResultComponent,
+        trader::TraderState,
+        trader::HandOffRequestComponent,
         sample::LoginListenerSet,
         sample::PositionSet,
         improbable::Interest,
@@ -197,7 +195,21 @@ int main(int argc, char** argv) {
   const int TARGET_TICK_TIME_MS = 10;
 
   auto AH_ptr = std::make_shared<AuctionHouse>(connection, view, 10, TARGET_TICK_TIME_MS, Log::INFO);
-  auto last_tick_time = std::chrono::steady_clock::now();
+  // Optionally keep market history on disk, so it survives restarts and can be read by other local processes.
+  // There is no retention: every AH tick (10 ms) appends one 16-byte record per commodity to each of the six
+  // series (prices_food.bin and so on), so the files only ever grow - about 140 MB per file per day of running.
+  // Rotate or delete them from outside while the AH is stopped.
+  if (const char* history_dir = std::getenv("OUTERSPATIAL_HISTORY_DIR")) {
+    AH_ptr->history.persist(history_dir);
+    connection.SendLogMessage(worker::LogLevel::kInfo, "AuctionHouse",
+                              std::string("Persisting market history to ") + history_dir);
+  }
+  // Market components are published on their own (slower) cadence, and only when they change
+  if (const char* publish_interval = std::getenv("OUTERSPATIAL_PUBLISH_INTERVAL_MS")) {
+    ah::PublishPolicy policy;
+    policy.publish_interval_ms = std::atoi(publish_interval);
+    AH_ptr->SetPublishPolicy(policy);
+  }
   Commodity food("food", 0.5, 3010);
   Commodity wood("wood", 1, 3011);
   Commodity fertilizer("fertilizer", 0.1, 3012);
@@ -213,24 +225,12 @@ int main(int argc, char** argv) {
   AH_ptr->RegisterCommodity(tools);
 
 
-  int timedelta_ms;
+  Executor executor;
+  AH_ptr->Schedule(executor);
+  // Block on the connection until either ops arrive or the next tick is due
   while (is_connected) {
-    view.Process(connection.GetOpList(kGetOpListTimeoutInMilliseconds));
-
-    AH_ptr->TickOnce();
-
-
-    auto t_now = std::chrono::steady_clock::now();
-    timedelta_ms = std::chrono::duration<double, std::milli>(t_now - last_tick_time)
-                        .count();  // Amount of time since last tick, in milliseconds
-
-    while (timedelta_ms < TARGET_TICK_TIME_MS) {
-      view.Process(connection.GetOpList(kGetOpListTimeoutInMilliseconds));
-      t_now = std::chrono::steady_clock::now();
-      timedelta_ms = std::chrono::duration<double, std::milli>(t_now - last_tick_time)
-          .count();  // Amount of time since last tick, in milliseconds
-    }
-    last_tick_time = t_now;
+    int wait_ms = executor.RunMain(kGetOpListTimeoutInMilliseconds);
+    view.Process(connection.GetOpList(wait_ms));
   }
 
   return ErrorExitStatus;
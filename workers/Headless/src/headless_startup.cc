@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <improbable/worker.h>
+
+// Schema includes
+#include <improbable/restricted/system_components.h>
+#include <improbable/standard_library.h>
+#include <market.h>
+#include <trader.h>
+
+#include "../../outerspatial/outerspatial_engine.h"
+
+// The auction house and AI trader workers in a single process, with no SpatialOS deployment: they
+// connect to an in-process local::Runtime instead (OUTERSPATIAL_HEADLESS, see
+// outerspatial/common/transport.h), so every command and update goes through the same handlers as
+// in a deployment. For profiling, benchmarks and soak tests.
+//
+// Configured like the workers it stands in for (OUTERSPATIAL_TRADERS_PER_WORKER and friends), plus:
+//   OUTERSPATIAL_HEADLESS_SECONDS        how long to simulate (default 60; 0 runs until killed)
+//   OUTERSPATIAL_HEADLESS_TRADER_WORKERS AITraderWorker loops, each on a thread of its own (default 0:
+//                                        the traders share the AH's connection and thread)
+//   OUTERSPATIAL_HEADLESS_LATENCY_MS     delay before any op reaches its worker (default 0)
+//   OUTERSPATIAL_HEADLESS_TURBO          1 to run on simulated time, as fast as the CPU allows: once every
+//                                        op has been handled, time skips straight to the next timer due.
+//                                        Everything runs on one thread, with no latency.
+//   OUTERSPATIAL_REPORT_INTERVAL_MS      how often to print progress (default 10000)
+
+const std::uint32_t kGetOpListTimeoutInMilliseconds = 100;
+const worker::EntityId kAuctionHousePartitionId = 3;
+const int kAuctionHouseId = 10;
+
+using AssignPartitionCommand = improbable::restricted::Worker::Commands::AssignPartition;
+
+int EnvInt(const char* name, int fallback) {
+  const char* value = std::getenv(name);
+  return value ? std::atoi(value) : fallback;
+}
+
+// The component sets whose authority decides where commands go, as in schema
+void AddComponentSets(local::Runtime& runtime) {
+  runtime.AddComponentSet(3020, {market::RegisterCommandComponent::ComponentId,
+                                 market::MakeOfferCommandComponent::ComponentId,
+                                 market::RequestProductionComponent::ComponentId,
+                                 market::RequestShutdownComponent::ComponentId,
+                                 market::HandOffCommandComponent::ComponentId,
+                                 market::DemographicInfo::ComponentId,
+                                 market::MarketSnapshot::ComponentId,
+                                 market::RecipeRegistry::ComponentId});
+  runtime.AddComponentSet(4004, {trader::Inventory::ComponentId,
+                                 trader::AIBuildings::ComponentId,
+                                 trader::TraderState::ComponentId,
+                                 improbable::AuthorityDelegation::ComponentId});
+  runtime.AddComponentSet(4005, {trader::Metadata::ComponentId,
+                                 improbable::Interest::ComponentId,
+                                 trader::ReportOfferResultComponent::ComponentId,
+                                 trader::HandOffRequestComponent::ComponentId});
+}
+
+// As in AITraderWorker
+struct TraderConfig {
+  static constexpr int TICK_TIME_MS = 50;
+
+  std::size_t population = std::max(1, EnvInt("OUTERSPATIAL_TRADERS_PER_WORKER", 1));
+#if OUTERSPATIAL_HAS_COROUTINES
+  TraderHost::Mode mode = TraderHost::COROUTINES;
+#else
+  TraderHost::Mode mode = TraderHost::TICKED;
+#endif
+  std::int32_t cohort_members = std::max(1, EnvInt("OUTERSPATIAL_COHORT_SIZE", 1));
+
+  TraderConfig() {
+    if (EnvInt("OUTERSPATIAL_BATCH_DECISIONS", 0) != 0) {
+      mode = TraderHost::BATCHED;
+    }
+    if (EnvInt("OUTERSPATIAL_EVENT_DRIVEN", 0) != 0) {
+      mode = TraderHost::EVENT_DRIVEN;
+    }
+  }
+  std::unique_ptr<TraderHost> Host(local::Connection& connection, local::View& view, Executor& executor,
+                                   const SimClock& clock) const {
+    return std::make_unique<TraderHost>(connection, view, executor, kAuctionHouseId, population, TICK_TIME_MS, 1000,
+                                        Log::WARN, mode, cohort_members, clock);
+  }
+};
+
+// The AITraderWorker loop, on a connection of its own
+void RunTraderWorker(local::Runtime& runtime, int index, const TraderConfig& config, std::atomic<std::size_t>& active,
+                     const std::atomic<bool>& running) {
+  local::Connection connection(runtime, "AITraderWorker" + std::to_string(index));
+  local::View view;
+  Executor executor;
+  auto host = config.Host(connection, view, executor, SimClock::Wall());
+  while (running) {
+    int wait_ms = executor.RunMain(kGetOpListTimeoutInMilliseconds);
+    view.Process(connection.GetOpList(wait_ms));
+    active = host->active();
+  }
+}
+
+int main() {
+  bool turbo = EnvInt("OUTERSPATIAL_HEADLESS_TURBO", 0) != 0;
+  int trader_workers = std::max(0, EnvInt("OUTERSPATIAL_HEADLESS_TRADER_WORKERS", 0));
+  int latency_ms = std::max(0, EnvInt("OUTERSPATIAL_HEADLESS_LATENCY_MS", 0));
+  if (turbo && (trader_workers > 0 || latency_ms > 0)) {
+    std::cerr << "[headless] Turbo mode runs on one thread with no latency; ignoring "
+                 "OUTERSPATIAL_HEADLESS_TRADER_WORKERS and OUTERSPATIAL_HEADLESS_LATENCY_MS" << std::endl;
+    trader_workers = 0;
+    latency_ms = 0;
+  }
+  LogicalClock simulated_clock(SimClock::Wall().NowMs());
+  const SimClock& clock = turbo ? static_cast<const SimClock&>(simulated_clock) : SimClock::Wall();
+
+  // In turbo, command timeouts run on simulated time too
+  local::Runtime runtime(latency_ms, turbo ? &simulated_clock : nullptr);
+  AddComponentSets(runtime);
+
+  // The AuctionHouseWorker loop runs on this thread
+  local::Connection connection(runtime, "AuctionHouseWorker");
+  local::View view;
+  connection.SendCommandRequest<AssignPartitionCommand>(connection.GetWorkerEntityId(), {kAuctionHousePartitionId}, {});
+
+  const int AH_TICK_TIME_MS = 10;
+  AuctionHouse auction_house(connection, view, kAuctionHouseId, AH_TICK_TIME_MS, Log::WARN, clock);
+  if (const char* publish_interval = std::getenv("OUTERSPATIAL_PUBLISH_INTERVAL_MS")) {
+    ah::PublishPolicy policy;
+    policy.publish_interval_ms = std::atoi(publish_interval);
+    auction_house.SetPublishPolicy(policy);
+  }
+  auction_house.RegisterCommodity(Commodity("food", 0.5, 3010));
+  auction_house.RegisterCommodity(Commodity("wood", 1, 3011));
+  auction_house.RegisterCommodity(Commodity("fertilizer", 0.1, 3012));
+  auction_house.RegisterCommodity(Commodity("ore", 1, 3013));
+  auction_house.RegisterCommodity(Commodity("metal", 1, 3014));
+  auction_house.RegisterCommodity(Commodity("tools", 1, 3015));
+
+  Executor executor(0, 1, turbo ? &simulated_clock : nullptr);
+  auction_house.Schedule(executor);
+
+  TraderConfig trader_config;
+  std::unique_ptr<TraderHost> host;
+  if (trader_workers == 0) {
+    host = trader_config.Host(connection, view, executor, clock);
+  }
+  std::atomic<bool> running{true};
+  std::vector<std::atomic<std::size_t>> active(trader_workers);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < trader_workers; i++) {
+    threads.emplace_back(RunTraderWorker, std::ref(runtime), i, std::cref(trader_config), std::ref(active[i]),
+                         std::cref(running));
+  }
+
+  using Clock = std::chrono::steady_clock;
+  auto start = Clock::now();
+  std::int64_t start_ms = clock.NowMs();
+  auto report = [&] {
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    double simulated_seconds = (clock.NowMs() - start_ms) / 1000.0;
+    std::size_t traders = host ? host->active() : 0;
+    for (const auto& worker_active : active) {
+      traders += worker_active;
+    }
+    std::uint64_t ops = runtime.OpsDelivered();
+    std::cout << "[headless] " << simulated_seconds << "s simulated in " << seconds << "s: " << traders << "/" << trader_config.population*std::max(1, trader_workers)
+              << " traders active, " << auction_house.Ticks() << " AH ticks, " << ops << " ops ("
+              << ops / std::max(seconds, 1e-3) << "/s)" << std::endl;
+  };
+  executor.Every(std::max(1, EnvInt("OUTERSPATIAL_REPORT_INTERVAL_MS", 10000)), 0, report);
+
+  int run_seconds = EnvInt("OUTERSPATIAL_HEADLESS_SECONDS", 60);
+  std::int64_t stop_ms = start_ms + run_seconds*std::int64_t(1000);
+  while (run_seconds <= 0 || clock.NowMs() < stop_ms) {
+    int wait_ms = executor.RunMain(kGetOpListTimeoutInMilliseconds);
+    if (!turbo) {
+      view.Process(connection.GetOpList(wait_ms));
+      continue;
+    }
+    auto ops = connection.GetOpList(0);
+    if (!ops.empty()) {
+      view.Process(ops);
+    } else if (wait_ms > 0) {
+      simulated_clock.Advance(wait_ms);
+    }
+  }
+  running = false;
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  report();
+  return 0;
+}
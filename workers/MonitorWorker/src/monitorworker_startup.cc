@@ -27,13 +27,8 @@
 // common components
 using ComponentRegistry =
 worker::Schema<
-    market::MetalMarket,
-    market::FoodMarket,
-    market::FertilizerMarket,
-    market::WoodMarket,
-    market::MetalMarket,
-    market::OreMarket,
-    market::ToolsMarket,
+    market::MarketSnapshot,
+    market::RecipeRegistry,
     market::RegisterCommandComponent,
     market::MakeOfferCommandComponent,
     market::RequestShutdownComponent,